@@ -0,0 +1,223 @@
+#include "BlockReader.h"
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <system_error>
+#include <thread>
+
+using namespace std;
+
+static int _ringSetup(unsigned entries, io_uring_params *params) {
+    return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int _ringEnter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+}
+
+// the kernel updates the other side of each ring concurrently
+static unsigned _loadAcquire(const unsigned *p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static void _storeRelease(unsigned *p, unsigned value) {
+    __atomic_store_n(p, value, __ATOMIC_RELEASE);
+}
+
+BlockReader::~BlockReader() {
+    closeRing();
+}
+
+bool BlockReader::setupRing() {
+    io_uring_params params{};
+    this->ring_fd = _ringSetup(BLOCK_READER_RING_ENTRIES, &params);
+    if (this->ring_fd == -1) {
+        return false;
+    }
+    this->sq_entries = params.sq_entries;
+    this->cq_entries = params.cq_entries;
+    this->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    this->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+        this->sq_ring_size = this->cq_ring_size = std::max(this->sq_ring_size, this->cq_ring_size);
+    }
+    this->sq_ring = mmap(nullptr, this->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         this->ring_fd, IORING_OFF_SQ_RING);
+    if (this->sq_ring == MAP_FAILED) {
+        this->sq_ring = nullptr;
+        return false;
+    }
+    if (single_mmap) {
+        this->cq_ring = this->sq_ring;
+    } else {
+        this->cq_ring = mmap(nullptr, this->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                             this->ring_fd, IORING_OFF_CQ_RING);
+        if (this->cq_ring == MAP_FAILED) {
+            this->cq_ring = nullptr;
+            return false;
+        }
+    }
+    this->sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    void *sqes_map = mmap(nullptr, this->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                          this->ring_fd, IORING_OFF_SQES);
+    if (sqes_map == MAP_FAILED) {
+        return false;
+    }
+    this->sqes = static_cast<io_uring_sqe *>(sqes_map);
+
+    char *sq = static_cast<char *>(this->sq_ring), *cq = static_cast<char *>(this->cq_ring);
+    this->sq_head = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+    this->sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    this->sq_mask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    this->sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    this->cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    this->cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    this->cq_mask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    this->cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+    return true;
+}
+
+void BlockReader::closeRing() {
+    if (this->sqes != nullptr) {
+        munmap(this->sqes, this->sqes_size);
+        this->sqes = nullptr;
+    }
+    if (this->cq_ring != nullptr && this->cq_ring != this->sq_ring) {
+        munmap(this->cq_ring, this->cq_ring_size);
+    }
+    this->cq_ring = nullptr;
+    if (this->sq_ring != nullptr) {
+        munmap(this->sq_ring, this->sq_ring_size);
+        this->sq_ring = nullptr;
+    }
+    if (this->ring_fd != -1) {
+        close(this->ring_fd);
+        this->ring_fd = -1;
+    }
+}
+
+// keeps up to a ring's worth of reads outstanding, refilling the submission queue as completions arrive;
+// returns false, with nothing left in the kernel, if the ring refuses the very first submission
+bool BlockReader::readRing(std::vector<BlockRead> &reads) {
+    // IORING_OP_READV rather than IORING_OP_READ, which needs 5.6
+    vector<iovec> vectors(reads.size());
+    size_t queued = 0, completed = 0;
+    const unsigned start = _loadAcquire(this->sq_head);
+    while (completed < reads.size()) {
+        unsigned tail = *this->sq_tail;
+        // completions are bounded by the reads outstanding, so the completion queue never overflows
+        while (queued < reads.size() && queued - completed < this->cq_entries &&
+               tail - _loadAcquire(this->sq_head) < this->sq_entries) {
+            BlockRead &read = reads[queued];
+            vectors[queued] = {read.buffer, read.len};
+            unsigned index = tail & *this->sq_mask;
+            io_uring_sqe *sqe = &this->sqes[index];
+            memset(sqe, 0, sizeof *sqe);
+            sqe->opcode = IORING_OP_READV;
+            sqe->fd = read.fd;
+            sqe->off = read.offset;
+            sqe->addr = (unsigned long) &vectors[queued];
+            sqe->len = 1;
+            sqe->user_data = queued;
+            this->sq_array[index] = index;
+            tail++;
+            queued++;
+        }
+        _storeRelease(this->sq_tail, tail);
+        // entries the kernel did not take on an interrupted call stay queued for the next one
+        if (_ringEnter(this->ring_fd, tail - _loadAcquire(this->sq_head), 1, IORING_ENTER_GETEVENTS) == -1 &&
+            errno != EINTR && errno != EAGAIN && errno != EBUSY && _loadAcquire(this->sq_head) == start) {
+            _storeRelease(this->sq_tail, start);
+            return false;
+        }
+        unsigned head = *this->cq_head;
+        while (head != _loadAcquire(this->cq_tail)) {
+            io_uring_cqe *cqe = &this->cqes[head & *this->cq_mask];
+            BlockRead &read = reads[cqe->user_data];
+            read.result = cqe->res;
+            // a short read before the end of the file only happens on signals; finish it synchronously
+            if (cqe->res > 0 && (size_t) cqe->res < read.len) {
+                ssize_t more = pread(read.fd, read.buffer + cqe->res, read.len - cqe->res, read.offset + cqe->res);
+                if (more > 0) {
+                    read.result += more;
+                }
+            }
+            head++;
+            completed++;
+        }
+        _storeRelease(this->cq_head, head);
+    }
+    return true;
+}
+
+void BlockReader::readThreads(std::vector<BlockRead> &reads) {
+    atomic<size_t> next{0};
+    auto worker = [&reads, &next]() {
+        for (size_t i = next++; i < reads.size(); i = next++) {
+            BlockRead &read = reads[i];
+            read.result = 0;
+            size_t done = 0;
+            while (done < read.len) {
+                ssize_t res = pread(read.fd, read.buffer + done, read.len - done, read.offset + done);
+                if (res == -1 && errno == EINTR) {
+                    continue;
+                }
+                if (res == -1) {
+                    read.result = -errno;
+                    break;
+                }
+                if (res == 0) {
+                    break;
+                }
+                done += res;
+            }
+            if (read.result >= 0) {
+                read.result = done;
+            }
+        }
+    };
+    size_t threads = std::min<size_t>(reads.size(), BLOCK_READER_MAX_THREADS);
+    vector<thread> pool;
+    // the calling thread is one of the workers
+    for (size_t i = 1; i < threads; i++) {
+        try {
+            pool.emplace_back(worker);
+        } catch (const system_error &) {
+            // fewer workers only make it slower
+            break;
+        }
+    }
+    worker();
+    for (auto &t: pool) {
+        t.join();
+    }
+}
+
+void BlockReader::readAll(std::vector<BlockRead> &reads) {
+    if (reads.empty()) {
+        return;
+    }
+    // a single read gains nothing from a ring, and setting one up costs several syscalls
+    if (reads.size() > 1 && !this->ring_tried) {
+        this->ring_tried = true;
+        if (getenv(BLOCK_READER_DISABLE_ENV) == nullptr && !setupRing()) {
+            closeRing();
+        }
+    }
+    if (usesRing() && reads.size() > 1) {
+        if (readRing(reads)) {
+            return;
+        }
+        closeRing();
+    }
+    readThreads(reads);
+}
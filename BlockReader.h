@@ -0,0 +1,70 @@
+#ifndef SMASH_BLOCK_READER_H_
+#define SMASH_BLOCK_READER_H_
+
+#include <vector>
+#include <sys/types.h>
+
+#define BLOCK_READER_RING_ENTRIES   (128)
+#define BLOCK_READER_MAX_THREADS    (16)
+// set to anything to skip io_uring and always use the thread pool
+#define BLOCK_READER_DISABLE_ENV    "SMASH_NO_IO_URING"
+
+struct BlockRead {
+    int fd;
+    off_t offset;
+    size_t len;
+    char *buffer;
+    // bytes read, short only at end of file, or -errno
+    ssize_t result = 0;
+};
+
+/*
+ * Performs a batch of independent positioned reads at once, so that reading the ends of many cold files costs
+ * about as much as the slowest one rather than the sum of them. The reads are submitted together through an
+ * io_uring set up with raw syscalls (there is no liburing dependency); when the kernel has no io_uring, or it is
+ * disabled, they are spread over a few threads doing pread(2) instead.
+ */
+class BlockReader {
+    // the ring is set up on the first batch of more than one read
+    bool ring_tried = false;
+    int ring_fd = -1;
+    void *sq_ring = nullptr;
+    void *cq_ring = nullptr;
+    size_t sq_ring_size = 0;
+    size_t cq_ring_size = 0;
+    struct io_uring_sqe *sqes = nullptr;
+    size_t sqes_size = 0;
+    unsigned sq_entries = 0;
+    unsigned cq_entries = 0;
+
+    // pointers into the mapped rings
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    bool setupRing();
+
+    void closeRing();
+
+    bool readRing(std::vector<BlockRead> &reads);
+
+    static void readThreads(std::vector<BlockRead> &reads);
+
+public:
+    BlockReader() = default;
+
+    ~BlockReader();
+
+    BlockReader(BlockReader const &) = delete;
+
+    void operator=(BlockReader const &) = delete;
+
+    // returns once every read has completed; failures are reported per read
+    void readAll(std::vector<BlockRead> &reads);
+
+    bool usesRing() const {
+        return this->ring_fd != -1;
+    }
+};
+
+#endif //SMASH_BLOCK_READER_H_
@@ -1,6 +1,13 @@
 
 
 #include "Commands.h"
+#include "BlockReader.h"
+#include "Tee.h"
+#include <poll.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <algorithm>
+#include <array>
 
 
 #if 0
@@ -36,21 +43,122 @@ string trim(const std::string &s) {
 }
 
 
-int _parseCommandLine(const char *cmd_line, char **args) {
+// splits a line into words on unquoted whitespace, removing quotes and backslashes as bash does; quoted tells
+// which words had any (their '*' and '?' are not patterns). False on an unterminated quote, which runs to the end
+static bool _splitWords(const std::string &line, std::vector<std::string> &words,
+                        std::vector<bool> *quoted = nullptr) {
+    bool in_word = false, word_quoted = false;
+    char quote = 0;
+    std::string word;
+    for (size_t i = 0; i < line.size(); i++) {
+        char c = line[i];
+        if (quote == '\'') {
+            if (c == '\'') {
+                quote = 0;
+            } else {
+                word += c;
+            }
+            continue;
+        }
+        if (quote == '"') {
+            if (c == '"') {
+                quote = 0;
+            } else if (c == '\\' && i + 1 < line.size() && strchr("$`\"\\\n", line[i + 1]) != nullptr) {
+                word += line[++i];
+            } else {
+                word += c;
+            }
+            continue;
+        }
+        if (WHITESPACE.find(c) != string::npos) {
+            if (in_word) {
+                words.push_back(std::move(word));
+                if (quoted != nullptr) {
+                    quoted->push_back(word_quoted);
+                }
+                word.clear();
+            }
+            in_word = word_quoted = false;
+            continue;
+        }
+        in_word = true;
+        if (c == '\'' || c == '"') {
+            quote = c;
+            word_quoted = true;
+        } else if (c == '\\' && i + 1 < line.size()) {
+            word += line[++i];
+            word_quoted = true;
+        } else {
+            word += c;
+        }
+    }
+    if (in_word) {
+        words.push_back(std::move(word));
+        if (quoted != nullptr) {
+            quoted->push_back(word_quoted);
+        }
+    }
+    return quote == 0;
+}
+
+// where the line continues after its first count words
+static size_t _skipWords(const std::string &line, int count) {
+    size_t pos = line.find_first_not_of(WHITESPACE);
+    char quote = 0;
+    for (; pos != string::npos && pos < line.size(); pos++) {
+        char c = line[pos];
+        if (quote != 0) {
+            if (c == quote) {
+                quote = 0;
+            } else if (c == '\\' && quote == '"') {
+                pos++;
+            }
+        } else if (c == '\'' || c == '"') {
+            quote = c;
+        } else if (c == '\\') {
+            pos++;
+        } else if (WHITESPACE.find(c) != string::npos) {
+            if (--count == 0) {
+                return pos;
+            }
+            pos = line.find_first_not_of(WHITESPACE, pos) - 1;
+        }
+    }
+    return line.size();
+}
+
+int _parseCommandLine(const char *cmd_line, char ***args) {
     FUNC_ENTRY()
+    std::vector<std::string> words;
+    _splitWords(cmd_line, words);
+    *args = new char *[words.size() + 1];
     int i = 0;
-    std::istringstream iss(trim(string(cmd_line)).c_str());
-    for (std::string s; iss >> s;) {
-        args[i] = (char *) malloc(s.length() + 1);
-        memset(args[i], 0, s.length() + 1);
-        strcpy(args[i], s.c_str());
-        args[++i] = NULL;
+    for (auto &word: words) {
+        (*args)[i] = (char *) malloc(word.length() + 1);
+        memset((*args)[i], 0, word.length() + 1);
+        strcpy((*args)[i], word.c_str());
+        i++;
     }
+    (*args)[i] = NULL;
     return i;
 
     FUNC_EXIT()
 }
 
+// bytes execve() will charge against ARG_MAX for the given vector
+size_t _argvSize(char *const *argv) {
+    size_t size = 0;
+    for (; argv != nullptr && *argv != nullptr; argv++) {
+        size += strlen(*argv) + 1 + ARG_POINTER_OVERHEAD;
+    }
+    return size;
+}
+
+size_t _argMax() {
+    static long arg_max = sysconf(_SC_ARG_MAX);
+    return arg_max > 0 ? (size_t) arg_max : _POSIX_ARG_MAX;
+}
+
 bool _isBackgroundComamnd(const char *cmd_line) {
     const string str(cmd_line);
     return str[str.find_last_not_of(WHITESPACE)] == '&';
@@ -75,10 +183,158 @@ void _removeBackgroundSign(char *cmd_line) {
 }
 
 
+std::string _withoutBackgroundSign(const std::string &cmd_line) {
+    std::string stripped = cmd_line;
+    _removeBackgroundSign(&stripped[0]);
+    return string(stripped.c_str());
+}
+
+// lines without substitutions, escapes or assignments can be exec'd without bash (quotes are removed and globs
+// expanded here); expanded variables come quoted, so they still run directly
+bool _isSimpleCommand(const std::string &cmd_s) {
+    if (cmd_s.find_first_of("\\~$<>|&;(){}`#") != string::npos) {
+        return false;
+    }
+    string firstWord = cmd_s.substr(0, cmd_s.find_first_of(WHITESPACE));
+    return firstWord.find('=') == string::npos;
+}
+
+// NAME=value, where value is a single word whose quotes are removed into the value
+bool _isAssignment(const std::string &cmd_s, std::string &name, std::string &value) {
+    size_t eq = cmd_s.find('=');
+    if (eq == string::npos || !Environment::isValidName(cmd_s.substr(0, eq))) {
+        return false;
+    }
+    std::vector<std::string> words;
+    if (!_splitWords(cmd_s.substr(eq + 1), words) || words.size() > 1 ||
+        (words.empty() && eq + 1 < cmd_s.size())) {
+        return false;
+    }
+    name = cmd_s.substr(0, eq);
+    value = words.empty() ? "" : words[0];
+    return true;
+}
+
+// splits a line on top-level ';', '&&' and '||', returns false if there is nothing to split. An operator with
+// no command before it, or a trailing '&&' or '||', is put in bad_token ("newline" for the end of the line)
+bool _parseChain(const std::string &cmd_s, std::vector<ChainCommand::Link> &links, std::string &bad_token) {
+    ChainOperator op = CHAIN_ALWAYS;
+    size_t start = 0;
+    char quote = 0;
+    bool found = false;
+    for (size_t i = 0; i < cmd_s.size(); i++) {
+        char c = cmd_s[i];
+        if (quote != 0) {
+            if (c == quote) {
+                quote = 0;
+            } else if (c == '\\' && quote == '"') {
+                i++;
+            }
+            continue;
+        }
+        if (c == '\\') {
+            i++;
+            continue;
+        }
+        if (c == '\'' || c == '"') {
+            quote = c;
+            continue;
+        }
+        ChainOperator next_op;
+        size_t op_len;
+        if (c == ';') {
+            next_op = CHAIN_ALWAYS;
+            op_len = 1;
+        } else if (c == '&' && i + 1 < cmd_s.size() && cmd_s[i + 1] == '&') {
+            next_op = CHAIN_AND;
+            op_len = 2;
+        } else if (c == '|' && i + 1 < cmd_s.size() && cmd_s[i + 1] == '|') {
+            next_op = CHAIN_OR;
+            op_len = 2;
+        } else {
+            continue;
+        }
+        string leaf = trim(cmd_s.substr(start, i - start));
+        if (!leaf.empty()) {
+            links.push_back({op, leaf});
+        } else if (bad_token.empty()) {
+            bad_token = cmd_s.substr(i, op_len);
+        }
+        found = true;
+        op = next_op;
+        start = i + op_len;
+        i += op_len - 1;
+    }
+    string leaf = trim(cmd_s.substr(start));
+    if (!leaf.empty()) {
+        links.push_back({op, leaf});
+    } else if (op != CHAIN_ALWAYS && bad_token.empty()) {
+        bad_token = "newline";
+    }
+    return found;
+}
+
+// splits a line on unquoted '|', '|&' and '&|' into its stages; false if a stage is empty
+bool _parsePipeline(const std::string &cmd_s, std::vector<PipeCommand::Stage> &stages) {
+    size_t start = 0;
+    char quote = 0;
+    for (size_t i = 0; i < cmd_s.size(); i++) {
+        char c = cmd_s[i];
+        if (quote != 0) {
+            if (c == quote) {
+                quote = 0;
+            } else if (c == '\\' && quote == '"') {
+                i++;
+            }
+            continue;
+        }
+        if (c == '\\') {
+            i++;
+            continue;
+        }
+        if (c == '\'' || c == '"') {
+            quote = c;
+            continue;
+        }
+        if (c != '|') {
+            continue;
+        }
+        PipeCommand::Stage stage;
+        size_t end = i;
+        if (i > start && cmd_s[i - 1] == '&') {
+            stage.mode = PIPE_BOTH;
+            end = i - 1;
+        } else if (i + 1 < cmd_s.size() && cmd_s[i + 1] == '&') {
+            stage.mode = PIPE_STDERR;
+            i++;
+        }
+        stage.cmd_line = trim(cmd_s.substr(start, end - start));
+        if (stage.cmd_line.empty()) {
+            return false;
+        }
+        stages.push_back(std::move(stage));
+        start = i + 1;
+    }
+    PipeCommand::Stage last;
+    last.cmd_line = trim(cmd_s.substr(start));
+    if (last.cmd_line.empty()) {
+        return false;
+    }
+    stages.push_back(std::move(last));
+    return true;
+}
 
-bool _isRedirectionCmd(std::string rd_cmd) {
-    return (rd_cmd.substr(1, (rd_cmd.length() - 1)).find(">") != string::npos && rd_cmd.at(1) != '>' &&
-            rd_cmd.at(rd_cmd.length() - 1) != '>');
+int _exitStatus(int status) {
+    if (WIFEXITED(status)) {
+        return WEXITSTATUS(status);
+    }
+    if (WIFSIGNALED(status)) {
+        return 128 + WTERMSIG(status);
+    }
+    if (WIFSTOPPED(status)) {
+        return 128 + WSTOPSIG(status);
+    }
+    return 0;
 }
 
 bool _isPipeCmd(std::string rd_cmd) {
@@ -89,52 +345,305 @@ bool _isPipeCmd(std::string rd_cmd) {
 
 SmallShell::SmallShell() {
     this->chprompt = "smash> ";
-    this->plastPwd = new char[COMMAND_ARGS_MAX_LENGTH];
-    this->job_list = JobsList();
+    this->plastPwd = "";
     this->fg_command = nullptr;
     this->shellActive = true;
     this->cmdLine = "";
-    this->timeout_list = new std::vector<TimeoutCommand *>();
     this->timeout_pid = -1;
     this->timeout_cmd_line = "";
+    this->subshell = false;
+    registerBuiltins();
 }
 
 SmallShell::~SmallShell() {
-    delete[] this->plastPwd;
-    delete this->fg_command;
-    delete this->timeout_list;
 }
 
+void SmallShell::registerBuiltins() {
+    registerBuiltin("pwd", [](const char *cmd_line) -> std::unique_ptr<Command> {
+        return std::make_unique<GetCurrDirCommand>(cmd_line);
+    });
+    registerBuiltin("showpid", [](const char *cmd_line) -> std::unique_ptr<Command> {
+        return std::make_unique<ShowPidCommand>(cmd_line);
+    });
+    registerBuiltin("cd", [this](const char *cmd_line) -> std::unique_ptr<Command> {
+        return std::make_unique<ChangeDirCommand>(cmd_line, getPlastPwd());
+    });
+    registerBuiltin("chprompt", [this](const char *cmd_line) -> std::unique_ptr<Command> {
+        char **args;
+        int num_of_args = _parseCommandLine(cmd_line, &args);
+        if (num_of_args == 1) {
+            setChprompt();
+        } else {
+            setChprompt(args[1]);
+        }
+        freeArgs(args, num_of_args);
+        return nullptr;
+    });
+    registerBuiltin("fg", [this](const char *cmd_line) -> std::unique_ptr<Command> {
+        return std::make_unique<ForegroundCommand>(cmd_line, &this->job_list);
+    });
+    registerBuiltin("jobs", [this](const char *cmd_line) -> std::unique_ptr<Command> {
+        return std::make_unique<JobsCommand>(cmd_line, &this->job_list);
+    });
+    registerBuiltin("kill", [this](const char *cmd_line) -> std::unique_ptr<Command> {
+        return std::make_unique<KillCommand>(cmd_line, &this->job_list);
+    });
+    registerBuiltin("bg", [this](const char *cmd_line) -> std::unique_ptr<Command> {
+        return std::make_unique<BackgroundCommand>(cmd_line, &this->job_list);
+    });
+    registerBuiltin("quit", [this](const char *cmd_line) -> std::unique_ptr<Command> {
+        quitShell();
+        return std::make_unique<QuitCommand>(cmd_line, &this->job_list);
+    });
+    registerBuiltin("tail", [](const char *cmd_line) -> std::unique_ptr<Command> {
+        return std::make_unique<TailCommand>(cmd_line);
+    }, true);
+    registerBuiltin("head", [](const char *cmd_line) -> std::unique_ptr<Command> {
+        return std::make_unique<HeadCommand>(cmd_line);
+    }, true);
+    registerBuiltin("tee", [](const char *cmd_line) -> std::unique_ptr<Command> {
+        return std::make_unique<TeeCommand>(cmd_line);
+    }, true);
+    registerBuiltin("sort", [](const char *cmd_line) -> std::unique_ptr<Command> {
+        return std::make_unique<SortCommand>(cmd_line);
+    }, true);
+    registerBuiltin("uniq", [](const char *cmd_line) -> std::unique_ptr<Command> {
+        return std::make_unique<UniqCommand>(cmd_line);
+    }, true);
+    registerBuiltin("touch", [](const char *cmd_line) -> std::unique_ptr<Command> {
+        return std::make_unique<TouchCommand>(cmd_line);
+    });
+    registerBuiltin("timeout", [](const char *cmd_line) -> std::unique_ptr<Command> {
+        return std::make_unique<TimeoutCommand>(cmd_line);
+    });
+    registerBuiltin("wait", [this](const char *cmd_line) -> std::unique_ptr<Command> {
+        return std::make_unique<WaitCommand>(cmd_line, &this->job_list);
+    });
+    // not on a worker: the history is added to by the prompt as it runs
+    registerBuiltin("history", [this](const char *cmd_line) -> std::unique_ptr<Command> {
+        return std::make_unique<HistoryCommand>(cmd_line, &this->history);
+    });
+    registerBuiltin("jobtop", [this](const char *cmd_line) -> std::unique_ptr<Command> {
+        return std::make_unique<JobTopCommand>(cmd_line, &this->job_list);
+    });
+    registerBuiltin("limit", [this](const char *cmd_line) -> std::unique_ptr<Command> {
+        return std::make_unique<LimitCommand>(cmd_line, &this->job_list);
+    });
+    registerBuiltin("trace", [](const char *cmd_line) -> std::unique_ptr<Command> {
+        return std::make_unique<TraceCommand>(cmd_line);
+    });
+    registerBuiltin("batch", [](const char *cmd_line) -> std::unique_ptr<Command> {
+        return std::make_unique<BatchCommand>(cmd_line);
+    });
+    registerBuiltin("export", [](const char *cmd_line) -> std::unique_ptr<Command> {
+        return std::make_unique<ExportCommand>(cmd_line);
+    });
+    registerBuiltin("unset", [](const char *cmd_line) -> std::unique_ptr<Command> {
+        return std::make_unique<UnsetCommand>(cmd_line);
+    });
+    registerBuiltin("alias", [](const char *cmd_line) -> std::unique_ptr<Command> {
+        return std::make_unique<AliasCommand>(cmd_line);
+    });
+    registerBuiltin("unalias", [](const char *cmd_line) -> std::unique_ptr<Command> {
+        return std::make_unique<UnaliasCommand>(cmd_line);
+    });
+    registerBuiltin("load", [](const char *cmd_line) -> std::unique_ptr<Command> {
+        return std::make_unique<LoadCommand>(cmd_line);
+    });
+}
+
+void SmallShell::registerBuiltin(const std::string &name, CommandFactory factory, bool runs_on_worker) {
+    DispatchEntry &entry = this->dispatch[name];
+    entry.builtin = std::move(factory);
+    entry.runs_on_worker = runs_on_worker;
+    this->dispatch_generation++;
+}
+
+const SmallShell::DispatchEntry *SmallShell::simpleBuiltin(const std::string &cmd_line) const {
+    string cmd_s = _withoutBackgroundSign(trim(cmd_line));
+    std::vector<ChainCommand::Link> links;
+    string stripped, bad_token;
+    if (cmd_s.empty() || _parseChain(cmd_s, links, bad_token) || _isPipeCmd(cmd_s)) {
+        return nullptr;
+    }
+    Redirections redirections;
+    if (!Redirections::parse(cmd_s, stripped, redirections, bad_token)) {
+        return nullptr;
+    }
+    stripped = trim(stripped);
+    auto entry = this->dispatch.find(stripped.substr(0, stripped.find_first_of(WHITESPACE)));
+    if (entry == this->dispatch.end() || !entry->second.builtin || entry->second.is_function ||
+        entry->second.is_alias) {
+        return nullptr;
+    }
+    return &entry->second;
+}
+
+bool SmallShell::runsOnWorker(const std::string &cmd_line) const {
+    const DispatchEntry *entry = simpleBuiltin(cmd_line);
+    return entry != nullptr && entry->runs_on_worker;
+}
+
+bool SmallShell::runsInShell(const std::string &cmd_line) const {
+    const DispatchEntry *entry = simpleBuiltin(expandAliases(cmd_line));
+    return entry != nullptr && !entry->runs_on_worker;
+}
+
+std::unique_ptr<WorkerCommand> SmallShell::createWorkerStage(const std::string &cmd_line) {
+    if (!runsOnWorker(cmd_line) || !WorkerPool::instance().reserve()) {
+        return nullptr;
+    }
+    // a stage that fails here falls back to a forked shell, which reports the error itself
+    std::ostringstream discarded;
+    std::ostream *saved = smashError::setStream(&discarded);
+    std::unique_ptr<Command> cmd = CreateCommand(cmd_line.c_str());
+    smashError::setStream(saved);
+    if (cmd == nullptr || cmd->getError()) {
+        WorkerPool::instance().release();
+        return nullptr;
+    }
+    return std::make_unique<WorkerCommand>(std::move(cmd));
+}
+
+void SmallShell::setAlias(const std::string &name, const std::string &value) {
+    DispatchEntry &entry = this->dispatch[name];
+    entry.alias = value;
+    entry.is_alias = true;
+    this->dispatch_generation++;
+}
+
+bool SmallShell::removeAlias(const std::string &name) {
+    auto entry = this->dispatch.find(name);
+    if (entry == this->dispatch.end() || !entry->second.is_alias) {
+        return false;
+    }
+    entry->second.alias.clear();
+    entry->second.is_alias = false;
+    if (!entry->second.builtin && !entry->second.is_function) {
+        this->dispatch.erase(entry);
+    }
+    this->dispatch_generation++;
+    return true;
+}
+
+bool SmallShell::removeFunction(const std::string &name) {
+    auto entry = this->dispatch.find(name);
+    if (entry == this->dispatch.end() || !entry->second.is_function) {
+        return false;
+    }
+    entry->second.function.clear();
+    entry->second.is_function = false;
+    if (!entry->second.builtin && !entry->second.is_alias) {
+        this->dispatch.erase(entry);
+    }
+    this->dispatch_generation++;
+    return true;
+}
+
+std::vector<std::pair<std::string, std::string>> SmallShell::getAliases() const {
+    vector<pair<string, string>> aliases;
+    for (auto &entry: this->dispatch) {
+        if (entry.second.is_alias) {
+            aliases.emplace_back(entry.first, entry.second.alias);
+        }
+    }
+    sort(aliases.begin(), aliases.end());
+    return aliases;
+}
+
+std::vector<std::string> SmallShell::commandNames() const {
+    vector<string> names;
+    names.reserve(this->dispatch.size());
+    for (auto &entry: this->dispatch) {
+        names.push_back(entry.first);
+    }
+    return names;
+}
+
+std::string SmallShell::expandAliases(const std::string &cmd_line) const {
+    string line = ltrim(cmd_line);
+    vector<string> expanded;
+    while (true) {
+        size_t word_end = line.find_first_of(WHITESPACE);
+        string firstWord = line.substr(0, word_end);
+        auto entry = this->dispatch.find(firstWord);
+        if (entry == this->dispatch.end() || !entry->second.is_alias ||
+            find(expanded.begin(), expanded.end(), firstWord) != expanded.end()) {
+            return line;
+        }
+        expanded.push_back(firstWord);
+        line = ltrim(entry->second.alias + (word_end == string::npos ? "" : line.substr(word_end)));
+    }
+}
+
+bool SmallShell::defineFunction(const std::string &cmd_line) {
+    string line = trim(cmd_line);
+    string name;
+    size_t pos;
+    if (line.compare(0, 9, "function ") == 0) {
+        pos = line.find_first_not_of(WHITESPACE, 9);
+        size_t name_end = line.find_first_of(" \t({", pos);
+        if (pos == string::npos || name_end == string::npos) {
+            return false;
+        }
+        name = line.substr(pos, name_end - pos);
+        pos = line.find_first_not_of(WHITESPACE, name_end);
+        if (line.compare(pos, 2, "()") == 0) {
+            pos = line.find_first_not_of(WHITESPACE, pos + 2);
+        }
+    } else {
+        size_t parens = line.find("()");
+        if (parens == string::npos || line.find_first_of(WHITESPACE) < parens) {
+            return false;
+        }
+        name = line.substr(0, parens);
+        pos = line.find_first_not_of(WHITESPACE, parens + 2);
+        // `a=()` and the like are not definitions
+        if (name.empty() || name.find_first_of(COMMAND_NAME_SPECIALS) != string::npos) {
+            return false;
+        }
+    }
+    if (pos == string::npos || line[pos] != '{' || line.back() != '}') {
+        smashError::SyntaxError(pos == string::npos ? "newline" : line.substr(pos, 1));
+        return true;
+    }
+    if (name.find_first_of(COMMAND_NAME_SPECIALS) != string::npos) {
+        smashError::InvalidIdentifier("function", name);
+        return true;
+    }
+    // the body keeps its `$1`s and is expanded only when the function runs
+    string body = trim(line.substr(pos + 1, line.size() - pos - 2));
+    while (!body.empty() && body.back() == ';') {
+        body = rtrim(body.substr(0, body.size() - 1));
+    }
+    if (body.empty()) {
+        smashError::SyntaxError("}");
+        return true;
+    }
+    DispatchEntry &entry = this->dispatch[name];
+    entry.function = body;
+    entry.is_function = true;
+    this->dispatch_generation++;
+    return true;
+}
 
 BuiltInCommand::BuiltInCommand(const char *cmd_line) : Command(cmd_line) {
-    this->args =new char* [COMMAND_MAX_ARGS];
-    this->num_of_args = _parseCommandLine(cmd_line, args);
+    // a trailing '&' belongs to the command line, not to the arguments
+    this->num_of_args = _parseCommandLine(this->bg_cmd.c_str(), &this->args);
 }
 
 Command::Command(const char *cmd_line) {
-    char **args =new char* [COMMAND_MAX_ARGS];
-    int num_of_args = _parseCommandLine(cmd_line, args);
+    char **args;
+    int num_of_args = _parseCommandLine(cmd_line, &args);
     string cmd_s = trim(string(cmd_line));
     string firstWord = cmd_s.substr(0, cmd_s.find_first_of(" \n"));
 
     if (firstWord.compare("timeout") == 0 && num_of_args >2) {
-        std::string new_cmd = "";
-        for (int i = 2; i < num_of_args; i++) {
-            new_cmd += args[i];
-            new_cmd += " ";
-        }
-        this->actual_cmd = new char[new_cmd.length() +1];
-        strcpy(this->actual_cmd, new_cmd.c_str());
-        _removeBackgroundSign(this->actual_cmd);
-    } else {
-        this->actual_cmd = nullptr;
-    }
-    int size = std::string(cmd_line).length();
-    this->cmd_line = new char[size+1];
-    this->bg_cmd = new char[size+1];
-    strcpy(this->cmd_line, cmd_line);
-    strcpy(this->bg_cmd, (cmd_line));
-    _removeBackgroundSign(this->bg_cmd);
+        // the command as written, quotes and all, since bash runs it
+        this->actual_cmd = _withoutBackgroundSign(trim(cmd_s.substr(_skipWords(cmd_s, 2))));
+    }
+    this->cmd_line = cmd_line;
+    this->bg_cmd = _withoutBackgroundSign(this->cmd_line);
     if (_isBackgroundComamnd(cmd_line)) {
         bg_command = true;
     } else {
@@ -148,135 +657,466 @@ Command::Command(const char *cmd_line) {
     freeArgs(args,num_of_args);
 }
 
-Command *SmallShell::CreateCommand(const char *cmd_line) {
+ExternalCommand::ExternalCommand(const char *cmd_line) : Command(cmd_line) {
+    Environment &env = SmallShell::getInstance().getEnvironment();
+    this->envp = env.getEnvp();
+    string cmd_s = trim(string(this->bg_cmd));
+    if (!_isSimpleCommand(cmd_s)) {
+        return;
+    }
+    Glob &glob = SmallShell::getInstance().getGlob();
+    std::vector<std::string> words;
+    std::vector<bool> quoted;
+    if (!_splitWords(cmd_s, words, &quoted)) {
+        // bash reports the unterminated quote
+        return;
+    }
+    for (size_t i = 0; i < words.size(); i++) {
+        vector<string> matches;
+        if (!quoted[i] && Glob::hasMagic(words[i])) {
+            matches = glob.expand(words[i]);
+        }
+        if (matches.empty()) {
+            this->argv_words.push_back(words[i]);
+        } else {
+            this->argv_words.insert(this->argv_words.end(), matches.begin(), matches.end());
+        }
+    }
+    if (this->argv_words.empty()) {
+        return;
+    }
+    for (auto &word: this->argv_words) {
+        this->argv.push_back(&word[0]);
+    }
+    this->argv.push_back(nullptr);
+    if (_argvSize(this->argv.data()) + _argvSize(this->envp) > _argMax()) {
+        smashError::ArgumentListTooLong(this->argv_words[0]);
+        this->setError();
+        return;
+    }
+    this->exec_path = env.findExecutable(this->argv_words[0]);
+}
+
+int Command::openWaitFd() const {
+    return (int) syscall(SYS_pidfd_open, this->cmd_pid, 0);
+}
+
+std::vector<pid_t> Command::processes() const {
+    // a forked command leads its own process group, which takes in whatever it forks in turn
+    std::vector<pid_t> members = processGroupMembers(this->cmd_pid);
+    if (members.empty()) {
+        members.push_back(this->cmd_pid);
+    }
+    return members;
+}
+
+void commandReaped(const Command *cmd, int status) {
+    const struct rusage &usage = cmd->getUsage();
+    Trace::event(TRACE_JOB_FINISH, cmd->getCmdPID(), status, nullptr,
+                 (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000L + usage.ru_utime.tv_usec +
+                 usage.ru_stime.tv_usec);
+    const ResourceLimits &limits = cmd->getLimits();
+    if (limits.empty()) {
+        return;
+    }
+    LimitResource hit = limits.hitBy(status, cmd->getUsage());
+    if (hit == LIMIT_RESOURCES) {
+        return;
+    }
+    OutputSink::standard(STDERR_FILENO) << "smash: process " << cmd->getCmdPID() << " exceeded its "
+                                        << ResourceLimits::name(hit) << " limit of "
+                                        << ResourceLimits::format(hit, limits.get(hit)) << '\n';
+}
+
+// a finished or cancelled worker task's outcome in the form waitpid() reports a process's
+static int _workerStatus(const WorkerTask &task) {
+    if (task.cancelledBy() != 0) {
+        return task.cancelledBy() & 0x7f;
+    }
+    return (task.getExitStatus() & 0xff) << 8;
+}
+
+WorkerCommand::WorkerCommand(std::unique_ptr<Command> builtin) : Command(builtin->getCmdLine()),
+                                                                 builtin(std::move(builtin)) {
+}
+
+WorkerCommand::~WorkerCommand() {
+    if (!WorkerPool::instance().ownsWorkers()) {
+        // a forked child exiting has nothing to wait for
+        return;
+    }
+    if (this->task == nullptr && !getError()) {
+        // never started, as with the stages of a pipeline that failed to set up
+        WorkerPool::instance().release();
+    } else if (this->task != nullptr && !this->task->isFinished()) {
+        this->task->cancel(SIGKILL);
+        reap(nullptr, 0);
+    }
+}
+
+void WorkerCommand::execute() {
+    if (!this->builtin->detachRedirections()) {
+        WorkerPool::instance().release();
+        smashError::SyscallFailed("fcntl");
+        this->setError();
+        return;
+    }
+    Command *cmd = this->builtin.get();
+    this->task = std::make_shared<WorkerTask>([cmd]() {
+        smashError::raised = false;
+        smashError::setStream(&cmd->err());
+        cmd->execute();
+        cmd->flushOutput();
+        int status = cmd->getExitStatus() >= 0 ? cmd->getExitStatus() : (smashError::raised ? 1 : 0);
+        // a pipeline's next stage sees end of input only once every copy of the pipe is closed
+        cmd->closeRedirections();
+        return status;
+    });
+    WorkerPool::instance().start(this->task);
+    this->setCmdPID(this->task->getTid());
+}
+
+int WorkerCommand::sendSignal(int sig_num, bool) {
+    if (this->task == nullptr) {
+        errno = ESRCH;
+        return FAILURE;
+    }
+    // like a zombie, a finished task accepts signals until it is reaped
+    if (this->task->isFinished()) {
+        return SUCCESS;
+    }
+    switch (sig_num) {
+        // including the signals a process ignores by default
+        case 0:
+        case SIGCONT:
+        case SIGCHLD:
+        case SIGWINCH:
+        case SIGURG:
+            return SUCCESS;
+        case SIGSTOP:
+        case SIGTSTP:
+        case SIGTTIN:
+        case SIGTTOU:
+            // a thread can not be stopped on its own
+            errno = ENOTSUP;
+            return FAILURE;
+        default:
+            if (!WorkerPool::instance().ownsWorkers()) {
+                errno = ESRCH;
+                return FAILURE;
+            }
+            this->task->cancel(sig_num);
+            return SUCCESS;
+    }
+}
+
+pid_t WorkerCommand::reap(int *status, int options) {
+    // like waitpid() for a process that is not one's child
+    if (this->task == nullptr || !WorkerPool::instance().ownsWorkers()) {
+        errno = ECHILD;
+        return FAILURE;
+    }
+    SmallShell &smash = SmallShell::getInstance();
+    while (!this->task->isFinished()) {
+        if (options & WNOHANG) {
+            return 0;
+        }
+        pollfd pfd{this->task->getDoneFd(), POLLIN, 0};
+        bool cancelled = this->task->cancelledBy() != 0;
+        int res = poll(&pfd, 1, cancelled || pfd.fd == -1 ? WORKER_WAKE_INTERVAL_MS : -1);
+        if (res == -1 && errno == EINTR && smash.consumeInterrupt()) {
+            this->task->cancel(SIGINT);
+        } else if (res == 0 && cancelled) {
+            this->task->cancel(this->task->cancelledBy());
+        }
+    }
+    if (status != nullptr) {
+        *status = _workerStatus(*this->task);
+    }
+    return this->cmd_pid;
+}
+
+std::vector<pid_t> WorkerCommand::processes() const {
+    return {};
+}
+
+int WorkerCommand::openWaitFd() const {
+    if (this->task == nullptr || this->task->getDoneFd() == -1) {
+        errno = ECHILD;
+        return FAILURE;
+    }
+    return fcntl(this->task->getDoneFd(), F_DUPFD_CLOEXEC, REDIRECT_FDS);
+}
+
+std::unique_ptr<Command> SmallShell::CreateCommand(const char *cmd_line) {
     string cmd_s = trim(string(cmd_line));
     string firstWord = cmd_s.substr(0, cmd_s.find_first_of(" \n"));
 
     this->job_list.removeFinishedJobs();
+    std::vector<ChainCommand::Link> links;
+    std::string chain_s = cmd_s;
+    _removeBackgroundSign(&chain_s[0]);
+    std::string bad_token;
+    if (_parseChain(string(chain_s.c_str()), links, bad_token)) {
+        if (!bad_token.empty()) {
+            smashError::SyntaxError(bad_token);
+            return nullptr;
+        }
+        return std::make_unique<ChainCommand>(cmd_line, links);
+    }
     if (_isPipeCmd(cmd_s)) {
-        std::string cmd1, cmd2;
-        int pos_of_pip_sign = cmd_s.find("|");
-        bool err = false;
-        if (cmd_s.find("|&") != string::npos) {
-            err = true;
-            cmd1 = trim(cmd_s.substr(0, pos_of_pip_sign));
-            cmd2 = trim(cmd_s.substr(pos_of_pip_sign + 2));
-        } else {
-            cmd1 = trim(cmd_s.substr(0, pos_of_pip_sign));
-            cmd2 = trim(cmd_s.substr(pos_of_pip_sign + 1));
+        std::vector<PipeCommand::Stage> stages;
+        if (!_parsePipeline(_withoutBackgroundSign(cmd_s), stages)) {
+            smashError::SyntaxError("|");
+            return nullptr;
+        }
+        // every '|' may have been quoted
+        if (stages.size() > 1) {
+            return std::make_unique<PipeCommand>(cmd_line, std::move(stages));
         }
-        return new PipeCommand(cmd_line, cmd1, cmd2, err);
     }
-    if (_isRedirectionCmd(cmd_s)) {
-        std::string file;
-        std::string rd_cmd;
-
-        int pos_of_rd_sign = cmd_s.find(">");
-        int flags;
-        if (cmd_s.find(">>") != string::npos) {
-            flags = (O_CREAT | O_APPEND | O_WRONLY);
-            file = trim(cmd_s.substr(pos_of_rd_sign + 2));
-            rd_cmd = trim(cmd_s.substr(0, pos_of_rd_sign));
-        } else {
-            flags = (O_CREAT | O_WRONLY | O_TRUNC);
-            file = trim(cmd_s.substr(pos_of_rd_sign + 1));
-            rd_cmd = trim(cmd_s.substr(0, pos_of_rd_sign));
-        }
-        char *f = new char[file.length()];
-        strcpy(f, file.c_str());
-        char *c = new char[rd_cmd.length()];
-        strcpy(c, rd_cmd.c_str());
-        return new RedirectionCommand(cmd_line, c, f, flags);
-    } else if (firstWord.compare("pwd") == 0) {
-        return new GetCurrDirCommand(cmd_line);
-    } else if (firstWord.compare("showpid") == 0) {
-        return new ShowPidCommand(cmd_line);
-    } else if (firstWord.compare("cd") == 0) {
-        if (string(getPlastPwd()).length() > 0) {
-            char *plast = getPlastPwd();
-            return new ChangeDirCommand(cmd_line, &plast);
-        } else {
-            return new ChangeDirCommand(cmd_line, nullptr);
+    Redirections redirections;
+    std::string stripped;
+    if (!Redirections::parse(cmd_s, stripped, redirections, bad_token)) {
+        smashError::SyntaxError(bad_token);
+        return nullptr;
+    }
+    if (!redirections.empty()) {
+        if (!redirections.open()) {
+            smashError::SyscallFailed("open");
+            return nullptr;
         }
-    } else if (firstWord.compare("chprompt") == 0) {
-        char **args =new char* [COMMAND_MAX_ARGS];
-        int num_of_args = _parseCommandLine(cmd_line, args);
-        if (num_of_args == 1) {
-            setChprompt();
-        } else {
-            setChprompt(args[1]);
+        // errors of the command itself already go to its redirected stderr
+        std::ostream *saved = smashError::setStream(&redirections.stream(STDERR_FILENO));
+        std::unique_ptr<Command> cmd = CreateCommand(stripped.c_str());
+        smashError::setStream(saved);
+        if (cmd != nullptr) {
+            cmd->cmd_line = cmd_line;
+            cmd->setRedirections(std::move(redirections));
         }
-        freeArgs(args,num_of_args);
+        return cmd;
+    }
+    auto entry = this->dispatch.find(firstWord);
+    std::string name, value;
+    if (entry != this->dispatch.end() && entry->second.is_function) {
+        return std::make_unique<FunctionCommand>(cmd_line, firstWord, entry->second.function);
+    } else if (entry != this->dispatch.end() && entry->second.builtin) {
+        return entry->second.builtin(cmd_line);
+    } else if (_isAssignment(cmd_s, name, value)) {
+        this->env.set(name, value);
         return nullptr;
-    } else if (firstWord.compare("fg") == 0) {
-        return new ForegroundCommand(cmd_line, &this->job_list);
-    } else if (firstWord.compare("jobs") == 0) {
-        return new JobsCommand(cmd_line, &this->job_list);
-    } else if (firstWord.compare("kill") == 0) {
-        return new KillCommand(cmd_line, &this->job_list);
-    } else if (firstWord.compare("bg") == 0) {
-        return new BackgroundCommand(cmd_line, &this->job_list);
-    } else if (firstWord.compare("quit") == 0) {
-        quitShell();
-        return  new QuitCommand(cmd_line, &this->job_list);
-    } else if (firstWord.compare("tail") == 0) {
-        return new TailCommand(cmd_line);
-    } else if (firstWord.compare("touch") == 0) {
-        return new TouchCommand(cmd_line);
-    } else if (firstWord.compare("timeout") == 0) {
-        return new TimeoutCommand(cmd_line);
     } else {
-        return new ExternalCommand(cmd_line);
+        return std::make_unique<ExternalCommand>(cmd_line);
     }
     return nullptr;
 }
 
-void SmallShell::executeCommand(const char *cmd_line) {
-
-    Command *cmd = CreateCommand(cmd_line);
+void SmallShell::executeCommand(const char *cmd_line, bool expand) {
+    TraceScope trace_scope(cmd_line);
+    smashError::raised = false;
+    // aliases may stand for whole chains, so they are replaced before anything is parsed
+    string aliased = expandAliases(cmd_line);
+    cmd_line = aliased.c_str();
+    if (defineFunction(aliased)) {
+        setLastStatus(smashError::raised ? 1 : 0);
+        OutputSink::flushStandard();
+        return;
+    }
+    string expanded;
+    std::vector<ChainCommand::Link> links;
+    // chain links are expanded one by one so that $? sees the previous link
+    string bad_token;
+    if (expand && !_parseChain(trim(string(cmd_line)), links, bad_token)) {
+        expanded = this->env.expand(cmd_line);
+        cmd_line = expanded.c_str();
+    }
+    std::unique_ptr<Command> cmd = CreateCommand(cmd_line);
     if (cmd == nullptr || cmd->getError()) {
+        setLastStatus(smashError::raised ? 1 : 0);
+        OutputSink::flushStandard();
         return;
     }
 
-    if (typeid(*cmd) == typeid(ExternalCommand) || typeid(*cmd) == typeid(TimeoutCommand))
+    // builtins that may run on a worker go to the background as jobs instead of blocking the prompt
+    if (cmd->bg_command && runsOnWorker(cmd_line) && WorkerPool::instance().reserve()) {
+        OutputSink::flushStandard();
+        // the terminal belongs to the prompt, as it would to a background process in its own group
+        int null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        if (null_fd != OPEN_FAILED && !cmd->attachRedirection(STDIN_FILENO, null_fd)) {
+            close(null_fd);
+        }
+        auto job = std::make_unique<WorkerCommand>(std::move(cmd));
+        job->execute();
+        if (job->getError()) {
+            setLastStatus(1);
+            return;
+        }
+        Trace::event(TRACE_JOB_START, job->getCmdPID(), 0, job->getCmdLine());
+        addJobShell(std::move(job));
+        setLastStatus(0);
+        return;
+    }
+    if (typeid(*cmd) == typeid(PipeCommand)) {
+        // the stages are forked by the pipeline itself, which the shell then treats like a single process
+        cmd->setLimits(this->job_limits);
+        cmd->execute();
+        if (cmd->getError()) {
+            setLastStatus(1);
+            return;
+        }
+        Trace::event(TRACE_JOB_START, cmd->getCmdPID(), 0, cmd->getCmdLine());
+        if (cmd->bg_command) {
+            addJobShell(std::move(cmd));
+            setLastStatus(0);
+        } else {
+            waitForeground(std::move(cmd));
+        }
+        return;
+    }
+    if (typeid(*cmd) == typeid(ExternalCommand) || typeid(*cmd) == typeid(TimeoutCommand) ||
+        ((typeid(*cmd) == typeid(ChainCommand) || typeid(*cmd) == typeid(FunctionCommand)) && cmd->bg_command))
     {
+        // children must not inherit output still sitting in the shell's buffers
+        OutputSink::flushStandard();
+        cmd->setLimits(this->job_limits);
         pid_t pid = fork();
 
         if (pid == -1) {
             smashError::ForkFailed();
+            setLastStatus(1);
+            return;
         }
         if (pid == 0) {
-            setpgrp();
+            if (!this->subshell) {
+                setpgrp();
+            }
+            // a job that can not be limited does not run at all
+            if (!cmd->getLimits().apply()) {
+                smashError::SyscallFailed("setrlimit");
+                OutputSink::flushStandard();
+                _exit(1);
+            }
+            cmd->applyRedirections();
+            if (typeid(*cmd) == typeid(ChainCommand) || typeid(*cmd) == typeid(FunctionCommand)) {
+                enterSubshell();
+                cmd->execute();
+                exit(getLastStatus());
+            }
             cmd->execute();
         } else {
             cmd->setCmdPID(pid);
+            Trace::event(TRACE_JOB_START, pid, 0, cmd->getCmdLine());
+            cmd->closeRedirections();
+            if (typeid(*cmd) == typeid(TimeoutCommand)) {
+                this->addTimeoutCMD(dynamic_cast<TimeoutCommand *>(cmd.get()));
+            }
             if (!cmd->bg_command) {
-                if (typeid(*cmd) == typeid(TimeoutCommand)) {
-                    this->addTimeoutCMD(dynamic_cast<TimeoutCommand *>(cmd));
-                }
-                setActiveCMD(cmd);
-                waitpid(pid, nullptr, WUNTRACED);
+                waitForeground(std::move(cmd));
             } else {
                 setActiveCMD(nullptr);
-                if (typeid(*cmd) == typeid(TimeoutCommand)) {
-                    this->addTimeoutCMD(dynamic_cast<TimeoutCommand *>(cmd));
-                }
-                addJobShell(cmd);
+                addJobShell(std::move(cmd));
+                setLastStatus(0);
             }
         }
     } else {
+        std::ostream *saved = smashError::setStream(&cmd->err());
         cmd->execute();
+        cmd->flushOutput();
+        smashError::setStream(saved);
+        if (dynamic_cast<BuiltInCommand *>(cmd.get()) != nullptr) {
+            if (cmd->getExitStatus() >= 0) {
+                setLastStatus(cmd->getExitStatus());
+            } else {
+                setLastStatus(smashError::raised ? 1 : 0);
+            }
+        }
+    }
+}
+
+void SmallShell::waitForeground(std::unique_ptr<Command> cmd) {
+    setActiveCMD(cmd.get());
+    int status = 0;
+    // a subshell has no job control: a stop is the parent shell's to see, and this copy waits until the
+    // command is continued
+    cmd->reap(&status, this->subshell ? 0 : WUNTRACED);
+    setActiveCMD(nullptr);
+    setLastStatus(_exitStatus(status));
+    if (!WIFSTOPPED(status)) {
+        commandReaped(cmd.get(), status);
+    }
+    // a stopped foreground command becomes a job, anything else is released here
+    if (WIFSTOPPED(status)) {
+        addJobShell(std::move(cmd), true);
+    }
+}
+
+void ChainCommand::execute() {
+    SmallShell &smash = SmallShell::getInstance();
+    for (auto &link: this->links) {
+        if (!smash.getActiveStatus()) {
+            break;
+        }
+        if ((link.op == CHAIN_AND && smash.getLastStatus() != 0) ||
+            (link.op == CHAIN_OR && smash.getLastStatus() == 0)) {
+            continue;
+        }
+        smash.executeCommand(link.cmd.c_str());
+    }
+}
+
+
+FunctionCommand::FunctionCommand(const char *cmd_line, std::string name, std::string body) :
+        BuiltInCommand(cmd_line), name(std::move(name)), body(std::move(body)) {
+    for (int i = 1; i < num_of_args; i++) {
+        this->params.emplace_back(args[i]);
+    }
+}
+
+void FunctionCommand::execute() {
+    SmallShell &smash = SmallShell::getInstance();
+    if (!smash.enterFunction()) {
+        smashError::NestingTooDeep(this->name);
+        return;
     }
+    // the body's commands inherit the call's redirections, so they are put in place for its duration
+    int saved[REDIRECT_FDS];
+    bool redirected = !this->redirections.empty();
+    if (redirected) {
+        flushOutput();
+        for (int fd = 0; fd < REDIRECT_FDS; fd++) {
+            saved[fd] = fcntl(fd, F_DUPFD_CLOEXEC, REDIRECT_FDS);
+        }
+        applyRedirections();
+    }
+    Environment &env = smash.getEnvironment();
+    std::vector<std::string> outer = env.setPositional(this->params);
+    std::ostream *saved_stream = smashError::setStream(&OutputSink::standard(STDERR_FILENO));
+    smash.executeCommand(this->body.c_str());
+    smashError::setStream(saved_stream);
+    env.setPositional(std::move(outer));
+    if (redirected) {
+        OutputSink::flushStandard();
+        for (int fd = 0; fd < REDIRECT_FDS; fd++) {
+            if (saved[fd] == -1) {
+                close(fd);
+                continue;
+            }
+            dup2(saved[fd], fd);
+            close(saved[fd]);
+        }
+    }
+    smash.leaveFunction();
+    setExitStatus(smash.getLastStatus());
 }
 
 
 void GetCurrDirCommand::execute() {
     char buf[PATH_MAX];
-    cout << getcwd(buf, PATH_MAX) << endl;
+    out() << getcwd(buf, PATH_MAX) << '\n';
 }
 
 void ShowPidCommand::execute() {
-    cout << "smash pid is " << getpid() << endl;
+    out() << "smash pid is " << getpid() << '\n';
 }
 
 void ChangeDirCommand::execute() {
@@ -285,11 +1125,13 @@ void ChangeDirCommand::execute() {
     char *actual_path = getcwd(buf, PATH_MAX);
     int res;
     if (this->path == "-") {
-        if (plastPwd == nullptr) {
+        if (plastPwd.empty()) {
             smashError::PWDNotSet("cd");
             return;
         }
-        res = chdir(*this->plastPwd);
+        res = chdir(this->plastPwd.c_str());
+    } else if (this->path.empty()) {
+        res = chdir(smash.getEnvironment().get("HOME").c_str());
     } else {
         res = chdir(path.c_str());
     }
@@ -297,42 +1139,871 @@ void ChangeDirCommand::execute() {
         smashError::SyscallFailed("chdir");
         return;
     }
-    smash.setPlastPwd(actual_path);
+    if (actual_path != nullptr) {
+        smash.setPlastPwd(actual_path);
+    }
 }
 
 void ExternalCommand::execute() {
+    if (!this->exec_path.empty()) {
+        execve(this->exec_path.c_str(), this->argv.data(), this->envp);
+    }
     if (this->bg_command) {
-        execl("/bin/bash", "/bin/bash", "-c", bg_cmd, NULL);
+        execle("/bin/bash", "/bin/bash", "-c", bg_cmd.c_str(), NULL, this->envp);
     } else {
-        execl("/bin/bash", "/bin/bash", "-c", cmd_line, NULL);
+        execle("/bin/bash", "/bin/bash", "-c", cmd_line.c_str(), NULL, this->envp);
     }
+    smashError::SyscallFailed("execv");
+    exit(1);
 }
 
-void TimeoutCommand::execute() {
-    execl("/bin/bash", "/bin/bash", "-c", this->actual_cmd, NULL);
+BatchCommand::BatchCommand(const char *cmd_line) : BuiltInCommand(cmd_line) {
+    int first = 1;
+    if (num_of_args > 2 && strcmp(args[1], "-n") == 0) {
+        if (!isDigits(args[2]) || atoi(args[2]) < 1) {
+            smashError::InvalidArguments("batch");
+            this->setError();
+            return;
+        }
+        this->max_items = atoi(args[2]);
+        first = 3;
+    }
+    if (first >= num_of_args) {
+        smashError::InvalidArguments("batch");
+        this->setError();
+        return;
+    }
+    for (int i = first; i < num_of_args; i++) {
+        this->base_args.emplace_back(args[i]);
+    }
+    this->exec_path = SmallShell::getInstance().getEnvironment().findExecutable(this->base_args[0]);
+    if (this->exec_path.empty()) {
+        smashError::CommandNotFound("batch", this->base_args[0]);
+        this->setError();
+    }
+}
+
+bool BatchCommand::run(std::vector<std::string> &items) {
+    SmallShell &smash = SmallShell::getInstance();
+    if (smash.consumeInterrupt()) {
+        return false;
+    }
+    std::vector<char *> argv;
+    for (auto &arg: this->base_args) {
+        argv.push_back(&arg[0]);
+    }
+    for (auto &item: items) {
+        argv.push_back(&item[0]);
+    }
+    argv.push_back(nullptr);
+    char *const *envp = smash.getEnvironment().getEnvp();
+    flushOutput();
+    pid_t pid = fork();
+    if (pid == -1) {
+        smashError::ForkFailed();
+        this->failed_runs++;
+        return true;
+    }
+    if (pid == 0) {
+        setpgrp();
+        applyRedirections();
+        execve(this->exec_path.c_str(), argv.data(), envp);
+        smashError::SyscallFailed("execv");
+        exit(1);
+    }
+    this->setCmdPID(pid);
+    smash.setActiveCMD(this);
+    int status = 0;
+    pid_t res;
+    do {
+        res = waitpid(pid, &status, WUNTRACED);
+    } while (res == -1 && errno == EINTR);
+    smash.setActiveCMD(nullptr);
+    if (res != -1 && WIFSTOPPED(status)) {
+        // ctrl-Z: the run becomes a stopped job, as a stopped foreground command does, and batching ends
+        std::string run_line;
+        for (char *arg: argv) {
+            if (arg != nullptr) {
+                run_line += (run_line.empty() ? "" : " ") + std::string(arg);
+            }
+        }
+        smash.addJobShell(std::make_unique<ChildProcessCommand>(run_line.c_str(), pid), true);
+        items.clear();
+        this->failed_runs++;
+        return false;
+    }
+    if (res == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        this->failed_runs++;
+    }
+    items.clear();
+    return !smash.consumeInterrupt();
+}
+
+void BatchCommand::execute() {
+    size_t budget = _argMax() - ARG_MAX_HEADROOM - _argvSize(SmallShell::getInstance().getEnvironment().getEnvp());
+    size_t base_size = ARG_POINTER_OVERHEAD;
+    for (auto &arg: this->base_args) {
+        base_size += arg.size() + 1 + ARG_POINTER_OVERHEAD;
+    }
+    std::vector<std::string> items;
+    size_t used = base_size;
+    std::string item;
+    char buffer[BUFSIZ];
+    ssize_t res;
+    bool done = false, stopped = false;
+    while (!done && !stopped) {
+        // read() is restarted after ctrl-C, poll() is not
+        pollfd pfd{getInFd(), POLLIN, 0};
+        res = poll(&pfd, 1, -1) == -1 ? -1 : read(getInFd(), buffer, sizeof buffer);
+        if (res == -1) {
+            if (errno != EINTR) {
+                smashError::SyscallFailed("read");
+                break;
+            }
+            stopped = SmallShell::getInstance().consumeInterrupt();
+            continue;
+        }
+        done = res == 0;
+        for (ssize_t i = 0; i <= res && !stopped; i++) {
+            bool separator = i == res ? done : isspace(buffer[i]);
+            if (!separator) {
+                if (i < res) {
+                    item += buffer[i];
+                }
+                continue;
+            }
+            if (item.empty()) {
+                continue;
+            }
+            size_t item_size = item.size() + 1 + ARG_POINTER_OVERHEAD;
+            if (base_size + item_size > budget) {
+                smashError::ArgumentListTooLong("batch");
+                item.clear();
+                continue;
+            }
+            if (used + item_size > budget || (this->max_items > 0 && items.size() == this->max_items)) {
+                stopped = !run(items);
+                used = base_size;
+            }
+            items.push_back(std::move(item));
+            item.clear();
+            used += item_size;
+        }
+    }
+    if (!stopped && !items.empty()) {
+        run(items);
+    }
+    if (stopped || this->failed_runs > 0) {
+        smashError::raised = true;
+    }
+}
+
+// a count of seconds that fits a long, with no sign
+static bool _parseSeconds(const char *arg, long &seconds) {
+    char *end;
+    errno = 0;
+    long value = strtol(arg, &end, 10);
+    if (errno == ERANGE || *end != '\0' || value < 0) {
+        return false;
+    }
+    seconds = value;
+    return true;
+}
+
+static long long _monotonicMs() {
+    timespec now{};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+}
+
+// when a wait of seconds started now ends, in _monotonicMs() time; LLONG_MAX for none or one too far off
+static long long _deadlineMs(long seconds) {
+    long long now = _monotonicMs();
+    if (seconds < 0 || seconds > (LLONG_MAX - now) / 1000) {
+        return LLONG_MAX;
+    }
+    return now + seconds * 1000LL;
+}
+
+WaitCommand::WaitCommand(const char *cmd_line, JobsList *jobs) : BuiltInCommand(cmd_line), job_list(jobs) {
+    for (int i = 1; i < num_of_args; i++) {
+        string arg = args[i];
+        if (arg == "-n") {
+            this->any = true;
+        } else if (arg == "-t" && i + 1 < num_of_args && isDigits(args[i + 1]) && args[i + 1][0] != '-' &&
+                   _parseSeconds(args[i + 1], this->timeout)) {
+            i++;
+        } else if (!arg.empty() && isDigits(arg[0] == '%' ? arg.substr(1) : arg) && arg.find('-') == string::npos &&
+                   arg != "%") {
+            this->job_ids.push_back(atoi(arg[0] == '%' ? arg.c_str() + 1 : arg.c_str()));
+        } else {
+            smashError::InvalidArguments("wait");
+            this->setError();
+            return;
+        }
+    }
+}
+
+void WaitCommand::reap(JobsList::JobEntry *job, int status) {
+    out() << "[" << job->getJobID() << "] " << job->getJobCMD()->getCmdLine() << " : ";
+    out() << job->getJobCMD()->getCmdPID();
+    if (WIFSIGNALED(status)) {
+        out() << " killed by signal " << WTERMSIG(status) << '\n';
+    } else {
+        out() << " exited with status " << WEXITSTATUS(status) << '\n';
+    }
+    out().flush();
+    commandReaped(job->getJobCMD(), status);
+    this->setExitStatus(_exitStatus(status));
+    this->job_list->removeJobById(job->getJobID());
+}
+
+// sleeps in poll() on one pidfd per job; returns false if pidfds are not available
+bool WaitCommand::waitWithPidfds(std::vector<JobsList::JobEntry *> &targets) {
+    std::vector<pollfd> fds;
+    for (auto job: targets) {
+        int fd = job->getJobCMD()->openWaitFd();
+        if (fd == -1) {
+            for (auto &opened: fds) {
+                close(opened.fd);
+            }
+            return false;
+        }
+        fds.push_back({fd, POLLIN, 0});
+    }
+    SmallShell &smash = SmallShell::getInstance();
+    long long deadline = _deadlineMs(this->timeout);
+    size_t remaining = targets.size();
+    while (remaining > 0) {
+        int wait_ms = -1;
+        if (deadline != LLONG_MAX) {
+            wait_ms = (int) std::min<long long>(std::max<long long>(0, deadline - _monotonicMs()), INT_MAX);
+        }
+        int res = poll(fds.data(), fds.size(), wait_ms);
+        if (res == -1 && errno == EINTR) {
+            if (smash.consumeInterrupt()) {
+                this->setExitStatus(128 + SIGINT);
+                break;
+            }
+            continue;
+        }
+        if (res == -1) {
+            smashError::SyscallFailed("poll");
+            break;
+        }
+        if (res == 0 && _monotonicMs() < deadline) {
+            // the wait was longer than poll() takes at once
+            continue;
+        }
+        if (res == 0) {
+            this->setExitStatus(WAIT_TIMED_OUT);
+            break;
+        }
+        for (size_t i = 0; i < fds.size(); i++) {
+            if (fds[i].fd == -1 || fds[i].revents == 0) {
+                continue;
+            }
+            int status = 0;
+            if (targets[i]->getJobCMD()->reap(&status, WNOHANG) <= 0) {
+                continue;
+            }
+            reap(targets[i], status);
+            close(fds[i].fd);
+            fds[i].fd = -1;
+            remaining--;
+        }
+        out().flush();
+        if (this->any && remaining < targets.size()) {
+            break;
+        }
+    }
+    for (auto &pfd: fds) {
+        if (pfd.fd != -1) {
+            close(pfd.fd);
+        }
+    }
+    return true;
+}
+
+// kernels without pidfd_open: block SIGCHLD and sleep in sigtimedwait() until a child changes state
+bool WaitCommand::waitWithSigchld(std::vector<JobsList::JobEntry *> &targets) {
+    SmallShell &smash = SmallShell::getInstance();
+    sigset_t chld, old_mask;
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chld, &old_mask);
+    long long deadline = _deadlineMs(this->timeout);
+    size_t reaped = 0;
+    while (true) {
+        for (auto &job: targets) {
+            int status = 0;
+            if (job != nullptr && job->getJobCMD()->reap(&status, WNOHANG) > 0) {
+                reap(job, status);
+                job = nullptr;
+                reaped++;
+            }
+        }
+        out().flush();
+        if (reaped == targets.size() || (this->any && reaped > 0)) {
+            break;
+        }
+        long long left = std::max<long long>(0, deadline - _monotonicMs());
+        timespec wait_time{(time_t) (left / 1000), (long) (left % 1000) * 1000000};
+        if (sigtimedwait(&chld, nullptr, deadline == LLONG_MAX ? nullptr : &wait_time) == -1) {
+            if (errno == EAGAIN) {
+                this->setExitStatus(WAIT_TIMED_OUT);
+                break;
+            }
+            if (errno == EINTR && smash.consumeInterrupt()) {
+                this->setExitStatus(128 + SIGINT);
+                break;
+            }
+        }
+    }
+    sigprocmask(SIG_SETMASK, &old_mask, nullptr);
+    return true;
+}
+
+void WaitCommand::execute() {
+    std::vector<JobsList::JobEntry *> targets;
+    if (this->job_ids.empty()) {
+        // a stopped job can not finish while the shell is blocked here
+        for (auto &job: this->job_list->jobs_list) {
+            if (!job->getStoppedStatus()) {
+                targets.push_back(job.get());
+            }
+        }
+    }
+    for (int id: this->job_ids) {
+        JobsList::JobEntry *job = this->job_list->getJobById(id);
+        if (job == nullptr) {
+            smashError::NotExist(id, "wait");
+            return;
+        }
+        targets.push_back(job);
+    }
+    this->setExitStatus(0);
+    if (targets.empty()) {
+        return;
+    }
+    SmallShell::getInstance().consumeInterrupt();
+    if (!waitWithPidfds(targets)) {
+        waitWithSigchld(targets);
+    }
+}
+
+JobTopCommand::JobTopCommand(const char *cmd_line, JobsList *jobs) : BuiltInCommand(cmd_line), job_list(jobs) {
+    for (int i = 1; i < num_of_args; i++) {
+        string arg = args[i];
+        char *end = nullptr;
+        if (arg == "-d" && i + 1 < num_of_args) {
+            this->interval = strtod(args[++i], &end);
+            if (*end == '\0' && this->interval > 0) {
+                continue;
+            }
+        } else if (arg == "-n" && i + 1 < num_of_args && isDigits(args[i + 1]) && atol(args[i + 1]) > 0) {
+            this->iterations = atol(args[++i]);
+            continue;
+        }
+        smashError::InvalidArguments("jobtop");
+        this->setError();
+        return;
+    }
+    // a single frame when the output is not a terminal, so that jobtop > file does not run forever
+    if (this->iterations == -1 && !isatty(getOutFd())) {
+        this->iterations = 1;
+    }
+}
+
+// the pids jobtop samples for a job: its processes, or for a builtin on a worker, the worker's thread
+static std::vector<pid_t> _jobTopMembers(const Command *cmd) {
+    std::vector<pid_t> members = cmd->processes();
+    if (members.empty() && cmd->getCmdPID() > 0) {
+        members.push_back(cmd->getCmdPID());
+    }
+    return members;
+}
+
+void JobTopCommand::printFrame(bool clear) {
+    ProcSampler &sampler = SmallShell::getInstance().getProcSampler();
+    static const long ticks_per_sec = sysconf(_SC_CLK_TCK);
+    static const long page_kb = sysconf(_SC_PAGESIZE) / 1024;
+    std::vector<pid_t> alive;
+    std::ostringstream frame;
+    if (clear) {
+        frame << "\033[H\033[J";
+    }
+    char line[256];
+    snprintf(line, sizeof line, "%-5s %-8s %-2s %6s %10s %10s %10s %s\n", "JOB", "PID", "S", "CPU%", "RSS(KB)",
+             "READ/s", "WRITE/s", "COMMAND");
+    frame << line;
+    // a row per job, summed over its processes (every stage of a pipeline); the state is the first member's,
+    // or R if any of them is running
+    for (auto &job: this->job_list->jobs_list) {
+        bool sampled = false, has_io = true;
+        char state = '?';
+        long rss_pages = 0;
+        double cpu = 0, read_rate = 0, write_rate = 0;
+        for (pid_t pid: _jobTopMembers(job->getJobCMD())) {
+            ProcSample current, previous;
+            bool has_previous = false;
+            if (!sampler.sample(pid, current, previous, has_previous)) {
+                continue;
+            }
+            alive.push_back(pid);
+            if (!sampled || current.state == 'R') {
+                state = current.state;
+            }
+            sampled = true;
+            rss_pages += current.rss_pages;
+            has_io = has_io && current.has_io;
+            double elapsed = current.taken_at - previous.taken_at;
+            if (has_previous && elapsed > 0) {
+                cpu += 100.0 * (current.cpu_ticks - previous.cpu_ticks) / (elapsed * ticks_per_sec);
+                read_rate += (current.read_bytes - previous.read_bytes) / elapsed;
+                write_rate += (current.write_bytes - previous.write_bytes) / elapsed;
+            }
+        }
+        if (!sampled) {
+            continue;
+        }
+        pid_t pid = job->getJobCMD()->getCmdPID();
+        if (has_io) {
+            snprintf(line, sizeof line, "%-5d %-8d %-2c %6.1f %10ld %10.0f %10.0f ", job->getJobID(), pid,
+                     state, cpu, rss_pages * page_kb, read_rate, write_rate);
+        } else {
+            snprintf(line, sizeof line, "%-5d %-8d %-2c %6.1f %10ld %10s %10s ", job->getJobID(), pid,
+                     state, cpu, rss_pages * page_kb, "-", "-");
+        }
+        frame << line << job->getJobCMD()->getCmdLine() << "\n";
+    }
+    sampler.prune(alive);
+    string text = frame.str();
+    out() << text << flush;
+}
+
+void JobTopCommand::execute() {
+    SmallShell &smash = SmallShell::getInstance();
+    ProcSampler &sampler = smash.getProcSampler();
+    bool tty = isatty(getOutFd());
+    this->job_list->removeFinishedJobs();
+    // prime the samples so that the first frame already shows rates
+    for (auto &job: this->job_list->jobs_list) {
+        for (pid_t pid: _jobTopMembers(job->getJobCMD())) {
+            ProcSample current, previous;
+            bool has_previous = false;
+            sampler.sample(pid, current, previous, has_previous);
+        }
+    }
+    smash.consumeInterrupt();
+    timespec delay{(time_t) this->interval, (long) ((this->interval - (time_t) this->interval) * 1e9)};
+    for (long frame = 0; this->iterations == -1 || frame < this->iterations; frame++) {
+        timespec remaining = delay;
+        bool interrupted = false;
+        while (nanosleep(&remaining, &remaining) == -1 && errno == EINTR) {
+            if (smash.consumeInterrupt()) {
+                interrupted = true;
+                break;
+            }
+        }
+        if (interrupted) {
+            break;
+        }
+        this->job_list->removeFinishedJobs();
+        printFrame(tty);
+    }
+}
+
+void TimeoutCommand::execute() {
+    char *const *envp = SmallShell::getInstance().getEnvironment().getEnvp();
+    execle("/bin/bash", "/bin/bash", "-c", this->actual_cmd.c_str(), NULL, envp);
+    smashError::SyscallFailed("execv");
+    exit(1);
+}
+
+void ExportCommand::execute() {
+    Environment &env = SmallShell::getInstance().getEnvironment();
+    if (num_of_args == 1) {
+        env.printExported(out());
+        return;
+    }
+    for (int i = 1; i < num_of_args; i++) {
+        string arg = args[i];
+        size_t eq = arg.find('=');
+        string name = arg.substr(0, eq);
+        if (!Environment::isValidName(name)) {
+            smashError::InvalidIdentifier("export", arg);
+            continue;
+        }
+        if (eq == string::npos) {
+            env.exportVar(name);
+        } else {
+            env.exportVar(name, arg.substr(eq + 1));
+        }
+    }
+}
+
+void UnsetCommand::execute() {
+    SmallShell &smash = SmallShell::getInstance();
+    if (num_of_args > 1 && strcmp(args[1], "-f") == 0) {
+        for (int i = 2; i < num_of_args; i++) {
+            smash.removeFunction(args[i]);
+        }
+        return;
+    }
+    for (int i = 1; i < num_of_args; i++) {
+        smash.getEnvironment().unset(args[i]);
+    }
+}
+
+void PluginCommand::execute() {
+    // anything smash still buffers for these descriptors has to be written before the plugin's own output
+    flushOutput();
+    smash_io io{getInFd(), getOutFd(), this->redirections.get(STDERR_FILENO)};
+    setExitStatus(this->fn(num_of_args, args, &io, this->data));
+}
+
+void LoadCommand::execute() {
+    PluginList &plugins = SmallShell::getInstance().getPlugins();
+    if (num_of_args == 1) {
+        for (auto &plugin: plugins.getPlugins()) {
+            out() << plugin.path << ":";
+            for (auto &command: plugin.commands) {
+                out() << " " << command;
+            }
+            out() << '\n';
+        }
+        return;
+    }
+    for (int i = 1; i < num_of_args; i++) {
+        std::string error;
+        if (!plugins.load(args[i], error)) {
+            smashError::LoadFailed(error);
+        }
+    }
+}
+
+// removes one level of matching quotes around an alias value
+static std::string _unquote(const std::string &value) {
+    if (value.size() >= 2 && (value[0] == '\'' || value[0] == '"') && value.back() == value[0]) {
+        return value.substr(1, value.size() - 2);
+    }
+    return value;
+}
+
+void AliasCommand::execute() {
+    SmallShell &smash = SmallShell::getInstance();
+    if (num_of_args == 1) {
+        for (auto &alias: smash.getAliases()) {
+            out() << "alias " << alias.first << "='" << alias.second << "'\n";
+        }
+        return;
+    }
+    // the value may contain spaces, so it is taken from the line rather than from args
+    string definition = trim(_withoutBackgroundSign(this->cmd_line).substr(this->cmd_line.find("alias") + 5));
+    size_t eq = definition.find('=');
+    if (eq == string::npos) {
+        for (int i = 1; i < num_of_args; i++) {
+            bool found = false;
+            for (auto &alias: smash.getAliases()) {
+                if (alias.first == args[i]) {
+                    out() << "alias " << alias.first << "='" << alias.second << "'\n";
+                    found = true;
+                }
+            }
+            if (!found) {
+                smashError::NotFound("alias", args[i]);
+            }
+        }
+        return;
+    }
+    string name = definition.substr(0, eq);
+    if (name.empty() || name.find_first_of(std::string(COMMAND_NAME_SPECIALS) + WHITESPACE) != string::npos) {
+        smashError::InvalidIdentifier("alias", name);
+        return;
+    }
+    smash.setAlias(name, _unquote(definition.substr(eq + 1)));
+}
+
+void UnaliasCommand::execute() {
+    if (num_of_args == 1) {
+        smashError::InvalidArguments("unalias");
+        return;
+    }
+    for (int i = 1; i < num_of_args; i++) {
+        if (!SmallShell::getInstance().removeAlias(args[i])) {
+            smashError::NotFound("unalias", args[i]);
+        }
+    }
+}
+
+JobsCommand::JobsCommand(const char *cmd_line, JobsList *jobs) : BuiltInCommand(cmd_line), job_list(jobs) {
+    if (num_of_args == 2 && strcmp(args[1], "-v") == 0) {
+        this->verbose = true;
+    }
 }
 
 void JobsCommand::execute() {
-    job_list->printJobsList();
+    if (!this->verbose) {
+        job_list->printJobsList(out());
+        return;
+    }
+    for (auto &job: this->job_list->jobs_list) {
+        std::string limits = job->getJobCMD()->getLimits().describe();
+        out() << *job << "    limits: " << (limits.empty() ? "none" : limits) << '\n';
+    }
+}
+
+static int _signalNumber(const std::string &name) {
+    static const std::pair<const char *, int> signals[] = {
+            {"HUP",  SIGHUP},  {"INT",  SIGINT},  {"QUIT", SIGQUIT}, {"ILL",  SIGILL},  {"TRAP", SIGTRAP},
+            {"ABRT", SIGABRT}, {"BUS",  SIGBUS},  {"FPE",  SIGFPE},  {"KILL", SIGKILL}, {"USR1", SIGUSR1},
+            {"SEGV", SIGSEGV}, {"USR2", SIGUSR2}, {"PIPE", SIGPIPE}, {"ALRM", SIGALRM}, {"TERM", SIGTERM},
+            {"CHLD", SIGCHLD}, {"CONT", SIGCONT}, {"STOP", SIGSTOP}, {"TSTP", SIGTSTP}, {"TTIN", SIGTTIN},
+            {"TTOU", SIGTTOU}, {"URG",  SIGURG},  {"XCPU", SIGXCPU}, {"XFSZ", SIGXFSZ}, {"WINCH", SIGWINCH},
+    };
+    if (isDigits(name) && !name.empty() && name[0] != '-') {
+        int num = atoi(name.c_str());
+        return (num >= 1 && num <= 63) ? num : -1;
+    }
+    string bare = name.compare(0, 3, "SIG") == 0 ? name.substr(3) : name;
+    for (auto &sig: signals) {
+        if (bare == sig.first) {
+            return sig.second;
+        }
+    }
+    return -1;
+}
+
+static bool _parseJobId(const std::string &word, int *id) {
+    string digits = !word.empty() && word[0] == '%' ? word.substr(1) : word;
+    if (digits.empty() || digits.find_first_not_of("0123456789") != string::npos) {
+        return false;
+    }
+    *id = atoi(digits.c_str());
+    return true;
+}
+
+// N, %N, N-M, %N-%M, comma separated lists of those, or /regex/ against the command line
+bool KillCommand::parseSelector(const std::string &selector) {
+    if (selector.size() >= 2 && selector.front() == '/' && selector.back() == '/') {
+        try {
+            this->patterns.emplace_back(selector.substr(1, selector.size() - 2), std::regex::extended | std::regex::nosubs);
+        } catch (const std::regex_error &) {
+            return false;
+        }
+        return true;
+    }
+    size_t start = 0;
+    while (start <= selector.size()) {
+        size_t end = selector.find(',', start);
+        if (end == string::npos) {
+            end = selector.size();
+        }
+        string item = selector.substr(start, end - start);
+        size_t dash = item.find('-', 1);
+        int first, last;
+        if (dash == string::npos) {
+            if (!_parseJobId(item, &first)) {
+                return false;
+            }
+            last = first;
+        } else if (!_parseJobId(item.substr(0, dash), &first) || !_parseJobId(item.substr(dash + 1), &last) ||
+                   first > last) {
+            return false;
+        }
+        this->ranges.emplace_back(first, last);
+        start = end + 1;
+    }
+    return true;
+}
+
+KillCommand::KillCommand(const char *cmd_line, JobsList *jobs) : BuiltInCommand(cmd_line), job_list(jobs) {
+    int first_selector = 2;
+    if (num_of_args > 2 && strcmp(args[1], "-g") == 0) {
+        this->process_group = true;
+    }
+    int sig_arg = this->process_group ? 2 : 1;
+    first_selector = sig_arg + 1;
+    this->sig_num = num_of_args > sig_arg && args[sig_arg][0] == '-' ? _signalNumber(args[sig_arg] + 1) : -1;
+    if (this->sig_num == -1 || num_of_args <= first_selector) {
+        smashError::InvalidArguments("kill");
+        this->setError();
+        return;
+    }
+    // the classic "kill -N jobid" form keeps its per-job message and error
+    if (num_of_args == first_selector + 1 && isDigits(args[first_selector])) {
+        this->single = true;
+        int id = atoi(args[first_selector]);
+        this->ranges.emplace_back(id, id);
+        return;
+    }
+    for (int i = first_selector; i < num_of_args; i++) {
+        if (!parseSelector(args[i])) {
+            smashError::InvalidArguments("kill");
+            this->setError();
+            return;
+        }
+    }
+}
+
+bool KillCommand::selected(JobsList::JobEntry *job) const {
+    int id = job->getJobID();
+    for (auto &range: this->ranges) {
+        if (range.first <= id && id <= range.second) {
+            return true;
+        }
+    }
+    for (auto &pattern: this->patterns) {
+        if (std::regex_search(job->getJobCMD()->getCmdLine(), pattern)) {
+            return true;
+        }
+    }
+    return false;
 }
 
 void KillCommand::execute() {
-    JobsList::JobEntry *cmd_to_kill = job_list->getJobById(commandID);
-    if (cmd_to_kill == nullptr) {
-        smashError::NotExist(commandID, "kill");
+    int signaled = 0;
+    JobsList::JobEntry *last = nullptr;
+    for (auto &job: this->job_list->jobs_list) {
+        if (!selected(job.get())) {
+            continue;
+        }
+        Command *cmd = job->getJobCMD();
+        int res = cmd->sendSignal(sig_num, this->process_group);
+        // a finished but not yet reaped job has no process group left, only its zombie
+        if (res != SUCCESS && this->process_group && errno == ESRCH) {
+            res = cmd->sendSignal(sig_num);
+        }
+        if (res != SUCCESS) {
+            smashError::SyscallFailed("kill");
+            continue;
+        }
+        if (sig_num == SIGSTOP) {
+            job->setStoppedStatus(true);
+        }
+        if (sig_num == SIGCONT) {
+            job->setStoppedStatus(false);
+        }
+        last = job.get();
+        signaled++;
+    }
+    if (this->single) {
+        if (last == nullptr && !smashError::raised) {
+            smashError::NotExist(this->ranges[0].first, "kill");
+        } else if (last != nullptr) {
+            out() << "signal number " << sig_num << " was sent to pid " << last->getJobCMD()->getCmdPID() << '\n';
+        }
         return;
     }
-    if(kill(cmd_to_kill->getJobCMD()->getCmdPID(), sig_num) != SUCCESS)
-    {
-        smashError::SyscallFailed("kill");
+    if (signaled == 0) {
+        if (!smashError::raised) {
+            smashError::NoMatchingJobs("kill");
+        }
+        return;
     }
-    if (sig_num == SIGSTOP) {
-        cmd_to_kill->setStoppedStatus(true);
+    out() << "signal number " << sig_num << " was sent to " << signaled << " jobs\n";
+}
+
+TraceCommand::TraceCommand(const char *cmd_line) : BuiltInCommand(cmd_line) {
+    bool valid = num_of_args == 1 ||
+                 (num_of_args == 2 && (strcmp(args[1], "on") == 0 || strcmp(args[1], "off") == 0 ||
+                                       strcmp(args[1], "clear") == 0)) ||
+                 (num_of_args == 3 && strcmp(args[1], "dump") == 0);
+    if (!valid) {
+        smashError::InvalidArguments("trace");
+        this->setError();
     }
-    if (sig_num == SIGCONT) {
-        cmd_to_kill->setStoppedStatus(false);
+}
+
+void TraceCommand::execute() {
+    if (num_of_args == 1) {
+        out() << "trace: " << (Trace::enabled ? "on" : "off") << ", " << Trace::recorded() << " events\n";
+    } else if (strcmp(args[1], "on") == 0) {
+        Trace::enabled = true;
+    } else if (strcmp(args[1], "off") == 0) {
+        Trace::enabled = false;
+    } else if (strcmp(args[1], "clear") == 0) {
+        Trace::clear();
+    } else if (!Trace::dump(args[2])) {
+        smashError::SyscallFailed("trace dump");
+    }
+}
+
+LimitCommand::LimitCommand(const char *cmd_line, JobsList *jobs) : BuiltInCommand(cmd_line), job_list(jobs) {
+    int first = 1;
+    if (num_of_args >= 3 && strcmp(args[1], "-j") == 0) {
+        if (!_parseJobId(args[2], &this->job_id)) {
+            smashError::InvalidArguments("limit");
+            this->setError();
+            return;
+        }
+        first = 3;
+    }
+    if (num_of_args == first) {
+        return;
+    }
+    if (num_of_args != first + 2 || !ResourceLimits::parseResource(args[first], this->resource) ||
+        !ResourceLimits::parseValue(this->resource, args[first + 1], this->value)) {
+        smashError::InvalidArguments("limit");
+        this->setError();
+        return;
+    }
+    this->show = false;
+}
+
+void LimitCommand::execute() {
+    SmallShell &smash = SmallShell::getInstance();
+    Command *cmd = nullptr;
+    if (this->job_id != -1) {
+        JobsList::JobEntry *job = this->job_list->getJobById(this->job_id);
+        if (job == nullptr) {
+            smashError::NotExist(this->job_id, "limit");
+            return;
+        }
+        cmd = job->getJobCMD();
+    }
+    if (this->show) {
+        const ResourceLimits &limits = cmd != nullptr ? cmd->getLimits() : smash.getJobLimits();
+        char line[64];
+        for (int i = 0; i < LIMIT_RESOURCES; i++) {
+            auto resource = (LimitResource) i;
+            snprintf(line, sizeof line, "%-7s %s\n", ResourceLimits::name(resource),
+                     ResourceLimits::format(resource, limits.get(resource)).c_str());
+            out() << line;
+        }
+        return;
+    }
+    if (cmd == nullptr) {
+        smash.getJobLimits().set(this->resource, this->value);
+        return;
+    }
+    std::vector<pid_t> pids = cmd->processes();
+    if (pids.empty()) {
+        smashError::RunsInShell(this->job_id, "limit");
+        return;
+    }
+    ResourceLimits limits = cmd->getLimits();
+    limits.set(this->resource, this->value);
+    // every member gets the limit even if one refuses it: a lowered hard limit can not be raised back, so
+    // the members already limited stay that way and the job records it
+    bool applied = false;
+    int error = 0;
+    for (pid_t pid: pids) {
+        // a process may finish between the scan and here
+        if (limits.applyTo(pid, this->resource)) {
+            applied = true;
+        } else if (errno != ESRCH) {
+            error = errno;
+        }
+    }
+    if (error != 0 || !applied) {
+        errno = error != 0 ? error : ESRCH;
+        smashError::SyscallFailed("prlimit");
+    }
+    if (applied) {
+        cmd->setLimits(limits);
     }
-    cout << "signal number " << sig_num << " was sent to pid " << cmd_to_kill->getJobCMD()->getCmdPID() << endl;
 }
 
 void ForegroundCommand::execute() {
@@ -357,22 +2028,30 @@ void ForegroundCommand::execute() {
         }
     }
 
-    cout << cmd_to_move_to_fg->getJobCMD()->cmd_line << " : " << cmd_to_move_to_fg->getJobCMD()->getCmdPID() << endl;
+    out() << cmd_to_move_to_fg->getJobCMD()->getCmdLine() << " : " << cmd_to_move_to_fg->getJobCMD()->getCmdPID() << '\n';
+    flushOutput();
     cmd_to_move_to_fg->setStoppedStatus(false);
     pid_t pid = fork();
     if (pid == -1) {
         smashError::ForkFailed();
     } else if (pid == 0) {
         setpgrp();
-        if(kill(cmd_to_move_to_fg->getJobCMD()->getCmdPID(), SIGCONT)!= SUCCESS)
+        if(cmd_to_move_to_fg->getJobCMD()->sendSignal(SIGCONT)!= SUCCESS)
         {
             smashError::SyscallFailed("kill");
         }
         exit(0);
     } else {
         smash.setActiveCMD(cmd_to_move_to_fg->getJobCMD());
-        waitpid(smash.getActiveCMD()->getCmdPID(), nullptr, WUNTRACED);
-        if (!cmd_to_move_to_fg->getStoppedStatus()) {
+        int status = 0;
+        cmd_to_move_to_fg->getJobCMD()->reap(&status, WUNTRACED);
+        smash.setActiveCMD(nullptr);
+        waitpid(pid, nullptr, 0);
+        if (WIFSTOPPED(status)) {
+            cmd_to_move_to_fg->setStoppedStatus(true);
+            cmd_to_move_to_fg->setTimeInserted();
+        } else {
+            commandReaped(cmd_to_move_to_fg->getJobCMD(), status);
             this->jobs_list_ptr->removeJobById(cmd_to_move_to_fg->getJobID());
         }
     }
@@ -404,157 +2083,863 @@ void BackgroundCommand::execute() {
         }
     }
     cmd_to_bg->setStoppedStatus(false);
-    cout << cmd_to_bg->getJobCMD()->getCmdLine();
-    cout << " : " << cmd_to_bg->getJobCMD()->getCmdPID() << endl;
-    if(kill(cmd_to_bg->getJobCMD()->getCmdPID(), SIGCONT) != SUCCESS){
+    out() << cmd_to_bg->getJobCMD()->getCmdLine();
+    out() << " : " << cmd_to_bg->getJobCMD()->getCmdPID() << '\n';
+    if(cmd_to_bg->getJobCMD()->sendSignal(SIGCONT) != SUCCESS){
         smashError::SyscallFailed("kill");
     }
 }
 
 void QuitCommand::execute() {
     if (this->shouldKill) {
-        cout << "smash: sending SIGKILL signal to ";
-        cout << this->job_list->jobs_list->size();
-        cout << " jobs:" << endl;
-        this->job_list->killAllJobs();
+        out() << "smash: sending SIGKILL signal to ";
+        out() << this->job_list->jobs_list.size();
+        out() << " jobs:" << '\n';
+        this->job_list->killAllJobs(out());
     }
 
 }
 
-void RedirectionCommand::execute() {
-    prepare();
-    if (file_fd == OPEN_FAILED) {
-        return;
+// gives a worker stage its end of the pipe; the end is closed here if the stage redirected it elsewhere
+static void _attachPipeEnd(Command *stage, int target, int fd) {
+    if (!stage->attachRedirection(target, fd)) {
+        close(fd);
     }
+}
+
+void PipeCommand::startStages() {
     SmallShell &small_shell = SmallShell::getInstance();
-    small_shell.executeCommand(this->RCCmd.c_str());
-    cleanup();
+    size_t count = this->stages.size();
+    // builtin stages run on workers instead of forked shells
+    for (auto &stage: this->stages) {
+        stage.worker = small_shell.createWorkerStage(stage.cmd_line);
+    }
+    // pipes[i] connects stage i to stage i + 1
+    std::vector<std::array<int, 2>> pipes(count - 1);
+    for (size_t i = 0; i + 1 < count; i++) {
+        if (pipe2(pipes[i].data(), O_CLOEXEC) == -1) {
+            smashError::SyscallFailed("pipe");
+            for (size_t j = 0; j < i; j++) {
+                close(pipes[j][PIPE_READ]);
+                close(pipes[j][PIPE_WRITE]);
+            }
+            this->setError();
+            return;
+        }
+    }
+    bool grouped = !small_shell.inSubshell();
+    // children must not inherit output still sitting in the shell's buffers
+    OutputSink::flushStandard();
+    for (size_t i = 0; i < count; i++) {
+        Stage &stage = this->stages[i];
+        if (stage.worker != nullptr) {
+            continue;
+        }
+        stage.pid = fork();
+        if (stage.pid == -1) {
+            smashError::ForkFailed();
+            stage.finished = true;
+            stage.status = 1 << 8;
+            continue;
+        }
+        if (stage.pid == 0) {
+            if (grouped) {
+                setpgid(0, this->pgid);
+            }
+            if (!this->limits.apply()) {
+                smashError::SyscallFailed("setrlimit");
+                OutputSink::flushStandard();
+                _exit(1);
+            }
+            // its own children stay in the pipeline's group, and its stops are the pipeline's
+            small_shell.enterSubshell();
+            if (i > 0) {
+                dup2(pipes[i - 1][PIPE_READ], STDIN_FILENO);
+            }
+            if (i + 1 < count) {
+                int write_end = pipes[i][PIPE_WRITE];
+                dup2(write_end, stage.mode == PIPE_STDERR ? STDERR_FILENO : STDOUT_FILENO);
+                if (stage.mode == PIPE_BOTH) {
+                    dup2(write_end, STDERR_FILENO);
+                }
+            }
+            for (auto &ends: pipes) {
+                close(ends[PIPE_READ]);
+                close(ends[PIPE_WRITE]);
+            }
+            small_shell.executeCommand(stage.cmd_line.c_str(), false);
+            exit(small_shell.getLastStatus());
+        }
+        // set on both sides of the fork, so that the group exists whichever runs first
+        if (grouped) {
+            setpgid(stage.pid, this->pgid == 0 ? stage.pid : this->pgid);
+            if (this->pgid == 0) {
+                this->pgid = stage.pid;
+            }
+        }
+        if (this->cmd_pid == -1) {
+            this->setCmdPID(stage.pid);
+        }
+    }
+    // the workers take their ends only after the forks, so that no forked shell holds a copy keeping the
+    // pipe open; ends that no worker takes are closed here
+    for (size_t i = 0; i < count; i++) {
+        Stage &stage = this->stages[i];
+        if (stage.worker == nullptr) {
+            continue;
+        }
+        Command *builtin = stage.worker->getBuiltin();
+        if (i > 0) {
+            _attachPipeEnd(builtin, STDIN_FILENO, pipes[i - 1][PIPE_READ]);
+            pipes[i - 1][PIPE_READ] = -1;
+        } else if (this->bg_command) {
+            // the terminal belongs to the prompt, as with any background builtin
+            int null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+            if (null_fd != OPEN_FAILED) {
+                _attachPipeEnd(builtin, STDIN_FILENO, null_fd);
+            }
+        }
+        if (i + 1 < count) {
+            int write_end = pipes[i][PIPE_WRITE];
+            if (stage.mode == PIPE_BOTH) {
+                int copy = fcntl(write_end, F_DUPFD_CLOEXEC, REDIRECT_FDS);
+                if (copy != -1) {
+                    _attachPipeEnd(builtin, STDERR_FILENO, copy);
+                }
+            }
+            _attachPipeEnd(builtin, stage.mode == PIPE_STDERR ? STDERR_FILENO : STDOUT_FILENO, write_end);
+            pipes[i][PIPE_WRITE] = -1;
+        }
+    }
+    for (auto &ends: pipes) {
+        for (int fd: ends) {
+            if (fd != -1) {
+                close(fd);
+            }
+        }
+    }
+    for (auto &stage: this->stages) {
+        if (stage.worker == nullptr) {
+            continue;
+        }
+        stage.worker->execute();
+        // a stage that failed to start lets go of its ends right away
+        if (stage.worker->getError()) {
+            stage.worker.reset();
+            stage.finished = true;
+            stage.status = 1 << 8;
+        } else if (this->cmd_pid == -1) {
+            this->setCmdPID(stage.worker->getCmdPID());
+        }
+    }
 }
 
-void RedirectionCommand::prepare() {
-    saved_stdout_fd = dup(STDOUT_FILENO);
-    file_fd = open((this->RCOutputFile).c_str(), this->flags, 0655);
-    if (file_fd == OPEN_FAILED) {
-        smashError::SyscallFailed("open");
-        return;
+void PipeCommand::execute() {
+    startStages();
+    if (!getError() && this->cmd_pid == -1) {
+        // no stage could be started
+        this->setError();
     }
-    if (dup2(STDOUT_FILENO, saved_stdout_fd) == -1) {
-        smashError::SyscallFailed("dup2");
-        return;
+}
+
+int PipeCommand::sendSignal(int sig_num, bool) {
+    bool has_processes = false, delivered = false;
+    int saved_errno = ESRCH;
+    for (auto &stage: this->stages) {
+        has_processes = has_processes || stage.pid > 0;
     }
-    if (dup2(file_fd, STDOUT_FILENO) == FAILURE) {
-        smashError::SyscallFailed("dup2");
-        return;
+    if (this->pgid > 0) {
+        if (kill(-this->pgid, sig_num) == SUCCESS) {
+            delivered = true;
+        } else {
+            saved_errno = errno;
+        }
+    }
+    for (auto &stage: this->stages) {
+        int res;
+        if (stage.worker != nullptr) {
+            // a worker can not be stopped, but one stalls anyway once the processes around it are
+            bool stopping = sig_num == SIGSTOP || sig_num == SIGTSTP || sig_num == SIGTTIN || sig_num == SIGTTOU;
+            if (stopping && has_processes) {
+                continue;
+            }
+            res = stage.worker->sendSignal(sig_num);
+        } else if (this->pgid == 0 && stage.pid > 0 && !stage.finished) {
+            res = kill(stage.pid, sig_num);
+        } else {
+            continue;
+        }
+        if (res == SUCCESS) {
+            delivered = true;
+        } else {
+            saved_errno = errno;
+        }
+    }
+    if (!delivered) {
+        errno = saved_errno;
+        return FAILURE;
     }
+    return SUCCESS;
 }
 
-void RedirectionCommand::cleanup() {
-    dup2(saved_stdout_fd, STDOUT_FILENO);
-    if (close(file_fd) == -1) {
-        smashError::SyscallFailed("close");
-        return;
+// records what wait4() or a worker's reap() said about a stage, adding a finished process's usage to the
+// pipeline's; true if the stage stopped
+static bool _updateStage(PipeCommand::Stage &stage, pid_t res, int status, const rusage &stage_usage,
+                         rusage &usage) {
+    if (res == 0) {
+        return false;
+    }
+    if (res == -1) {
+        // EINTR leaves the stage to the next attempt; ECHILD means the ctrl-C handler reaped it in between,
+        // and recorded its status then
+        if (errno != EINTR) {
+            stage.finished = true;
+        }
+        return false;
     }
+    if (WIFSTOPPED(status)) {
+        return true;
+    }
+    stage.finished = true;
+    stage.status = status;
+    timeradd(&usage.ru_utime, &stage_usage.ru_utime, &usage.ru_utime);
+    timeradd(&usage.ru_stime, &stage_usage.ru_stime, &usage.ru_stime);
+    usage.ru_maxrss = std::max(usage.ru_maxrss, stage_usage.ru_maxrss);
+    return false;
 }
 
-void PipeCommand::execute() {
-    SmallShell &small_shell = SmallShell::getInstance();
-    int channel_redirection = STDOUT_FILENO;
-    if (err == true) {
-        channel_redirection = STDERR_FILENO;
-    }
-    int fd[2];
-    pipe(fd);
-    pid_t pid1 = fork();
-    if (pid1 == -1) {
-        smashError::ForkFailed();
-    } else if (pid1 == 0) {
-        dup2(fd[PIPE_WRITE], channel_redirection);
-        close(fd[PIPE_READ]);
-        close(fd[PIPE_WRITE]);
-        small_shell.executeCommand(this->cmd1.c_str());
-        exit(0);
+pid_t PipeCommand::reap(int *status, int options) {
+    while (true) {
+        bool stopped = false;
+        int stop_status = 0;
+        for (auto &stage: this->stages) {
+            if (stage.finished) {
+                continue;
+            }
+            int stage_status = 0;
+            rusage stage_usage{};
+            pid_t res;
+            if (stage.worker != nullptr) {
+                res = stage.worker->reap(&stage_status, WNOHANG);
+            } else {
+                res = wait4(stage.pid, &stage_status, WNOHANG | (options & WUNTRACED), &stage_usage);
+            }
+            if (_updateStage(stage, res, stage_status, stage_usage, this->usage)) {
+                stopped = true;
+                stop_status = stage_status;
+            }
+        }
+        Stage *pending = nullptr;
+        for (auto &stage: this->stages) {
+            // processes first: a stop shows up on them, while a worker stalls when its neighbours stop
+            if (!stage.finished && (pending == nullptr || (pending->worker != nullptr && stage.worker == nullptr))) {
+                pending = &stage;
+            }
+        }
+        if (pending == nullptr || stopped) {
+            if (status != nullptr) {
+                *status = stopped ? stop_status : this->stages.back().status;
+            }
+            return this->cmd_pid;
+        }
+        if (options & WNOHANG) {
+            return 0;
+        }
+        int stage_status = 0;
+        rusage stage_usage{};
+        pid_t res;
+        if (pending->worker != nullptr) {
+            res = pending->worker->reap(&stage_status, 0);
+        } else {
+            res = wait4(pending->pid, &stage_status, options & WUNTRACED, &stage_usage);
+        }
+        if (_updateStage(*pending, res, stage_status, stage_usage, this->usage)) {
+            if (status != nullptr) {
+                *status = stage_status;
+            }
+            return this->cmd_pid;
+        }
     }
-    pid_t pid2 = fork();
-    if (pid2 == -1) {
-        smashError::ForkFailed();
-    } else if (pid2 == 0) {
-        dup2(fd[PIPE_READ], STDIN_FILENO);
-        close(fd[PIPE_READ]);
-        close(fd[PIPE_WRITE]);
-        small_shell.executeCommand(this->cmd2.c_str());
-        exit(0);
+}
+
+std::vector<pid_t> PipeCommand::processes() const {
+    if (this->pgid > 0) {
+        return processGroupMembers(this->pgid);
     }
-    close(fd[PIPE_READ]);
-    close(fd[PIPE_WRITE]);
-    while ((waitpid(P_ALL, nullptr, 0)) != -1) {}
+    std::vector<pid_t> pids;
+    for (auto &stage: this->stages) {
+        if (stage.pid > 0 && !stage.finished) {
+            pids.push_back(stage.pid);
+        }
+    }
+    return pids;
+}
+
+// the pipeline finishes with its last stage to do so, which no single descriptor reports: wait falls back to
+// SIGCHLD, which workers send as well
+int PipeCommand::openWaitFd() const {
+    errno = ENOTSUP;
+    return FAILURE;
 }
 
 
-void TailCommand::execute() {
-    int file_fd = open(file.c_str(), O_RDONLY);
-    if (file_fd == OPEN_FAILED) {
-        smashError::SyscallFailed("open");
+TeeCommand::TeeCommand(const char *cmd_line) : BuiltInCommand(cmd_line) {
+    for (int i = 1; i < num_of_args; i++) {
+        if (strcmp(args[i], "-a") == 0 && this->files.empty()) {
+            this->append = true;
+        } else {
+            this->files.push_back(args[i]);
+        }
+    }
+}
+
+void TeeCommand::execute() {
+    std::vector<int> fds;
+    for (auto &file: this->files) {
+        // splice() refuses O_APPEND files, StreamTee copies into those instead
+        int fd = open(file.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC | (this->append ? O_APPEND : O_TRUNC), 0644);
+        if (fd == OPEN_FAILED) {
+            smashError::SyscallFailed("open");
+            continue;
+        }
+        fds.push_back(fd);
+    }
+    out().flush();
+    StreamTee stream(getInFd(), getOutFd(), fds);
+    if (!stream.run() && errno != EPIPE && !WorkerPool::cancelRequested()) {
+        smashError::SyscallFailed("tee");
+    }
+    for (int fd: fds) {
+        close(fd);
+    }
+}
+
+HistoryCommand::HistoryCommand(const char *cmd_line, History *history) : BuiltInCommand(cmd_line),
+                                                                         history(history) {
+    if (num_of_args >= 3 && strcmp(args[1], "-s") == 0) {
+        this->search = true;
+        // the rest of the line, so that patterns may contain spaces
+        this->pattern = args[2];
+        for (int i = 3; i < num_of_args; i++) {
+            this->pattern += std::string(" ") + args[i];
+        }
+    } else if (num_of_args == 2 && isDigits(args[1])) {
+        this->count = stoul(args[1]);
+    } else if (num_of_args != 1) {
+        smashError::InvalidArguments("history");
+        this->setError();
+    }
+}
+
+void HistoryCommand::printEntry(size_t position) {
+    char number[32];
+    snprintf(number, sizeof number, "%5zu  ", position + 1);
+    out() << number << this->history->at(position) << '\n';
+}
+
+void HistoryCommand::execute() {
+    if (this->search) {
+        for (size_t position: this->history->search(this->pattern, SIZE_MAX)) {
+            printEntry(position);
+        }
         return;
     }
-    char buffer[1];
-    char last_char;
-    std::memset(buffer, 0, sizeof buffer);
-    size_t count = 0;
-    int count_line = 1;
-    ssize_t res;
+    size_t size = this->history->size();
+    for (size_t position = size > this->count ? size - this->count : 0; position < size; position++) {
+        printEntry(position);
+    }
+}
 
+// a line count, which unlike isDigits() may be neither empty nor negative
+static bool _isLineCount(const char *arg) {
+    return *arg != '\0' && strspn(arg, "0123456789") == strlen(arg);
+}
 
+FileLinesCommand::FileLinesCommand(const char *cmd_line, bool from_end) : BuiltInCommand(cmd_line),
+                                                                          from_end(from_end) {
+    int i = 1;
+    if (i < num_of_args && args[i][0] == '-' && _isLineCount(args[i] + 1)) {
+        this->lines = atol(args[i] + 1);
+        i++;
+    } else if (i + 1 < num_of_args && strcmp(args[i], "-n") == 0 && _isLineCount(args[i + 1])) {
+        this->lines = atol(args[i + 1]);
+        i += 2;
+    }
+    // patterns are expanded as for external commands, rotated shards being the usual multi-file case
+    Glob &glob = SmallShell::getInstance().getGlob();
+    for (; i < num_of_args; i++) {
+        if (args[i][0] == '-' && args[i][1] != '\0') {
+            smashError::InvalidArguments(from_end ? "tail" : "head");
+            this->setError();
+            return;
+        }
+        vector<string> matches;
+        if (Glob::hasMagic(args[i])) {
+            matches = glob.expand(args[i]);
+        }
+        if (matches.empty()) {
+            this->files.push_back(args[i]);
+        } else {
+            this->files.insert(this->files.end(), matches.begin(), matches.end());
+        }
+    }
+}
+
+namespace {
+    // a file of tail or head: the part of it found so far, which grows by a block per round
+    struct LinesSource {
+        int fd = -1;
+        off_t size = 0;
+        // the bytes [start, end) of the file
+        off_t start = 0;
+        off_t end = 0;
+        std::string data;
+        long found = 0;
+        bool done = false;
+        bool failed = false;
+        std::vector<char> block;
+    };
+}
+
+// the length of the last lines at the end of block, or npos if it does not hold them all yet; the final
+// newline of the file ends the last line instead of starting a new one
+static size_t _tailCut(const char *block, size_t len, bool ends_file, long lines, long &found) {
+    size_t pos = len;
+    if (ends_file && pos > 0 && block[pos - 1] == '\n') {
+        pos--;
+    }
+    while (pos > 0) {
+        auto newline = (const char *) memrchr(block, '\n', pos);
+        if (newline == nullptr) {
+            break;
+        }
+        pos = newline - block;
+        if (++found == lines) {
+            return len - (pos + 1);
+        }
+    }
+    return std::string::npos;
+}
+
+// the length of the first lines at the start of block, or npos if it does not hold them all yet
+static size_t _headCut(const char *block, size_t len, long lines, long &found) {
+    size_t pos = 0;
+    while (pos < len) {
+        auto newline = (const char *) memchr(block + pos, '\n', len - pos);
+        if (newline == nullptr) {
+            break;
+        }
+        pos = newline - block + 1;
+        if (++found == lines) {
+            return pos;
+        }
+    }
+    return std::string::npos;
+}
+
+std::string FileLinesCommand::readStream(int fd, bool &failed) {
+    std::string data;
+    char buffer[LINES_FIRST_BLOCK];
+    long found = 0;
+    size_t trim_at = LINES_STREAM_WINDOW;
     while (true) {
-        res = read(file_fd, &buffer, 1);
+        if (WorkerPool::cancelRequested()) {
+            failed = true;
+            break;
+        }
+        ssize_t res = read(fd, buffer, sizeof buffer);
+        if (res == -1 && errno == EINTR) {
+            continue;
+        }
         if (res == -1) {
             smashError::SyscallFailed("read");
+            failed = true;
             break;
-        } else if (res == 0) {
+        }
+        if (res == 0) {
             break;
+        }
+        if (!this->from_end) {
+            // head can stop as soon as it has its lines
+            size_t cut = _headCut(buffer, res, this->lines, found);
+            data.append(buffer, cut == std::string::npos ? res : cut);
+            if (cut != std::string::npos) {
+                return data;
+            }
         } else {
-            if (buffer[0] == '\n' || buffer[0] == '\r') {
-                count_line += 1;
+            data.append(buffer, res);
+            if (data.size() > trim_at) {
+                // one line more than asked for, since a newline at the end may turn out to end the input
+                long counted = 0;
+                size_t cut = _tailCut(data.data(), data.size(), false,
+                                      this->lines < LONG_MAX ? this->lines + 1 : this->lines, counted);
+                if (cut != std::string::npos) {
+                    data.erase(0, data.size() - cut);
+                }
+                // long lines may keep the window large; trimming again only once it doubles stays linear
+                trim_at = std::max<size_t>(LINES_STREAM_WINDOW, 2 * data.size());
             }
-            last_char = buffer[0];
-            count += res;
         }
     }
-    if (last_char == '\n') {
-        count_line--;
+    if (this->from_end) {
+        size_t cut = _tailCut(data.data(), data.size(), true, this->lines, found);
+        if (cut != std::string::npos) {
+            data.erase(0, data.size() - cut);
+        }
     }
-    if (count == 0) {
-        close(file_fd);
+    return data;
+}
+
+void FileLinesCommand::execute() {
+    if (this->lines == 0) {
+        return;
+    }
+    if (this->files.empty()) {
+        bool failed = false;
+        std::string data = readStream(getInFd(), failed);
+        if (!WorkerPool::cancelRequested()) {
+            out() << data;
+        }
         return;
     }
-    lseek(file_fd, 0, SEEK_SET);
-    size_t pos_to_start_from = 0;
-    if (count_line >= n) {
-        int i = 0;
-        while (i < count_line - n) {
-            res = read(file_fd, &buffer, 1);
-            if (res == -1) {
+    std::vector<LinesSource> sources(this->files.size());
+    for (size_t i = 0; i < this->files.size(); i++) {
+        LinesSource &source = sources[i];
+        source.fd = open(this->files[i].c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st{};
+        if (source.fd == OPEN_FAILED || fstat(source.fd, &st) == -1) {
+            smashError::SyscallFailed("open");
+            source.failed = source.done = true;
+        } else if (S_ISDIR(st.st_mode)) {
+            errno = EISDIR;
+            smashError::SyscallFailed("read");
+            source.failed = source.done = true;
+        } else if (!S_ISREG(st.st_mode)) {
+            source.data = readStream(source.fd, source.failed);
+            source.done = true;
+        } else {
+            source.size = st.st_size;
+            source.start = source.end = this->from_end ? st.st_size : 0;
+            source.done = st.st_size == 0;
+        }
+    }
+
+    BlockReader reader;
+    std::vector<BlockRead> reads;
+    std::vector<LinesSource *> reading;
+    for (size_t block = LINES_FIRST_BLOCK;; block = std::min<size_t>(block * 2, LINES_MAX_BLOCK)) {
+        reads.clear();
+        reading.clear();
+        for (auto &source: sources) {
+            if (source.done) {
+                continue;
+            }
+            off_t left = this->from_end ? source.start : source.size - source.end;
+            size_t len = std::min<off_t>(block, left);
+            source.block.resize(len);
+            reads.push_back({source.fd, this->from_end ? source.start - (off_t) len : source.end, len,
+                             source.block.data()});
+            reading.push_back(&source);
+        }
+        // a cancelled worker prints nothing, but still closes its files below
+        if (reads.empty() || WorkerPool::cancelRequested()) {
+            break;
+        }
+        reader.readAll(reads);
+        for (size_t i = 0; i < reads.size(); i++) {
+            LinesSource &source = *reading[i];
+            if (reads[i].result < 0) {
+                errno = (int) -reads[i].result;
                 smashError::SyscallFailed("read");
+                source.failed = source.done = true;
+                continue;
+            }
+            const char *data = source.block.data();
+            size_t len = reads[i].result;
+            // fewer bytes than asked for means the file was truncated under us; what was read is all there is
+            bool short_read = len < reads[i].len;
+            if (this->from_end) {
+                size_t cut = _tailCut(data, len, source.start == source.size, this->lines, source.found);
+                if (cut != std::string::npos) {
+                    source.data.insert(0, data + len - cut, cut);
+                    source.done = true;
+                } else {
+                    source.data.insert(0, data, len);
+                    source.start -= (off_t) reads[i].len;
+                    source.done = source.start == 0 || short_read;
+                }
+            } else {
+                size_t cut = _headCut(data, len, this->lines, source.found);
+                source.data.append(data, cut != std::string::npos ? cut : len);
+                source.end += (off_t) len;
+                source.done = cut != std::string::npos || source.end >= source.size || short_read;
+            }
+        }
+    }
+
+    bool headers = this->files.size() > 1, first = true;
+    for (size_t i = 0; i < sources.size(); i++) {
+        LinesSource &source = sources[i];
+        if (source.fd != OPEN_FAILED) {
+            close(source.fd);
+        }
+        if ((source.failed && source.data.empty()) || WorkerPool::cancelRequested()) {
+            continue;
+        }
+        if (headers) {
+            out() << (first ? "" : "\n") << "==> " << this->files[i] << " <==\n";
+        }
+        first = false;
+        out() << source.data;
+    }
+}
+
+// -x value or -xvalue, for the options of sort that take one; rest is what follows the option's letter
+static const char *_optionValue(char **args, int num_of_args, int &i, const char *rest) {
+    if (*rest != '\0') {
+        return rest;
+    }
+    return i + 1 < num_of_args ? args[++i] : nullptr;
+}
+
+// false if args[i] is not an option sort knows, or lacks its value. Flags may be clustered, as in -nr, and
+// the last of a cluster may take a value, as in -nk2 or -rt,
+bool SortCommand::parseOption(int &i) {
+    const char *arg = args[i];
+    if (strncmp(arg, "--parallel=", 11) == 0) {
+        if (!_isLineCount(arg + 11) || atoi(arg + 11) == 0) {
+            return false;
+        }
+        this->options.threads = atoi(arg + 11);
+        return true;
+    }
+    for (const char *flag = arg + 1; *flag != '\0'; flag++) {
+        switch (*flag) {
+            case 'f':
+                this->options.ignore_case = true;
                 break;
-            } else if (res == 0) {
+            case 'n':
+                this->options.numeric = true;
                 break;
-            } else {
-                if (buffer[0] == '\n') {
-                    i += 1;
+            case 'r':
+                this->options.reverse = true;
+                break;
+            case 'u':
+                this->options.unique = true;
+                break;
+            case 't':
+            case 'k':
+            case 'S':
+            case 'T':
+                return parseValue(*flag, _optionValue(args, num_of_args, i, flag + 1));
+            default:
+                return false;
+        }
+    }
+    return true;
+}
+
+bool SortCommand::parseValue(char option, const char *value) {
+    if (value == nullptr) {
+        return false;
+    }
+    switch (option) {
+        case 't':
+            if (value[0] == '\0' || value[1] != '\0') {
+                return false;
+            }
+            this->options.separator = (unsigned char) value[0];
+            return true;
+        case 'k': {
+            char *end;
+            long first = strtol(value, &end, 10);
+            if (first <= 0 || (*end != '\0' && *end != ',')) {
+                return false;
+            }
+            long last = 0;
+            if (*end == ',') {
+                last = strtol(end + 1, &end, 10);
+                if (last < first || *end != '\0') {
+                    return false;
                 }
-                pos_to_start_from += res;
             }
+            this->options.key_first = (int) first;
+            this->options.key_last = (int) last;
+            return true;
+        }
+        case 'S': {
+            // sizes as limit takes them
+            rlim_t size;
+            if (!ResourceLimits::parseValue(LIMIT_AS, value, size) || size == RLIM_INFINITY) {
+                return false;
+            }
+            this->options.buffer_size = size;
+            return true;
         }
+        default:
+            this->options.temp_dir = value;
+            return true;
     }
+}
 
-    lseek(file_fd, pos_to_start_from, SEEK_SET);
-    char *whole_file = new char[count - pos_to_start_from];
-    res = read(file_fd, whole_file, count - pos_to_start_from);
-    if (res == -1) {
+SortCommand::SortCommand(const char *cmd_line) : BuiltInCommand(cmd_line) {
+    // read here, since the environment belongs to the shell's thread and sort may run on a worker
+    Environment &env = SmallShell::getInstance().getEnvironment();
+    if (!env.get("TMPDIR").empty()) {
+        this->options.temp_dir = env.get("TMPDIR");
+    }
+    Glob &glob = SmallShell::getInstance().getGlob();
+    for (int i = 1; i < num_of_args; i++) {
+        if (args[i][0] == '-' && args[i][1] != '\0' && this->files.empty()) {
+            if (!parseOption(i)) {
+                smashError::InvalidArguments("sort");
+                this->setError();
+                return;
+            }
+            continue;
+        }
+        vector<string> matches;
+        if (Glob::hasMagic(args[i])) {
+            matches = glob.expand(args[i]);
+        }
+        if (matches.empty()) {
+            this->files.push_back(args[i]);
+        } else {
+            this->files.insert(this->files.end(), matches.begin(), matches.end());
+        }
+    }
+}
+
+void SortCommand::execute() {
+    ExternalSort sorter(this->options);
+    if (this->files.empty()) {
+        this->files.emplace_back("-");
+    }
+    for (auto &file: this->files) {
+        int fd = file == "-" ? getInFd() : open(file.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == OPEN_FAILED) {
+            smashError::SyscallFailed("open");
+            return;
+        }
+        bool added = sorter.add(fd);
+        if (fd != getInFd()) {
+            close(fd);
+        }
+        // like GNU sort, nothing is printed unless every input could be read
+        if (!added) {
+            if (!WorkerPool::cancelRequested()) {
+                smashError::SyscallFailed("sort");
+            }
+            return;
+        }
+    }
+    out().flush();
+    if (!sorter.finish(getOutFd()) && errno != EPIPE && !WorkerPool::cancelRequested()) {
+        smashError::SyscallFailed("sort");
+    }
+}
+
+UniqCommand::UniqCommand(const char *cmd_line) : BuiltInCommand(cmd_line) {
+    for (int i = 1; i < num_of_args; i++) {
+        if (args[i][0] == '-' && args[i][1] != '\0' && this->file.empty()) {
+            for (const char *flag = args[i] + 1; *flag != '\0'; flag++) {
+                switch (*flag) {
+                    case 'c':
+                        this->count = true;
+                        break;
+                    case 'd':
+                        this->only_repeated = true;
+                        break;
+                    case 'u':
+                        this->only_unique = true;
+                        break;
+                    case 'i':
+                        this->ignore_case = true;
+                        break;
+                    default:
+                        smashError::InvalidArguments("uniq");
+                        this->setError();
+                        return;
+                }
+            }
+        } else if (this->file.empty()) {
+            this->file = args[i];
+        } else {
+            smashError::InvalidArguments("uniq");
+            this->setError();
+            return;
+        }
+    }
+}
+
+void UniqCommand::printGroup(LineWriter &writer, const std::string &line, long repeats) const {
+    if ((this->only_repeated && repeats == 1) || (this->only_unique && repeats > 1)) {
+        return;
+    }
+    if (this->count) {
+        char prefix[32];
+        int len = snprintf(prefix, sizeof prefix, "%7ld ", repeats);
+        writer.write(prefix, len);
+    }
+    writer.writeLine(line.data(), line.size());
+}
+
+static bool _sameLine(const std::string &line, const char *other, size_t len, bool ignore_case) {
+    if (line.size() != len) {
+        return false;
+    }
+    if (!ignore_case) {
+        return memcmp(line.data(), other, len) == 0;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (toupper((unsigned char) line[i]) != toupper((unsigned char) other[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void UniqCommand::execute() {
+    int fd = getInFd();
+    if (!this->file.empty() && this->file != "-") {
+        fd = open(this->file.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == OPEN_FAILED) {
+            smashError::SyscallFailed("open");
+            return;
+        }
+    }
+    out().flush();
+    LineReader reader(fd);
+    LineWriter writer(getOutFd());
+    // the first line of the group being counted
+    std::string group;
+    long repeats = 0;
+    const char *line;
+    size_t len;
+    bool failed = false;
+    while (writer.good() && reader.next(line, len, failed)) {
+        if (repeats > 0 && _sameLine(group, line, len, this->ignore_case)) {
+            repeats++;
+            continue;
+        }
+        if (repeats > 0) {
+            printGroup(writer, group, repeats);
+        }
+        group.assign(line, len);
+        repeats = 1;
+    }
+    if (failed && !WorkerPool::cancelRequested()) {
         smashError::SyscallFailed("read");
     }
-    write(STDOUT_FILENO, whole_file, count - pos_to_start_from);
-    delete[] whole_file;
-    close(file_fd);
+    if (repeats > 0 && !failed) {
+        printGroup(writer, group, repeats);
+    }
+    if (fd != getInFd()) {
+        close(fd);
+    }
+    if (!writer.flush() && errno != EPIPE && !WorkerPool::cancelRequested()) {
+        smashError::SyscallFailed("uniq");
+    }
 }
 
 void TouchCommand::execute() {
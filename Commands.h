@@ -16,9 +16,26 @@
 #include <utime.h>
 #include <climits>
 #include <cstring>
-
-#define COMMAND_ARGS_MAX_LENGTH (200)
-#define COMMAND_MAX_ARGS (20)
+#include <cerrno>
+#include <regex>
+#include <functional>
+#include <unordered_map>
+#include "Environment.h"
+#include "Glob.h"
+#include "ProcStats.h"
+#include "Redirection.h"
+#include "Trace.h"
+#include "History.h"
+#include "Limits.h"
+#include "Plugin.h"
+#include "Pool.h"
+#include "Sort.h"
+#include "Worker.h"
+
+// bytes the kernel reserves per argv/envp pointer on top of the strings themselves
+#define ARG_POINTER_OVERHEAD    (sizeof(char *))
+// headroom left below ARG_MAX when packing argument lists, as xargs does
+#define ARG_MAX_HEADROOM        (2048)
 
 #define YEARS_OFFSET    1900
 #define MONTHS_OFFSET   1
@@ -28,6 +45,11 @@
 #define OPEN_FAILED     (-1)
 #define PIPE_READ       0
 #define PIPE_WRITE      1
+#define WAIT_TIMED_OUT  124
+// shell functions calling each other deeper than this are stopped before they exhaust the stack
+#define FUNCTION_MAX_DEPTH  (100)
+// characters the name of an alias, function or plugin command cannot contain
+#define COMMAND_NAME_SPECIALS   "'\"\\$<>|&;(){}`="
 
 inline void freeArgs(char** args,int num_of_args)
 {
@@ -47,50 +69,127 @@ inline bool isDigits(const std::string &str) {
 
 class smashError {
 public:
+    // set whenever an error is reported, used to derive the exit status of builtins
+    static inline thread_local bool raised = false;
+    // the stderr of the command being created or run, which may be redirected; per thread, as builtins
+    // may run on workers
+    static inline thread_local std::ostream *stream = &OutputSink::standard(STDERR_FILENO);
+
+    // returns the previous stream
+    static std::ostream *setStream(std::ostream *err) {
+        std::ostream *previous = stream;
+        stream = err;
+        return previous;
+    }
+
     static void TooManyArguments(const std::string& func) {
+        raised = true;
         std::string error_msg = "smash error: " + func + ": " + "too many arguments";
-        std::cerr << error_msg << std::endl;
+        *stream << error_msg << '\n';
     }
 
     static void PWDNotSet(const std::string& func) {
+        raised = true;
         std::string error_msg = "smash error: " + func + ": " + "OLDPWD not set";
-        std::cerr << error_msg << std::endl;
+        *stream << error_msg << '\n';
     }
 
     static void InvalidArguments(const std::string& func) {
+        raised = true;
         std::string error_msg = "smash error: " + func + ": " + "invalid arguments";
-        std::cerr << error_msg << std::endl;
+        *stream << error_msg << '\n';
     }
 
     static void NotExist(int jobID, const std::string& func) {
+        raised = true;
         std::string error_msg = "smash error: " + func +  ": " + "job-id " + std::to_string(jobID) + " does not exist"  ;
-        std::cerr << error_msg << std::endl;
+        *stream << error_msg << '\n';
     }
 
     static void EmptyJobList(const std::string& func) {
+        raised = true;
         std::string error_msg = "smash error: " + func + ": " + "jobs list is empty";
-        std::cerr << error_msg << std::endl;
+        *stream << error_msg << '\n';
     }
 
     static void AlreadyRunning(int jobID, const std::string& func) {
+        raised = true;
         std::string error_msg = "smash error: " + func + ": " + "job-id " + std::to_string(jobID);
         error_msg += " is already running in the background";
-        std::cerr << error_msg << std::endl;
+        *stream << error_msg << '\n';
     }
 
     static void NoneStoppedJobs(const std::string& func) {
+        raised = true;
         std::string error_msg = "smash error: " + func + ": " + "there is no stopped jobs to resume";
-        std::cerr << error_msg << std::endl;
+        *stream << error_msg << '\n';
+    }
+
+    static void InvalidIdentifier(const std::string& func, const std::string& name) {
+        raised = true;
+        std::string error_msg = "smash error: " + func + ": " + "`" + name + "': not a valid identifier";
+        *stream << error_msg << '\n';
+    }
+
+    static void ArgumentListTooLong(const std::string& func) {
+        raised = true;
+        std::string error_msg = "smash error: " + func + ": " + "argument list too long";
+        *stream << error_msg << '\n';
+    }
+
+    static void CommandNotFound(const std::string& func, const std::string& cmd) {
+        raised = true;
+        std::string error_msg = "smash error: " + func + ": " + cmd + ": command not found";
+        *stream << error_msg << '\n';
+    }
+
+    static void NoMatchingJobs(const std::string& func) {
+        raised = true;
+        std::string error_msg = "smash error: " + func + ": " + "no matching jobs";
+        *stream << error_msg << '\n';
+    }
+
+    static void NotFound(const std::string& func, const std::string& name) {
+        raised = true;
+        std::string error_msg = "smash error: " + func + ": " + name + ": not found";
+        *stream << error_msg << '\n';
+    }
+
+    static void NestingTooDeep(const std::string& func) {
+        raised = true;
+        std::string error_msg = "smash error: " + func + ": maximum function nesting level exceeded";
+        *stream << error_msg << '\n';
+    }
+
+    static void LoadFailed(const std::string& error) {
+        raised = true;
+        std::string error_msg = "smash error: load: " + error;
+        *stream << error_msg << '\n';
+    }
+
+    static void SyntaxError(const std::string& token) {
+        raised = true;
+        std::string error_msg = "smash error: syntax error near unexpected token `" + token + "'";
+        *stream << error_msg << '\n';
     }
 
     static void ForkFailed() {
-        std::string error_msg = "smash error: forked failed";
-        perror(error_msg.c_str());
+        raised = true;
+        std::string error_msg = "smash error: forked failed: " + std::string(strerror(errno));
+        *stream << error_msg << '\n';
+    }
+
+    static void RunsInShell(int jobID, const std::string& func) {
+        raised = true;
+        std::string error_msg = "smash error: " + func + ": " + "job-id " + std::to_string(jobID);
+        error_msg += " runs inside smash";
+        *stream << error_msg << '\n';
     }
 
     static void SyscallFailed(const std::string& syscall) {
-        std::string error_msg = "smash error: " + syscall + " failed";
-        perror(error_msg.c_str());
+        raised = true;
+        std::string error_msg = "smash error: " + syscall + " failed: " + strerror(errno);
+        *stream << error_msg << '\n';
     }
 
 };
@@ -100,14 +199,22 @@ public:
 class Command {
 
 public:
-    char *cmd_line;
-    char *bg_cmd;
-    pid_t cmd_pid;
+    std::string cmd_line;
+    std::string bg_cmd;
+    pid_t cmd_pid = -1;
     bool bg_command;
-    char *actual_cmd;
+    std::string actual_cmd;
     bool error = false;
+    // set by builtins whose exit status is not just success/failure
+    int exit_status = -1;
+    Redirections redirections;
+    // put in place in the forked child; the usage is filled in once the command is reaped
+    ResourceLimits limits;
+    struct rusage usage{};
 
 public:
+    POOL_ALLOCATED()
+
     explicit Command(const char *cmd_line);
 
     virtual ~Command() =default;
@@ -119,7 +226,7 @@ public:
     }
 
     const char *getCmdLine() const {
-        return cmd_line;
+        return cmd_line.c_str();
     }
     void setError(){
         this->error = true;
@@ -127,74 +234,244 @@ public:
     bool getError() const{
         return this->error;
     }
+    void setExitStatus(int status) {
+        this->exit_status = status;
+    }
+    int getExitStatus() const {
+        return this->exit_status;
+    }
 
     void setCmdPID(pid_t new_pid) {
         cmd_pid = new_pid;
     }
-    virtual void prepare() { };
-    virtual void cleanup() { };
 
+    const ResourceLimits &getLimits() const {
+        return this->limits;
+    }
+    void setLimits(const ResourceLimits &new_limits) {
+        this->limits = new_limits;
+    }
+    const struct rusage &getUsage() const {
+        return this->usage;
+    }
+
+    void setRedirections(Redirections &&new_redirections) {
+        this->redirections = std::move(new_redirections);
+    }
+    // in a forked child, before exec
+    void applyRedirections() const {
+        this->redirections.apply();
+    }
+    // in the shell once the command no longer needs them
+    void closeRedirections() {
+        this->redirections.close();
+    }
+    // before the command runs on a worker thread
+    bool detachRedirections() {
+        return this->redirections.detach();
+    }
+    // in the shell, for a pipeline stage run on a worker; false, leaving fd to the caller, if target was
+    // redirected already
+    bool attachRedirection(int target, int fd) {
+        return this->redirections.attach(target, fd);
+    }
 
+    int getInFd() const {
+        return this->redirections.get(STDIN_FILENO);
+    }
+    int getOutFd() const {
+        return this->redirections.get(STDOUT_FILENO);
+    }
+    // what builtins print to instead of std::cout / std::cerr; buffered until flushOutput()
+    std::ostream &out() {
+        return this->redirections.stream(STDOUT_FILENO);
+    }
+    std::ostream &err() {
+        return this->redirections.stream(STDERR_FILENO);
+    }
+    void flushOutput() {
+        this->redirections.flush();
+    }
+
+    // how the shell controls the command once it runs: as a forked process here, while WorkerCommand
+    // overrides these for builtins running on a worker thread
+    virtual int sendSignal(int sig_num, bool process_group = false) {
+        return kill(process_group ? -this->cmd_pid : this->cmd_pid, sig_num);
+    }
+    // as waitpid(): the pid once the command finished, with status filled in, or 0 while it runs
+    virtual pid_t reap(int *status, int options) {
+        return wait4(this->cmd_pid, status, options, &this->usage);
+    }
+    // a descriptor that polls readable once the command finished, or -1 with errno set
+    virtual int openWaitFd() const;
+    // the processes that limits set on the running command apply to
+    virtual std::vector<pid_t> processes() const;
 };
 
+// wherever a command is reaped: ends its trace slice, and tells the user when it most likely died of one of
+// its resource limits
+void commandReaped(const Command *cmd, int status);
+
 class BuiltInCommand : public Command {
 protected:
     char **args;
     int num_of_args;
 public:
     explicit BuiltInCommand(const char *cmd_line);
-    virtual ~BuiltInCommand()  =default;
+    virtual ~BuiltInCommand() {
+        freeArgs(args, num_of_args);
+    }
+};
+
+/*
+ * A builtin running on a worker thread, either as a background job or as a pipeline stage. The jobs list,
+ * kill, fg and wait treat it like a process whose pid is the worker's thread id: a terminating signal
+ * cancels it, reap() reports its exit status (or the cancelling signal) in waitpid() form, and it can not be
+ * stopped. Destroying it while it runs cancels it and waits for the worker to let go.
+ */
+class WorkerCommand : public Command {
+    std::unique_ptr<Command> builtin;
+    std::shared_ptr<WorkerTask> task;
+public:
+    // the caller has reserved a worker from WorkerPool
+    explicit WorkerCommand(std::unique_ptr<Command> builtin);
+
+    virtual ~WorkerCommand();
+
+    // starts the builtin on the reserved worker and returns right away
+    void execute() override;
+
+    int sendSignal(int sig_num, bool process_group = false) override;
+
+    pid_t reap(int *status, int options) override;
+
+    int openWaitFd() const override;
+
+    // none: the builtin shares smash's own process
+    std::vector<pid_t> processes() const override;
+
+    Command *getBuiltin() {
+        return this->builtin.get();
+    }
 };
 
 class ExternalCommand : public Command {
+    std::vector<std::string> argv_words;
+    std::vector<char *> argv;
+    std::string exec_path;
+    char *const *envp;
 public:
-    explicit ExternalCommand(const char *cmd_line) : Command(cmd_line) {}
+    explicit ExternalCommand(const char *cmd_line);
 
-    virtual ~ExternalCommand()  =default;
+    virtual ~ExternalCommand() = default;
 
     void execute() override;
 };
 
+// a process a builtin forked and waited for itself, handed to the jobs list when it stops in the foreground
+class ChildProcessCommand : public Command {
+public:
+    ChildProcessCommand(const char *cmd_line, pid_t pid) : Command(cmd_line) {
+        setCmdPID(pid);
+    }
+
+    virtual ~ChildProcessCommand() = default;
+
+    // already running
+    void execute() override {}
+};
+
+enum PipeMode {
+    PIPE_STDOUT,    // '|'
+    PIPE_STDERR,    // '|&'
+    PIPE_BOTH       // '&|', stdout and stderr merged into the same pipe
+};
+
+/*
+ * A pipeline of any number of stages, run as a single job. The forked stages share one process group, led by
+ * the first of them, whose pid is the job's; builtin stages run on workers. Signals go to the whole group
+ * and to the workers, and reap() reports the pipeline as stopped as soon as one of its processes stops, or
+ * as finished with the last stage's status once every stage has.
+ */
 class PipeCommand : public Command {
-    std::string cmd1;
-    std::string cmd2;
-    bool err;
 public:
-    PipeCommand(const char *cmd_line,std::string cmd1, std::string cmd2, bool err):
-            Command(cmd_line),cmd1(cmd1),cmd2(cmd2),err(err){};
+    struct Stage {
+        std::string cmd_line;
+        // how the stage's output reaches the next one; unused for the last stage
+        PipeMode mode = PIPE_STDOUT;
+        pid_t pid = -1;
+        std::unique_ptr<WorkerCommand> worker;
+        bool finished = false;
+        int status = 0;
+    };
+private:
+    std::vector<Stage> stages;
+    // 0 in a subshell, where the stages stay in the subshell's group
+    pid_t pgid = 0;
+
+    void startStages();
+
+public:
+    PipeCommand(const char *cmd_line, std::vector<Stage> stages) : Command(cmd_line), stages(std::move(stages)) {};
 
-    virtual ~PipeCommand()=default;
+    virtual ~PipeCommand() = default;
 
+    // starts every stage and returns right away; the shell waits for the pipeline with reap()
     void execute() override;
+
+    int sendSignal(int sig_num, bool process_group = false) override;
+
+    pid_t reap(int *status, int options) override;
+
+    int openWaitFd() const override;
+
+    std::vector<pid_t> processes() const override;
+};
+
+enum ChainOperator {
+    CHAIN_ALWAYS,   // first command or ';'
+    CHAIN_AND,      // '&&'
+    CHAIN_OR        // '||'
 };
 
-class RedirectionCommand : public Command {
-    std::string RCCmd;
-    std::string RCOutputFile;
-    int flags;
-    int file_fd;
-    int saved_stdout_fd;
+class ChainCommand : public Command {
 public:
-    RedirectionCommand(const char *cmd_line,std::string RCCmd, std::string RCOutputFile,int flags):Command(cmd_line),
-                                                                                                   RCCmd(RCCmd),RCOutputFile(RCOutputFile), flags(flags), file_fd(-1) ,saved_stdout_fd(STDOUT_FILENO){}
+    struct Link {
+        ChainOperator op;
+        std::string cmd;
+    };
+private:
+    std::vector<Link> links;
+public:
+    ChainCommand(const char *cmd_line, std::vector<Link> links) : Command(cmd_line), links(std::move(links)) {};
+
+    virtual ~ChainCommand() = default;
+
+    void execute() override;
+};
 
+// runs the body of a shell function in smash itself, with the call's arguments as $1, $2, ...
+class FunctionCommand : public BuiltInCommand {
+    std::string name;
+    std::string body;
+    std::vector<std::string> params;
+public:
+    FunctionCommand(const char *cmd_line, std::string name, std::string body);
 
-    virtual ~RedirectionCommand()=default;
+    virtual ~FunctionCommand() = default;
 
     void execute() override;
-    void prepare() override;
-    void cleanup() override;
 };
 
 class ChangeDirCommand : public BuiltInCommand {
-    char **plastPwd;
+    std::string plastPwd;
     std::string path;
 public:
-    ChangeDirCommand(const char *cmd_line, char **plastPwd) : BuiltInCommand(cmd_line),plastPwd(plastPwd){
+    ChangeDirCommand(const char *cmd_line, std::string plastPwd) : BuiltInCommand(cmd_line),plastPwd(plastPwd){
         if (this->num_of_args > 2) {
             smashError::TooManyArguments("cd");
             this->setError();
-        } else {
+        } else if (this->num_of_args == 2) {
             this->path= this->args[1];
         }
     }
@@ -246,91 +523,93 @@ public:
     class JobEntry {
         int jobID;
 
-        Command *cmd;
+        std::unique_ptr<Command> cmd;
         time_t time_inserted;
         bool stopped;
 
     public:
-        JobEntry(int jobID, Command *cmd, time_t time_inserted, bool stopped) : jobID(jobID), cmd(cmd),
-                                                                                time_inserted(time_inserted),
-                                                                                stopped(stopped) {}
+        POOL_ALLOCATED()
+
+        JobEntry(int jobID, std::unique_ptr<Command> cmd, time_t time_inserted, bool stopped) : jobID(jobID),
+                                                                                                cmd(std::move(cmd)),
+                                                                                                time_inserted(time_inserted),
+                                                                                                stopped(stopped) {}
+
+        virtual ~JobEntry() = default;
 
         int getJobID() {
             return this->jobID;
         }
 
         Command *getJobCMD() {
-            return this->cmd;
+            return this->cmd.get();
         }
 
         bool getStoppedStatus() {
             return this->stopped;
         }
 
+        time_t getTimeInserted() const {
+            return this->time_inserted;
+        }
+
         void setStoppedStatus(bool stop) {
+            if (stop != this->stopped) {
+                Trace::event(stop ? TRACE_JOB_STOP : TRACE_JOB_RESUME, this->cmd->getCmdPID());
+            }
             this->stopped = stop;
         }
         void setTimeInserted(){
             this->time_inserted= time(nullptr);
         }
-        void setCMD(Command* command){
-            this->cmd =command;
-        }
 
         friend std::ostream &operator<<(std::ostream &os, const JobEntry &jobEntry);
     };
 
-    std::vector<JobEntry *> *jobs_list;
+    std::vector<std::unique_ptr<JobEntry>> jobs_list;
 public:
-    JobsList() : jobs_list(new std::vector<JobEntry *>()) {}
+    JobsList() = default;
 
     ~JobsList() = default;
 
-    void addJob(Command *cmd, bool isStopped = false) {
+    JobEntry *addJob(std::unique_ptr<Command> cmd, bool isStopped = false) {
         int index = 1;
-        if (!jobs_list->empty()) {
-            index = jobs_list->back()->getJobID() + 1;
+        if (!jobs_list.empty()) {
+            index = jobs_list.back()->getJobID() + 1;
         }
-        for(auto iter = jobs_list->begin(); iter != jobs_list->end() ; iter++)
-        {
-            if((*iter)->getJobCMD()->getCmdPID() == cmd->getCmdPID())
-            {
-                (*iter)->setTimeInserted();
-                (*iter)->setStoppedStatus(isStopped);
-                (*iter)->setCMD(cmd);
-                return;
-            }
+        jobs_list.push_back(std::unique_ptr<JobEntry>(new JobEntry(index, std::move(cmd), time(nullptr), isStopped)));
+        pid_t pid = jobs_list.back()->getJobCMD()->getCmdPID();
+        Trace::event(TRACE_JOB_ADDED, pid, index);
+        if (isStopped) {
+            Trace::event(TRACE_JOB_STOP, pid);
         }
-        JobEntry *new_job = new JobEntry(index, cmd, time(nullptr), isStopped);
-        jobs_list->push_back(new_job);
+        return jobs_list.back().get();
     }
 
-    void printJobsList() {
-        for (auto &job: *this->jobs_list) {
-            std::cout << *job;
+    void printJobsList(std::ostream &os) {
+        for (auto &job: this->jobs_list) {
+            os << *job;
         }
     }
 
-    void killAllJobs(){
-        for (auto &job: *this->jobs_list) {
-            if (kill(job->getJobCMD()->getCmdPID(), SIGKILL) !=SUCCESS){
+    void killAllJobs(std::ostream &os){
+        for (auto &job: this->jobs_list) {
+            if (job->getJobCMD()->sendSignal(SIGKILL) != SUCCESS) {
                 smashError::SyscallFailed("kill");
             }
-            std::cout << job->getJobCMD()->getCmdPID() << ": ";
-            std::cout << job->getJobCMD()->getCmdLine() << std::endl;
+            os << job->getJobCMD()->getCmdPID() << ": ";
+            os << job->getJobCMD()->getCmdLine() << '\n';
         }
     }
 
-    void removeFinishedJobs() const {
-        pid_t zombie_pid;
-        if (this->jobs_list == nullptr || jobs_list->empty()) {
-            return;
-        }
-        auto iter = this->jobs_list->begin();
-        while (iter != this->jobs_list->end()) {
-            zombie_pid = waitpid((*iter)->getJobCMD()->getCmdPID(), nullptr, WNOHANG);
-            if (*iter != nullptr && (*iter)->getJobCMD()->getCmdPID() == zombie_pid) {
-                this->jobs_list->erase(iter);
+    void removeFinishedJobs() {
+        auto iter = this->jobs_list.begin();
+        while (iter != this->jobs_list.end()) {
+            pid_t pid = (*iter)->getJobCMD()->getCmdPID();
+            int status = 0;
+            if ((*iter)->getJobCMD()->reap(&status, WNOHANG) == pid) {
+                commandReaped((*iter)->getJobCMD(), status);
+                iter = this->jobs_list.erase(iter);
             } else {
                 iter++;
             }
@@ -338,61 +617,44 @@ public:
     }
 
     JobEntry *getJobById(int jobId) {
-        for (auto &job: *this->jobs_list) {
+        for (auto &job: this->jobs_list) {
             if (job->getJobID() == jobId) {
-                return job;
+                return job.get();
             }
         }
         return nullptr;
     }
 
     void removeJobById(int jobId) {
-        if (!jobs_list) {
-            return;
-        }
-        size_t i = 0;
-        for (auto iter = this->jobs_list->begin(); iter != this->jobs_list->end(); iter++) {
+        for (auto iter = this->jobs_list.begin(); iter != this->jobs_list.end(); iter++) {
             if ((*iter)->getJobID() == jobId) {
-                jobs_list->erase(iter);
+                jobs_list.erase(iter);
                 break;
             }
-            i++;
         }
     }
     void removeJobByPID(pid_t pid) {
-        if (!jobs_list) {
-            return;
-        }
-        size_t i = 0;
-        for (auto iter = this->jobs_list->begin(); iter != this->jobs_list->end(); iter++) {
+        for (auto iter = this->jobs_list.begin(); iter != this->jobs_list.end(); iter++) {
             if ((*iter)->getJobCMD()->getCmdPID() == pid) {
-                jobs_list->erase(iter);
+                jobs_list.erase(iter);
                 break;
             }
-            i++;
         }
     }
 
     JobEntry *getLastJob(int *lastJobId) {
-        if (!jobs_list) {
-            return nullptr;
-        }
-        if (jobs_list->empty()) {
+        if (jobs_list.empty()) {
             return nullptr;
         }
-        *lastJobId = jobs_list->at(jobs_list->size() - 1)->getJobID();
-        return jobs_list->at(jobs_list->size() - 1);
+        *lastJobId = jobs_list.back()->getJobID();
+        return jobs_list.back().get();
     }
 
     JobEntry *getLastStoppedJob(int *jobId) {
-
-        if (jobs_list->empty()) {
-            return nullptr;
-        }
         JobEntry *temp = nullptr;
-        for (auto iter = this->jobs_list->begin(); *iter != nullptr && iter != this->jobs_list->end(); iter++) {
-            if ((*iter)->getStoppedStatus() == true) {
-                temp = (*iter);
+        for (auto &job: this->jobs_list) {
+            if (job->getStoppedStatus()) {
+                temp = job.get();
             }
         }
         if (temp != nullptr) {
@@ -407,8 +669,10 @@ public:
 
 class JobsCommand : public BuiltInCommand {
     JobsList *job_list;
+    // -v: the limits in effect for each job as well
+    bool verbose = false;
 public:
-    JobsCommand(const char *cmd_line, JobsList *jobs) : BuiltInCommand(cmd_line), job_list(jobs) {};
+    JobsCommand(const char *cmd_line, JobsList *jobs);
 
     virtual ~JobsCommand()=default;
     void execute() override;
@@ -416,19 +680,17 @@ public:
 
 class KillCommand : public BuiltInCommand {
     JobsList *job_list;
-    int commandID;
     int sig_num;
+    // job-id selectors: single ids and ranges as inclusive intervals, plus command line patterns
+    std::vector<std::pair<int, int>> ranges;
+    std::vector<std::regex> patterns;
+    bool single = false;
+    bool process_group = false;
+
+    bool parseSelector(const std::string &selector);
+    bool selected(JobsList::JobEntry *job) const;
 public:
-    KillCommand(const char *cmd_line, JobsList *jobs) : BuiltInCommand(cmd_line), job_list(jobs) {
-        if (num_of_args != 3 || args[1][0] != '-' || !isDigits(std::string(args[1]).substr(1)) || !isDigits(args[2]) ||
-            stoi(std::string(args[1]).substr(1)) < 1 || stoi(std::string(args[1]).substr(1)) > 63) {
-            smashError::InvalidArguments("kill");
-            this->setError();
-        } else {
-            this->commandID = std::stoi(args[2]);
-            this->sig_num = std::stoi(std::string(args[1]).substr(1));
-        }
-    }
+    KillCommand(const char *cmd_line, JobsList *jobs);
 
     virtual ~KillCommand()=default;
     void execute() override;
@@ -477,6 +739,80 @@ public:
     void execute() override;
 };
 
+class ExportCommand : public BuiltInCommand {
+public:
+    explicit ExportCommand(const char *cmd_line) : BuiltInCommand(cmd_line) {};
+
+    virtual ~ExportCommand() = default;
+
+    void execute() override;
+};
+
+// a command registered by a plugin, run in smash with the command's own descriptors
+class PluginCommand : public BuiltInCommand {
+    smash_builtin_fn fn;
+    void *data;
+public:
+    PluginCommand(const char *cmd_line, smash_builtin_fn fn, void *data) : BuiltInCommand(cmd_line), fn(fn),
+                                                                           data(data) {};
+
+    virtual ~PluginCommand() = default;
+
+    void execute() override;
+};
+
+class LoadCommand : public BuiltInCommand {
+public:
+    explicit LoadCommand(const char *cmd_line) : BuiltInCommand(cmd_line) {};
+
+    virtual ~LoadCommand() = default;
+
+    void execute() override;
+};
+
+class AliasCommand : public BuiltInCommand {
+public:
+    explicit AliasCommand(const char *cmd_line) : BuiltInCommand(cmd_line) {};
+
+    virtual ~AliasCommand() = default;
+
+    void execute() override;
+};
+
+class UnaliasCommand : public BuiltInCommand {
+public:
+    explicit UnaliasCommand(const char *cmd_line) : BuiltInCommand(cmd_line) {};
+
+    virtual ~UnaliasCommand() = default;
+
+    void execute() override;
+};
+
+class UnsetCommand : public BuiltInCommand {
+public:
+    explicit UnsetCommand(const char *cmd_line) : BuiltInCommand(cmd_line) {};
+
+    virtual ~UnsetCommand() = default;
+
+    void execute() override;
+};
+
+class BatchCommand : public BuiltInCommand {
+    std::vector<std::string> base_args;
+    size_t max_items = 0;
+    std::string exec_path;
+    int failed_runs = 0;
+
+    // false once batching should stop: the run was stopped, and is a job now, or ctrl-C was pressed
+    bool run(std::vector<std::string> &items);
+public:
+    explicit BatchCommand(const char *cmd_line);
+
+    virtual ~BatchCommand() = default;
+
+    void execute() override;
+};
+
 class TimeoutCommand : public BuiltInCommand {
     int timeout;
     time_t time_create = time(nullptr);
@@ -504,23 +840,158 @@ public:
     void execute() override;
 };
 
-class TailCommand : public BuiltInCommand {
+class WaitCommand : public BuiltInCommand {
+    JobsList *job_list;
+    std::vector<int> job_ids;
+    bool any = false;
+    // in seconds, -1 for none
+    long timeout = -1;
+
+    bool waitWithPidfds(std::vector<JobsList::JobEntry *> &targets);
+    bool waitWithSigchld(std::vector<JobsList::JobEntry *> &targets);
+    void reap(JobsList::JobEntry *job, int status);
+public:
+    WaitCommand(const char *cmd_line, JobsList *jobs);
+
+    virtual ~WaitCommand() = default;
+    void execute() override;
+};
+
+class JobTopCommand : public BuiltInCommand {
+    JobsList *job_list;
+    double interval = 1;
+    // -1 runs until ctrl-C
+    long iterations = -1;
+
+    void printFrame(bool clear);
+public:
+    JobTopCommand(const char *cmd_line, JobsList *jobs);
+
+    virtual ~JobTopCommand() = default;
+    void execute() override;
+};
+
+// limit [-j job-id] [resource value]: shows or sets the limits of new jobs, or sets one on a running job
+class LimitCommand : public BuiltInCommand {
+    JobsList *job_list;
+    int job_id = -1;
+    bool show = true;
+    LimitResource resource = LIMIT_AS;
+    rlim_t value = RLIM_INFINITY;
+public:
+    LimitCommand(const char *cmd_line, JobsList *jobs);
+
+    virtual ~LimitCommand() = default;
+    void execute() override;
+};
+
+// trace on|off|clear|dump file: records job lifecycle events and writes them out in Chrome trace format
+class TraceCommand : public BuiltInCommand {
+public:
+    explicit TraceCommand(const char *cmd_line);
+
+    virtual ~TraceCommand() = default;
+    void execute() override;
+};
+
+class TeeCommand : public BuiltInCommand {
+    std::vector<std::string> files;
+    bool append = false;
+public:
+    explicit TeeCommand(const char *cmd_line);
+
+    virtual ~TeeCommand() = default;
+    void execute() override;
+};
+
+class HistoryCommand : public BuiltInCommand {
+    History *history;
+    // lines containing it, newest first, when given with -s
+    std::string pattern;
+    bool search = false;
+    size_t count = SIZE_MAX;
+
+    // numbered from 1, oldest first
+    void printEntry(size_t position);
+public:
+    HistoryCommand(const char *cmd_line, History *history);
+
+    virtual ~HistoryCommand() = default;
+    void execute() override;
+};
+
+// the first read of each file in tail and head; a file short of lines gets a block twice as large each round
+#define LINES_FIRST_BLOCK   (16 * 1024)
+#define LINES_MAX_BLOCK     (1024 * 1024)
+// tail of a stream keeps no more than its last lines once this much is buffered
+#define LINES_STREAM_WINDOW (4 * LINES_MAX_BLOCK)
+
+/*
+ * tail and head: the last or first lines of each file, under a "==> file <==" header when there are several.
+ * The blocks of all the files are read at once through a BlockReader, round after round until every file has
+ * enough lines, so many cold files cost about as much as the slowest of them. Without files, and for pipes and
+ * devices, the input is read through to the end instead.
+ */
+class FileLinesCommand : public BuiltInCommand {
+    std::vector<std::string> files;
+    long lines = 10;
+    bool from_end;
+
+    std::string readStream(int fd, bool &failed);
+public:
+    FileLinesCommand(const char *cmd_line, bool from_end);
+
+    virtual ~FileLinesCommand() = default;
+    void execute() override;
+};
+
+class TailCommand : public FileLinesCommand {
+public:
+    explicit TailCommand(const char *cmd_line) : FileLinesCommand(cmd_line, true) {}
+
+    virtual ~TailCommand() = default;
+};
+
+class HeadCommand : public FileLinesCommand {
+public:
+    explicit HeadCommand(const char *cmd_line) : FileLinesCommand(cmd_line, false) {}
+
+    virtual ~HeadCommand() = default;
+};
+
+/*
+ * sort [-fnru] [-t char] [-k first[,last]] [-S size] [-T dir] [--parallel=threads] [file...]: the lines of the
+ * files, or of the input, through an ExternalSort, so that inputs larger than the -S memory budget spill to
+ * sorted runs in the -T directory ($TMPDIR, or /tmp) and are merged back. Lines compare as bytes.
+ */
+class SortCommand : public BuiltInCommand {
+    SortOptions options;
+    std::vector<std::string> files;
+
+    bool parseOption(int &i);
+
+    // the value of -t, -k, -S or -T
+    bool parseValue(char option, const char *value);
+public:
+    explicit SortCommand(const char *cmd_line);
+
+    virtual ~SortCommand() = default;
+    void execute() override;
+};
+
+// uniq [-cdui] [file]: adjacent equal lines once, with -c prefixed by how many there were
+class UniqCommand : public BuiltInCommand {
     std::string file;
-    int n = 10;
+    bool count = false;
+    bool only_repeated = false;
+    bool only_unique = false;
+    bool ignore_case = false;
+
+    void printGroup(LineWriter &writer, const std::string &line, long repeats) const;
 public:
-    explicit TailCommand(const char *cmd_line) : BuiltInCommand(cmd_line)
-    {
-        if (num_of_args == 2) {
-            file = args[1];
-        } else if (num_of_args == 3 && args[1][0] == '-' && isDigits(std::string(args[1]).substr(1))) {
-            file = args[2],
-                    n = stoi(std::string(args[1]).substr(1));
-        } else {
-            smashError::InvalidArguments("tail");
-            this->setError();
-        }
-    }
-    virtual ~TailCommand()=default;
+    explicit UniqCommand(const char *cmd_line);
+
+    virtual ~UniqCommand() = default;
     void execute() override;
 };
 
@@ -547,21 +1018,73 @@ public:
 };
 
 
+// creates a builtin for a command line starting with its name
+using CommandFactory = std::function<std::unique_ptr<Command>(const char *cmd_line)>;
+
 class SmallShell {
 private:
+    // everything a command name can stand for; an alias is expanded first, then a function wins over a builtin
+    struct DispatchEntry {
+        CommandFactory builtin;
+        // the builtin only touches its own descriptors and files, so it may run on a worker thread
+        bool runs_on_worker = false;
+        std::string alias;
+        std::string function;
+        bool is_alias = false;
+        bool is_function = false;
+    };
+
+    struct TimeoutEntry {
+        pid_t pid;
+        std::string cmd_line;
+        int timeout;
+        time_t time_create;
+    };
+
     std::string chprompt;
-    char *plastPwd;
+    std::string plastPwd;
+    Environment env;
+    Glob glob;
     JobsList job_list;
+    // what the limit builtin set for commands started from now on
+    ResourceLimits job_limits;
+    ProcSampler proc_sampler;
+    History history;
+    PluginList plugins;
+    // not owned: either the command being waited for in executeCommand or a job's command brought to fg
     Command *fg_command;
     bool shellActive;
     std::string cmdLine;
-    std::vector<TimeoutCommand*>* timeout_list;
+    std::vector<TimeoutEntry> timeout_list;
+    bool subshell;
+    // set by ctrl-C so that builtins blocking inside smash itself can give up
+    volatile sig_atomic_t interrupted = 0;
     pid_t timeout_pid;
     std::string timeout_cmd_line;
+    std::unordered_map<std::string, DispatchEntry> dispatch;
+    // bumped whenever a name is added or removed, so that completion knows to rebuild
+    unsigned dispatch_generation = 0;
+    int function_depth = 0;
+    // the job addJobShell() added last, until takeAddedJob()
+    int added_job_id = 0;
     SmallShell();
 
+    void registerBuiltins();
+
+    // replaces a leading alias (repeatedly, but never the same alias twice)
+    std::string expandAliases(const std::string &cmd_line) const;
+
+    // the builtin a simple command line names, or nullptr for anything else
+    const DispatchEntry *simpleBuiltin(const std::string &cmd_line) const;
+
+    // stores `function name { ... }` or `name() { ... }`; returns false if the line is not a definition
+    bool defineFunction(const std::string &cmd_line);
+
+    // waits for a command started in the foreground; one that stops becomes a stopped job
+    void waitForeground(std::unique_ptr<Command> cmd);
+
 public:
-    Command *CreateCommand(const char *cmd_line);
+    std::unique_ptr<Command> CreateCommand(const char *cmd_line);
 
     SmallShell(SmallShell const &) = delete; // disable copy ctor
     void operator=(SmallShell const &) = delete; // disable = operator
@@ -574,7 +1097,7 @@ public:
 
     ~SmallShell();
 
-    void executeCommand(const char *cmd_line);
+    void executeCommand(const char *cmd_line, bool expand = true);
 
     void setChprompt() {
         this->chprompt = "smash> ";
@@ -588,8 +1111,89 @@ public:
         return this->chprompt;
     }
 
-    void addJobShell(Command *cmd, bool isStopped = false) {
-        job_list.addJob(cmd, isStopped);
+    Environment &getEnvironment() {
+        return this->env;
+    }
+
+    Glob &getGlob() {
+        return this->glob;
+    }
+
+    JobsList &getJobsList() {
+        return this->job_list;
+    }
+
+    ResourceLimits &getJobLimits() {
+        return this->job_limits;
+    }
+
+    ProcSampler &getProcSampler() {
+        return this->proc_sampler;
+    }
+
+    History &getHistory() {
+        return this->history;
+    }
+
+    PluginList &getPlugins() {
+        return this->plugins;
+    }
+
+    void registerBuiltin(const std::string &name, CommandFactory factory, bool runs_on_worker = false);
+
+    // whether cmd_line is a simple command naming a builtin that may run on a worker thread
+    bool runsOnWorker(const std::string &cmd_line) const;
+
+    // whether cmd_line, aliases expanded, names a builtin that runs in the shell itself even with '&'
+    bool runsInShell(const std::string &cmd_line) const;
+
+    // a pipeline stage that runs on a reserved worker instead of a forked shell, or nullptr if cmd_line
+    // can not or no worker is free
+    std::unique_ptr<WorkerCommand> createWorkerStage(const std::string &cmd_line);
+
+    void setAlias(const std::string &name, const std::string &value);
+
+    // returns false if there was no such alias
+    bool removeAlias(const std::string &name);
+
+    // returns false if there was no such function
+    bool removeFunction(const std::string &name);
+
+    // name and value of every alias, sorted by name
+    std::vector<std::pair<std::string, std::string>> getAliases() const;
+
+    // builtins, aliases and functions, for completion
+    std::vector<std::string> commandNames() const;
+
+    unsigned getDispatchGeneration() const {
+        return this->dispatch_generation;
+    }
+
+    // returns false when the maximum depth was reached
+    bool enterFunction() {
+        if (this->function_depth >= FUNCTION_MAX_DEPTH) {
+            return false;
+        }
+        this->function_depth++;
+        return true;
+    }
+
+    void leaveFunction() {
+        this->function_depth--;
+    }
+
+    JobsList::JobEntry *addJobShell(std::unique_ptr<Command> cmd, bool isStopped = false) {
+        JobsList::JobEntry *job = job_list.addJob(std::move(cmd), isStopped);
+        this->added_job_id = job->getJobID();
+        return job;
+    }
+
+    // the id of the job added since the last call, or 0; tells a caller of executeCommand() which job, if
+    // any, its line became
+    int takeAddedJob() {
+        int job_id = this->added_job_id;
+        this->added_job_id = 0;
+        return job_id;
     }
 
 
@@ -609,19 +1213,51 @@ public:
         return this->shellActive;
     }
 
-    char *getPlastPwd() {
+    int getLastStatus() const {
+        return this->env.getLastStatus();
+    }
+
+    void setLastStatus(int status) {
+        this->env.setLastStatus(status);
+    }
+
+    void interrupt() {
+        this->interrupted = 1;
+    }
+
+    bool interruptPending() const {
+        return this->interrupted != 0;
+    }
+
+    bool consumeInterrupt() {
+        bool was_interrupted = this->interrupted != 0;
+        this->interrupted = 0;
+        return was_interrupted;
+    }
+
+    // a forked copy of smash running a background job keeps its children in the job's process group
+    void enterSubshell() {
+        this->subshell = true;
+    }
+
+    bool inSubshell() const {
+        return this->subshell;
+    }
+
+    const std::string &getPlastPwd() const {
         return this->plastPwd;
     }
 
-    void setPlastPwd(char *plast_pwd) {
-        strcpy(this->plastPwd,plast_pwd);
+    void setPlastPwd(const std::string &plast_pwd) {
+        this->plastPwd = plast_pwd;
     }
 
     void removeJobByPID(pid_t pid){
         this->job_list.removeJobByPID(pid);
     }
     void addTimeoutCMD(TimeoutCommand* timout_cmd){
-        this->timeout_list->push_back(timout_cmd);
+        this->timeout_list.push_back({timout_cmd->getCmdPID(), timout_cmd->getCmdLine(), timout_cmd->getTimeOut(),
+                                      timout_cmd->getTimeCreate()});
         this->timeoutAlarm();
     }
     pid_t getTimeoutPid() const{
@@ -631,10 +1267,10 @@ public:
         return this->timeout_cmd_line;
     }
     void timeoutRemoveByPID(pid_t pid){
-        for(auto iter = this->timeout_list->begin() ; iter != timeout_list->end() ; iter++)
+        for(auto iter = this->timeout_list.begin() ; iter != timeout_list.end() ; iter++)
         {
-            if ((*iter)->getCmdPID() == pid){
-                this->timeout_list->erase(iter);
+            if (iter->pid == pid){
+                this->timeout_list.erase(iter);
                 break;
             }
         }
@@ -642,22 +1278,22 @@ public:
     }
     void timeoutAlarm()
     {
-        if (this->timeout_list == nullptr || timeout_list->empty()) {
+        if (timeout_list.empty()) {
             return;
         }
-        auto iter = this->timeout_list->begin();
-        TimeoutCommand* to_alart = *iter;
-        while (iter != this->timeout_list->end()) {
-            int min_time = to_alart->getTimeOut() - difftime(time(nullptr), to_alart->getTimeCreate());
-            int iter_time = (*iter)->getTimeOut() - difftime(time(nullptr), (*iter)->getTimeCreate());
+        auto iter = this->timeout_list.begin();
+        TimeoutEntry* to_alart = &*iter;
+        while (iter != this->timeout_list.end()) {
+            int min_time = to_alart->timeout - difftime(time(nullptr), to_alart->time_create);
+            int iter_time = iter->timeout - difftime(time(nullptr), iter->time_create);
             if(iter_time < min_time && iter_time >= 0) {
-                to_alart = *iter;
+                to_alart = &*iter;
             }
             iter++;
         }
-        alarm(to_alart->getTimeOut() - difftime(time(nullptr), to_alart->getTimeCreate()));
-        this->timeout_pid = to_alart->getCmdPID();
-        this->timeout_cmd_line = to_alart->getCmdLine();
+        alarm(to_alart->timeout - difftime(time(nullptr), to_alart->time_create));
+        this->timeout_pid = to_alart->pid;
+        this->timeout_cmd_line = to_alart->cmd_line;
     }
 };
 
@@ -671,7 +1307,7 @@ inline std::ostream &operator<<(std::ostream &os, const JobsList::JobEntry &jobE
     if (jobEntry.stopped) {
         os << " (stopped)";
     }
-    os << std::endl;
+    os << '\n';
     return os;
 }
 
@@ -0,0 +1,270 @@
+#include "ControlSocket.h"
+#include "Commands.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <cerrno>
+
+using namespace std;
+
+ControlServer::~ControlServer() {
+    for (auto &client: this->clients) {
+        close(client.fd);
+    }
+    if (this->listen_fd != -1) {
+        close(this->listen_fd);
+        unlink(this->path.c_str());
+    }
+}
+
+bool ControlServer::listen(const std::string &socket_path) {
+    sockaddr_un addr{};
+    if (socket_path.size() >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        smashError::SyscallFailed("bind");
+        return false;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        smashError::SyscallFailed("socket");
+        return false;
+    }
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path.c_str());
+    unlink(socket_path.c_str());
+    if (bind(fd, (sockaddr *) &addr, sizeof(addr)) == -1) {
+        smashError::SyscallFailed("bind");
+        close(fd);
+        return false;
+    }
+    if (::listen(fd, CONTROL_BACKLOG) == -1) {
+        smashError::SyscallFailed("listen");
+        close(fd);
+        unlink(socket_path.c_str());
+        return false;
+    }
+    this->listen_fd = fd;
+    this->path = socket_path;
+    return true;
+}
+
+void ControlServer::acceptClients() {
+    while (true) {
+        int fd = accept4(this->listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                smashError::SyscallFailed("accept");
+            }
+            return;
+        }
+        if (this->clients.size() >= CONTROL_MAX_CLIENTS) {
+            close(fd);
+            continue;
+        }
+        this->clients.push_back({fd, "", ""});
+    }
+}
+
+bool ControlServer::flushClient(Client &client) {
+    while (!client.out.empty()) {
+        ssize_t res = send(client.fd, client.out.data(), client.out.size(), MSG_NOSIGNAL);
+        if (res == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        client.out.erase(0, res);
+    }
+    return true;
+}
+
+// returns false once the client should be dropped
+bool ControlServer::readClient(Client &client) {
+    char buffer[BUFSIZ];
+    bool eof = false;
+    // the rest stays in the socket until these requests are answered
+    while (client.in.size() <= CONTROL_MAX_LINE) {
+        ssize_t res = recv(client.fd, buffer, sizeof buffer, 0);
+        if (res == 0) {
+            eof = true;
+            break;
+        }
+        if (res == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                return false;
+            }
+            break;
+        }
+        client.in.append(buffer, res);
+    }
+    if (client.in.size() > CONTROL_MAX_LINE && client.in.find('\n') == string::npos) {
+        return false;
+    }
+    serveRequests(client);
+    // after the peer shut down its side, stay around only until every request is answered and sent
+    bool flushed = flushClient(client);
+    return flushed && (!eof || !client.out.empty() || client.in.find('\n') != string::npos);
+}
+
+// answers the complete requests received, but only while the client keeps up with reading the replies
+void ControlServer::serveRequests(Client &client) {
+    size_t newline;
+    while (client.out.size() < CONTROL_MAX_PENDING && (newline = client.in.find('\n')) != string::npos) {
+        string request = client.in.substr(0, newline);
+        client.in.erase(0, newline + 1);
+        if (!request.empty() && request.back() == '\r') {
+            request.pop_back();
+        }
+        client.out += handleRequest(request);
+    }
+}
+
+static JobsList::JobEntry *_controlJob(JobsList &jobs, const std::string &id, std::string &error) {
+    if (!isDigits(id) || id.empty()) {
+        error = "error invalid job-id\n";
+        return nullptr;
+    }
+    JobsList::JobEntry *job = jobs.getJobById(atoi(id.c_str()));
+    if (job == nullptr) {
+        error = "error job-id " + id + " does not exist\n";
+    }
+    return job;
+}
+
+std::string ControlServer::handleRequest(const std::string &request) {
+    SmallShell &smash = SmallShell::getInstance();
+    JobsList &jobs = smash.getJobsList();
+    std::istringstream iss(request);
+    string verb;
+    iss >> verb;
+    if (verb == "ping") {
+        return "pong\n";
+    }
+    if (verb == "run") {
+        string cmd_line;
+        getline(iss, cmd_line);
+        size_t start = cmd_line.find_first_not_of(" \t");
+        if (start == string::npos) {
+            return "error empty command\n";
+        }
+        cmd_line = cmd_line.substr(start);
+        if (cmd_line.find_last_not_of(" \t") != string::npos &&
+            cmd_line[cmd_line.find_last_not_of(" \t")] != '&') {
+            cmd_line += " &";
+        }
+        // only what becomes a job: the rest would change the shell itself (cd, quit, fg, limit, ...)
+        if (smash.runsInShell(cmd_line)) {
+            return "error runs inside smash\n";
+        }
+        smash.takeAddedJob();
+        smash.executeCommand(cmd_line.c_str());
+        int job_id = smash.takeAddedJob();
+        JobsList::JobEntry *job = job_id > 0 ? jobs.getJobById(job_id) : nullptr;
+        if (job == nullptr) {
+            return "ok\n";
+        }
+        return "ok " + to_string(job->getJobID()) + " " + to_string(job->getJobCMD()->getCmdPID()) + "\n";
+    }
+    if (verb == "jobs") {
+        jobs.removeFinishedJobs();
+        string reply;
+        for (auto &job: jobs.jobs_list) {
+            reply += "job " + to_string(job->getJobID()) + " " + to_string(job->getJobCMD()->getCmdPID());
+            reply += job->getStoppedStatus() ? " stopped " : " running ";
+            reply += to_string((long) difftime(time(nullptr), job->getTimeInserted())) + " ";
+            reply += job->getJobCMD()->getCmdLine();
+            reply += "\n";
+        }
+        return reply + "end\n";
+    }
+    if (verb == "kill" || verb == "bg") {
+        string first, second, error;
+        iss >> first >> second;
+        int sig_num = SIGCONT;
+        string id = first;
+        if (verb == "kill") {
+            if (!isDigits(first) || first.empty() || atoi(first.c_str()) < 1 || atoi(first.c_str()) > 63) {
+                return "error invalid signal\n";
+            }
+            sig_num = atoi(first.c_str());
+            id = second;
+        }
+        JobsList::JobEntry *job = _controlJob(jobs, id, error);
+        if (job == nullptr) {
+            return error;
+        }
+        if (verb == "bg" && !job->getStoppedStatus()) {
+            return "error job-id " + id + " is already running in the background\n";
+        }
+        if (job->getJobCMD()->sendSignal(sig_num) != SUCCESS) {
+            return "error kill failed: " + string(strerror(errno)) + "\n";
+        }
+        if (sig_num == SIGSTOP) {
+            job->setStoppedStatus(true);
+        } else if (sig_num == SIGCONT) {
+            job->setStoppedStatus(false);
+        }
+        return "ok\n";
+    }
+    return "error unknown request\n";
+}
+
+bool ControlServer::waitForInput(int fd) {
+    while (true) {
+        vector<pollfd> fds;
+        fds.push_back({fd, POLLIN, 0});
+        fds.push_back({this->listen_fd, POLLIN, 0});
+        for (auto &client: this->clients) {
+            // a client whose replies are backed up is not read from until it catches up
+            short events = client.out.size() < CONTROL_MAX_PENDING ? POLLIN : 0;
+            fds.push_back({client.fd, (short) (events | (client.out.empty() ? 0 : POLLOUT)), 0});
+        }
+        if (poll(fds.data(), fds.size(), -1) == -1) {
+            // ctrl-C at the prompt: let the caller drop the line it is reading
+            if (errno == EINTR && SmallShell::getInstance().interruptPending()) {
+                return true;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            smashError::SyscallFailed("poll");
+            return false;
+        }
+        if (fds[1].revents & POLLIN) {
+            acceptClients();
+        }
+        // clients accepted above are polled on the next round
+        size_t polled = fds.size() - 2;
+        vector<Client> alive;
+        for (size_t i = 0; i < this->clients.size(); i++) {
+            Client &client = this->clients[i];
+            bool keep = true;
+            if (i < polled) {
+                short revents = fds[i + 2].revents;
+                if (revents & (POLLIN | POLLHUP | POLLERR)) {
+                    keep = readClient(client);
+                } else if (revents & POLLOUT) {
+                    keep = flushClient(client);
+                    if (keep && client.out.size() < CONTROL_MAX_PENDING) {
+                        // requests held back while the replies were backed up
+                        serveRequests(client);
+                        keep = flushClient(client);
+                    }
+                }
+            }
+            if (keep) {
+                alive.push_back(std::move(client));
+            } else {
+                close(client.fd);
+            }
+        }
+        this->clients.swap(alive);
+        if (fds[0].revents != 0) {
+            return true;
+        }
+    }
+}
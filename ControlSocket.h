@@ -0,0 +1,64 @@
+#ifndef SMASH_CONTROL_SOCKET_H_
+#define SMASH_CONTROL_SOCKET_H_
+
+#include <string>
+#include <vector>
+#include <poll.h>
+
+#define CONTROL_MAX_CLIENTS     (128)
+#define CONTROL_MAX_LINE        (64 * 1024)
+#define CONTROL_BACKLOG         (64)
+// replies held for a client that does not read them; past this its further requests wait
+#define CONTROL_MAX_PENDING     (4 * CONTROL_MAX_LINE)
+
+/*
+ * Line based control protocol served from the shell's input loop:
+ *   run <command line>    submit a command as a background job -> "ok <job-id> <pid>", or "ok" if it ended
+ *                         at once; builtins that run inside the shell (cd, quit, fg, ...) are refused
+ *   jobs                  one "job <id> <pid> <running|stopped> <secs> <command>" line per job, then "end"
+ *   kill <signum> <id>    send a signal to a job -> "ok"
+ *   bg <id>               resume a stopped job in the background -> "ok"
+ *   ping                  -> "pong"
+ * Failures are answered with "error <message>".
+ */
+class ControlServer {
+    struct Client {
+        int fd;
+        std::string in;
+        std::string out;
+    };
+
+    std::string path;
+    int listen_fd = -1;
+    std::vector<Client> clients;
+
+    void acceptClients();
+
+    bool readClient(Client &client);
+
+    bool flushClient(Client &client);
+
+    void serveRequests(Client &client);
+
+    std::string handleRequest(const std::string &request);
+
+public:
+    ControlServer() = default;
+
+    ~ControlServer();
+
+    ControlServer(ControlServer const &) = delete;
+
+    void operator=(ControlServer const &) = delete;
+
+    bool listen(const std::string &socket_path);
+
+    bool isListening() const {
+        return this->listen_fd != -1;
+    }
+
+    // serves control requests until fd becomes readable or ctrl-C is pressed, returns false if polling failed
+    bool waitForInput(int fd);
+};
+
+#endif //SMASH_CONTROL_SOCKET_H_
@@ -0,0 +1,265 @@
+#include "Environment.h"
+
+#include <iostream>
+#include <unistd.h>
+#include <cstring>
+
+extern char **environ;
+
+using namespace std;
+
+Environment::Environment() {
+    for (char **env = environ; env != nullptr && *env != nullptr; env++) {
+        const char *eq = strchr(*env, '=');
+        if (eq == nullptr) {
+            continue;
+        }
+        this->vars[string(*env, eq - *env)] = {string(eq + 1), true};
+    }
+}
+
+void Environment::invalidate(const std::string &name) {
+    this->envp_dirty = true;
+    if (name == "PATH") {
+        this->path_cache.clear();
+    }
+}
+
+bool Environment::isValidName(const std::string &name) {
+    if (name.empty() || isdigit(name[0])) {
+        return false;
+    }
+    for (char c: name) {
+        if (!isalnum(c) && c != '_') {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Environment::isSet(const std::string &name) const {
+    return this->vars.find(name) != this->vars.end();
+}
+
+std::string Environment::get(const std::string &name) const {
+    auto iter = this->vars.find(name);
+    if (iter == this->vars.end()) {
+        return "";
+    }
+    return iter->second.value;
+}
+
+void Environment::set(const std::string &name, const std::string &value) {
+    auto iter = this->vars.find(name);
+    if (iter == this->vars.end()) {
+        this->vars[name] = {value, false};
+        return;
+    }
+    iter->second.value = value;
+    if (iter->second.exported) {
+        invalidate(name);
+    }
+}
+
+void Environment::exportVar(const std::string &name) {
+    Variable &var = this->vars[name];
+    if (!var.exported) {
+        var.exported = true;
+        invalidate(name);
+    }
+}
+
+void Environment::exportVar(const std::string &name, const std::string &value) {
+    this->vars[name] = {value, true};
+    invalidate(name);
+}
+
+void Environment::unset(const std::string &name) {
+    auto iter = this->vars.find(name);
+    if (iter == this->vars.end()) {
+        return;
+    }
+    if (iter->second.exported) {
+        invalidate(name);
+    }
+    this->vars.erase(iter);
+}
+
+void Environment::printExported(std::ostream &os) const {
+    for (auto &var: this->vars) {
+        if (var.second.exported) {
+            os << "export " << var.first << "=" << var.second.value << '\n';
+        }
+    }
+}
+
+char *const *Environment::getEnvp() {
+    if (!this->envp_dirty) {
+        return this->envp_cache.data();
+    }
+    this->envp_storage.clear();
+    this->envp_cache.clear();
+    for (auto &var: this->vars) {
+        if (var.second.exported) {
+            this->envp_storage.push_back(var.first + "=" + var.second.value);
+        }
+    }
+    for (auto &entry: this->envp_storage) {
+        this->envp_cache.push_back(&entry[0]);
+    }
+    this->envp_cache.push_back(nullptr);
+    this->envp_dirty = false;
+    return this->envp_cache.data();
+}
+
+std::string Environment::positionalParam(size_t number) const {
+    if (number == 0) {
+        return "smash";
+    }
+    return number <= this->positional.size() ? this->positional[number - 1] : "";
+}
+
+// a value as a literal part of a word, so that the shell's own parsers and bash never read it as syntax:
+// single quoted (its own single quotes as "'"), or inside double quotes with \ " $ ` escaped
+static string _quoted(const string &value, bool in_double) {
+    string quoted;
+    if (in_double) {
+        for (char c: value) {
+            if (strchr("\\\"$`", c) != nullptr) {
+                quoted += '\\';
+            }
+            quoted += c;
+        }
+        return quoted;
+    }
+    quoted = "'";
+    for (char c: value) {
+        quoted += c == '\'' ? "'\"'\"'" : string(1, c);
+    }
+    return quoted + "'";
+}
+
+// outside double quotes a value is split into fields, as bash does, and each is quoted on its own
+static string _substitute(const string &value, bool in_double) {
+    if (in_double) {
+        return _quoted(value, true);
+    }
+    string result;
+    size_t start = value.find_first_not_of(" \t\n");
+    while (start != string::npos) {
+        size_t end = value.find_first_of(" \t\n", start);
+        result += (result.empty() ? "" : " ") + _quoted(value.substr(start, end - start), false);
+        start = end == string::npos ? end : value.find_first_not_of(" \t\n", end);
+    }
+    return result;
+}
+
+std::string Environment::expand(const std::string &line) const {
+    if (line.find('$') == string::npos) {
+        return line;
+    }
+    string result;
+    result.reserve(line.size());
+    bool in_single = false;
+    bool in_double = false;
+    for (size_t i = 0; i < line.size(); i++) {
+        char c = line[i];
+        if (c == '\\' && !in_single && i + 1 < line.size()) {
+            result += c;
+            result += line[++i];
+            continue;
+        }
+        if (c == '\'' && !in_double) {
+            in_single = !in_single;
+        } else if (c == '"' && !in_single) {
+            in_double = !in_double;
+        }
+        if (c != '$' || in_single || i + 1 >= line.size()) {
+            result += c;
+            continue;
+        }
+        char next = line[i + 1];
+        if (next == '$') {
+            result += std::to_string(getpid());
+            i++;
+        } else if (next == '?') {
+            result += std::to_string(this->last_status);
+            i++;
+        } else if (next == '#') {
+            result += std::to_string(this->positional.size());
+            i++;
+        } else if (next == '@' || next == '*') {
+            string params;
+            for (size_t param = 0; param < this->positional.size(); param++) {
+                params += (param > 0 ? " " : "") + this->positional[param];
+            }
+            result += _substitute(params, in_double);
+            i++;
+        } else if (isdigit(next)) {
+            result += _substitute(positionalParam(next - '0'), in_double);
+            i++;
+        } else if (next == '{') {
+            size_t close = line.find('}', i + 2);
+            string name = close == string::npos ? "" : line.substr(i + 2, close - i - 2);
+            if (!name.empty() && name.size() < 10 && name.find_first_not_of("0123456789") == string::npos) {
+                result += _substitute(positionalParam(stoul(name)), in_double);
+                i = close;
+                continue;
+            }
+            if (!isValidName(name)) {
+                result += c;
+                continue;
+            }
+            result += _substitute(get(name), in_double);
+            i = close;
+        } else if (isalpha(next) || next == '_') {
+            size_t end = i + 1;
+            while (end < line.size() && (isalnum(line[end]) || line[end] == '_')) {
+                end++;
+            }
+            result += _substitute(get(line.substr(i + 1, end - i - 1)), in_double);
+            i = end - 1;
+        } else {
+            result += c;
+        }
+    }
+    return result;
+}
+
+std::vector<std::string> Environment::getPathDirs() const {
+    vector<string> dirs;
+    string path = get("PATH");
+    size_t start = 0;
+    while (start <= path.size()) {
+        size_t end = path.find(':', start);
+        if (end == string::npos) {
+            end = path.size();
+        }
+        // an empty PATH entry means the current directory
+        dirs.push_back(end > start ? path.substr(start, end - start) : ".");
+        start = end + 1;
+    }
+    return dirs;
+}
+
+std::string Environment::findExecutable(const std::string &cmd) {
+    if (cmd.find('/') != string::npos) {
+        return access(cmd.c_str(), X_OK) == 0 ? cmd : "";
+    }
+    auto cached = this->path_cache.find(cmd);
+    if (cached != this->path_cache.end()) {
+        return cached->second;
+    }
+    string found;
+    for (auto &dir: getPathDirs()) {
+        string candidate = dir + "/" + cmd;
+        if (access(candidate.c_str(), X_OK) == 0) {
+            found = candidate;
+            break;
+        }
+    }
+    if (!found.empty()) {
+        this->path_cache[cmd] = found;
+    }
+    return found;
+}
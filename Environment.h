@@ -0,0 +1,77 @@
+#ifndef SMASH_ENVIRONMENT_H_
+#define SMASH_ENVIRONMENT_H_
+
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+
+class Environment {
+    struct Variable {
+        std::string value;
+        bool exported;
+    };
+
+    std::map<std::string, Variable> vars;
+    // envp handed to children, rebuilt only after an exported variable changed
+    std::vector<std::string> envp_storage;
+    std::vector<char *> envp_cache;
+    bool envp_dirty = true;
+    int last_status = 0;
+    // $1, $2, ... of the shell function being run, empty outside functions
+    std::vector<std::string> positional;
+    // PATH lookups, dropped whenever PATH itself changes
+    std::unordered_map<std::string, std::string> path_cache;
+
+    void invalidate(const std::string &name);
+
+    // $0 is always "smash"
+    std::string positionalParam(size_t number) const;
+
+public:
+    Environment();
+
+    ~Environment() = default;
+
+    static bool isValidName(const std::string &name);
+
+    bool isSet(const std::string &name) const;
+
+    std::string get(const std::string &name) const;
+
+    void set(const std::string &name, const std::string &value);
+
+    void exportVar(const std::string &name);
+
+    void exportVar(const std::string &name, const std::string &value);
+
+    void unset(const std::string &name);
+
+    void printExported(std::ostream &os) const;
+
+    void setLastStatus(int status) {
+        this->last_status = status;
+    }
+
+    int getLastStatus() const {
+        return this->last_status;
+    }
+
+    // returns the parameters that were in effect, for the caller to restore
+    std::vector<std::string> setPositional(std::vector<std::string> params) {
+        this->positional.swap(params);
+        return params;
+    }
+
+    char *const *getEnvp();
+
+    // substitutes variables and parameters; their values come quoted, so that whatever they contain ends up as
+    // words of the command rather than as operators, redirections or substitutions parsed again
+    std::string expand(const std::string &line) const;
+
+    std::vector<std::string> getPathDirs() const;
+
+    std::string findExecutable(const std::string &cmd);
+};
+
+#endif //SMASH_ENVIRONMENT_H_
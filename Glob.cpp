@@ -0,0 +1,295 @@
+#include "Glob.h"
+
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <dirent.h>
+#include <cstring>
+
+#define GLOB_MAX_DEPTH  (64)
+
+using namespace std;
+
+struct linux_dirent64 {
+    ino64_t d_ino;
+    off64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+static bool _sameTime(const timespec &a, const timespec &b) {
+    return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
+
+static bool _earlierThan(const timespec &a, const timespec &b) {
+    return a.tv_sec < b.tv_sec || (a.tv_sec == b.tv_sec && a.tv_nsec < b.tv_nsec);
+}
+
+bool DirectoryCache::readDirectory(int dir_fd, std::vector<Entry> &entries) {
+    char *buffer = new char[GETDENTS_BUFFER_SIZE];
+    bool ok = true;
+    while (true) {
+        long res = syscall(SYS_getdents64, dir_fd, buffer, GETDENTS_BUFFER_SIZE);
+        if (res == -1) {
+            ok = false;
+            break;
+        }
+        if (res == 0) {
+            break;
+        }
+        for (long pos = 0; pos < res;) {
+            auto *dirent = (linux_dirent64 *) (buffer + pos);
+            pos += dirent->d_reclen;
+            if (strcmp(dirent->d_name, ".") == 0 || strcmp(dirent->d_name, "..") == 0) {
+                continue;
+            }
+            bool is_dir = dirent->d_type == DT_DIR;
+            bool is_link = dirent->d_type == DT_LNK;
+            if (dirent->d_type == DT_UNKNOWN || is_link) {
+                struct stat st{};
+                is_dir = fstatat(dir_fd, dirent->d_name, &st, 0) == 0 && S_ISDIR(st.st_mode);
+            }
+            entries.push_back({dirent->d_name, is_dir, is_link});
+        }
+    }
+    delete[] buffer;
+    return ok;
+}
+
+const std::vector<DirectoryCache::Entry> *DirectoryCache::list(const std::string &dir) {
+    int dir_fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd == -1) {
+        this->listings.erase(dir);
+        return nullptr;
+    }
+    struct stat st{};
+    if (fstat(dir_fd, &st) == -1) {
+        close(dir_fd);
+        return nullptr;
+    }
+    timespec now{};
+    clock_gettime(CLOCK_REALTIME, &now);
+    auto iter = this->listings.find(dir);
+    if (iter != this->listings.end()) {
+        Listing &cached = iter->second;
+        // a listing read in the same clock tick as the last change may have missed part of it
+        if (cached.dev == st.st_dev && cached.ino == st.st_ino && _sameTime(cached.mtime, st.st_mtim) &&
+            _earlierThan(cached.mtime, cached.loaded) && now.tv_sec - cached.loaded.tv_sec < GLOB_CACHE_TTL_SECS) {
+            close(dir_fd);
+            return &cached.entries;
+        }
+        this->listings.erase(iter);
+    }
+    if (this->listings.size() >= GLOB_CACHE_MAX_DIRS) {
+        this->listings.clear();
+    }
+    Listing listing{st.st_dev, st.st_ino, st.st_mtim, now, {}};
+    if (!readDirectory(dir_fd, listing.entries)) {
+        close(dir_fd);
+        return nullptr;
+    }
+    close(dir_fd);
+    std::sort(listing.entries.begin(), listing.entries.end(), [](const Entry &a, const Entry &b) {
+        return a.name < b.name;
+    });
+    return &(this->listings[dir] = std::move(listing)).entries;
+}
+
+// parses the bracket expression starting at pattern[0] == '[', returns its length or 0 if it is not one
+static size_t _bracketLength(const char *pattern) {
+    size_t i = 1;
+    if (pattern[i] == '!' || pattern[i] == '^') {
+        i++;
+    }
+    if (pattern[i] == ']') {
+        i++;
+    }
+    while (pattern[i] != '\0' && pattern[i] != ']') {
+        i++;
+    }
+    return pattern[i] == ']' ? i + 1 : 0;
+}
+
+static bool _bracketMatch(const char *pattern, size_t len, char c) {
+    size_t i = 1;
+    bool negate = false;
+    if (pattern[i] == '!' || pattern[i] == '^') {
+        negate = true;
+        i++;
+    }
+    bool found = false;
+    size_t end = len - 1;
+    while (i < end) {
+        if (i + 2 < end && pattern[i + 1] == '-') {
+            if (pattern[i] <= c && c <= pattern[i + 2]) {
+                found = true;
+            }
+            i += 3;
+        } else {
+            if (pattern[i] == c) {
+                found = true;
+            }
+            i++;
+        }
+    }
+    return found != negate;
+}
+
+bool Glob::hasMagic(const std::string &word) {
+    for (size_t i = 0; i < word.size(); i++) {
+        if (word[i] == '*' || word[i] == '?') {
+            return true;
+        }
+        if (word[i] == '[' && _bracketLength(word.c_str() + i) > 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Linear matcher: on mismatch only the position after the last '*' is retried,
+// so a pattern never causes exponential backtracking.
+bool Glob::match(const char *pattern, const char *name) {
+    if (name[0] == '.' && pattern[0] != '.') {
+        return false;
+    }
+    const char *star_pattern = nullptr;
+    const char *star_name = nullptr;
+    while (*name != '\0') {
+        if (*pattern == '*') {
+            star_pattern = ++pattern;
+            star_name = name;
+            continue;
+        }
+        size_t bracket = *pattern == '[' ? _bracketLength(pattern) : 0;
+        if (bracket > 0 && _bracketMatch(pattern, bracket, *name)) {
+            pattern += bracket;
+            name++;
+            continue;
+        }
+        if (bracket == 0 && *pattern != '\0' && (*pattern == '?' || *pattern == *name)) {
+            pattern++;
+            name++;
+            continue;
+        }
+        if (star_pattern == nullptr) {
+            return false;
+        }
+        pattern = star_pattern;
+        name = ++star_name;
+    }
+    while (*pattern == '*') {
+        pattern++;
+    }
+    return *pattern == '\0';
+}
+
+static std::string _joinPath(const std::string &base, const std::string &name) {
+    if (base.empty()) {
+        return name;
+    }
+    if (base.back() == '/') {
+        return base + name;
+    }
+    return base + "/" + name;
+}
+
+void Glob::expandRecursive(const std::string &base, const std::vector<std::string> &components, size_t index,
+                           std::vector<std::string> &results, int depth) {
+    // "**" matches zero directories here, then every directory below base
+    expandComponents(base, components, index + 1, results);
+    if (depth >= GLOB_MAX_DEPTH) {
+        return;
+    }
+    const vector<DirectoryCache::Entry> *entries = this->cache.list(base.empty() ? "." : base);
+    if (entries == nullptr) {
+        return;
+    }
+    vector<string> subdirs;
+    for (auto &entry: *entries) {
+        if (entry.name[0] == '.') {
+            continue;
+        }
+        if (entry.is_dir && !entry.is_link) {
+            subdirs.push_back(_joinPath(base, entry.name));
+        } else if (index + 1 == components.size()) {
+            results.push_back(_joinPath(base, entry.name));
+        }
+    }
+    for (auto &subdir: subdirs) {
+        expandRecursive(subdir, components, index, results, depth + 1);
+    }
+}
+
+void Glob::expandComponents(const std::string &base, const std::vector<std::string> &components, size_t index,
+                            std::vector<std::string> &results) {
+    if (index == components.size()) {
+        if (!base.empty()) {
+            results.push_back(base);
+        }
+        return;
+    }
+    const string &component = components[index];
+    bool last = index + 1 == components.size();
+    if (component == "**") {
+        expandRecursive(base, components, index, results, 0);
+        return;
+    }
+    if (!hasMagic(component)) {
+        string path = _joinPath(base, component);
+        if (last) {
+            if (access(path.c_str(), F_OK) == 0) {
+                results.push_back(path);
+            }
+        } else {
+            expandComponents(path, components, index + 1, results);
+        }
+        return;
+    }
+    const vector<DirectoryCache::Entry> *entries = this->cache.list(base.empty() ? "." : base);
+    if (entries == nullptr) {
+        return;
+    }
+    vector<string> matches;
+    for (auto &entry: *entries) {
+        if ((last || entry.is_dir) && match(component.c_str(), entry.name.c_str())) {
+            matches.push_back(_joinPath(base, entry.name));
+        }
+    }
+    for (auto &path: matches) {
+        expandComponents(path, components, index + 1, results);
+    }
+}
+
+std::vector<std::string> Glob::expand(const std::string &pattern) {
+    vector<string> components;
+    size_t start = 0;
+    while (start <= pattern.size()) {
+        size_t end = pattern.find('/', start);
+        if (end == string::npos) {
+            end = pattern.size();
+        }
+        if (end > start) {
+            components.push_back(pattern.substr(start, end - start));
+        }
+        start = end + 1;
+    }
+    vector<string> results;
+    expandComponents(pattern[0] == '/' ? "/" : "", components, 0, results);
+    if (pattern.back() == '/') {
+        vector<string> dirs;
+        for (auto &path: results) {
+            struct stat st{};
+            if (stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+                dirs.push_back(path + "/");
+            }
+        }
+        results.swap(dirs);
+    }
+    std::sort(results.begin(), results.end());
+    results.erase(std::unique(results.begin(), results.end()), results.end());
+    return results;
+}
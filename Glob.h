@@ -0,0 +1,74 @@
+#ifndef SMASH_GLOB_H_
+#define SMASH_GLOB_H_
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <ctime>
+#include <sys/types.h>
+
+#define GLOB_CACHE_MAX_DIRS     (64)
+#define GLOB_CACHE_TTL_SECS     (5)
+#define GETDENTS_BUFFER_SIZE    (64 * 1024)
+
+class DirectoryCache {
+public:
+    struct Entry {
+        std::string name;
+        bool is_dir;
+        bool is_link;
+    };
+
+private:
+    struct Listing {
+        dev_t dev;
+        ino_t ino;
+        timespec mtime;
+        timespec loaded;
+        std::vector<Entry> entries;
+    };
+
+    std::unordered_map<std::string, Listing> listings;
+
+    static bool readDirectory(int dir_fd, std::vector<Entry> &entries);
+
+public:
+    DirectoryCache() = default;
+
+    ~DirectoryCache() = default;
+
+    // returns nullptr if the directory can not be read
+    const std::vector<Entry> *list(const std::string &dir);
+
+    void clear() {
+        this->listings.clear();
+    }
+};
+
+class Glob {
+    DirectoryCache cache;
+
+    void expandComponents(const std::string &base, const std::vector<std::string> &components, size_t index,
+                          std::vector<std::string> &results);
+
+    void expandRecursive(const std::string &base, const std::vector<std::string> &components, size_t index,
+                         std::vector<std::string> &results, int depth);
+
+public:
+    Glob() = default;
+
+    ~Glob() = default;
+
+    static bool hasMagic(const std::string &word);
+
+    static bool match(const char *pattern, const char *name);
+
+    // expanded paths in sorted order, empty if nothing matched
+    std::vector<std::string> expand(const std::string &pattern);
+
+    DirectoryCache &getCache() {
+        return this->cache;
+    }
+};
+
+#endif //SMASH_GLOB_H_
@@ -0,0 +1,249 @@
+#include "History.h"
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstring>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+// substring search that may read up to HISTORY_SEARCH_SLACK - 1 bytes past text + len
+static bool _contains(const char *text, size_t len, const std::string &needle) {
+    size_t k = needle.size();
+    if (k == 0) {
+        return true;
+    }
+    if (len < k) {
+        return false;
+    }
+#ifdef __SSE2__
+    // compares the first and last byte of the needle at 16 positions at once, and only positions where both
+    // match are checked in full
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[k - 1]);
+    for (size_t i = 0; i + k <= len; i += 16) {
+        __m128i block_first = _mm_loadu_si128((const __m128i *) (text + i));
+        __m128i block_last = _mm_loadu_si128((const __m128i *) (text + i + k - 1));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, block_first),
+                                                        _mm_cmpeq_epi8(last, block_last)));
+        while (mask != 0) {
+            size_t pos = i + __builtin_ctz(mask);
+            if (pos + k <= len && (k <= 2 || memcmp(text + pos + 1, needle.data() + 1, k - 2) == 0)) {
+                return true;
+            }
+            mask &= mask - 1;
+        }
+    }
+    return false;
+#else
+    return memmem(text, len, needle.data(), k) != nullptr;
+#endif
+}
+
+History::~History() {
+    if (this->map != nullptr) {
+        munmap(this->map, this->map_size);
+    }
+    if (this->fd != -1) {
+        close(this->fd);
+    }
+}
+
+bool History::open(const std::string &path) {
+    int file = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (file == -1) {
+        return false;
+    }
+    // only creating or repairing the file needs the lock, an existing file is mapped as it is
+    flock(file, LOCK_EX);
+    struct stat file_stat{};
+    fstat(file, &file_stat);
+    size_t size = file_stat.st_size;
+    char *mapped = nullptr;
+    if (size >= HISTORY_HEADER_SIZE) {
+        mapped = (char *) mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+        if (mapped == MAP_FAILED) {
+            mapped = nullptr;
+        }
+    }
+    auto *existing = (Header *) mapped;
+    bool usable = existing != nullptr && memcmp(existing->magic, HISTORY_FILE_MAGIC, sizeof existing->magic) == 0 &&
+                  existing->version == HISTORY_FILE_VERSION && existing->header_size == HISTORY_HEADER_SIZE &&
+                  existing->index_capacity > 0 && existing->index_capacity <= UINT32_MAX &&
+                  existing->data_capacity > HISTORY_MAX_LINE && existing->data_capacity <= UINT32_MAX &&
+                  size == HISTORY_HEADER_SIZE + existing->index_capacity * sizeof(IndexEntry) +
+                          existing->data_capacity + HISTORY_SEARCH_SLACK;
+    if (!usable) {
+        if (mapped != nullptr) {
+            munmap(mapped, size);
+        }
+        size = HISTORY_HEADER_SIZE + HISTORY_INDEX_CAPACITY * sizeof(IndexEntry) + HISTORY_DATA_CAPACITY +
+               HISTORY_SEARCH_SLACK;
+        // the file is sparse, untouched parts of the rings take no space
+        if (ftruncate(file, 0) == -1 || ftruncate(file, size) == -1) {
+            flock(file, LOCK_UN);
+            close(file);
+            return false;
+        }
+        mapped = (char *) mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+        if (mapped == MAP_FAILED) {
+            flock(file, LOCK_UN);
+            close(file);
+            return false;
+        }
+        auto *fresh = (Header *) mapped;
+        memcpy(fresh->magic, HISTORY_FILE_MAGIC, sizeof fresh->magic);
+        fresh->version = HISTORY_FILE_VERSION;
+        fresh->header_size = HISTORY_HEADER_SIZE;
+        fresh->index_capacity = HISTORY_INDEX_CAPACITY;
+        fresh->data_capacity = HISTORY_DATA_CAPACITY;
+        fresh->head.store(0);
+        fresh->data_end.store(0);
+    }
+    flock(file, LOCK_UN);
+    this->fd = file;
+    this->map = mapped;
+    this->map_size = size;
+    this->header = (Header *) mapped;
+    this->index = (IndexEntry *) (mapped + HISTORY_HEADER_SIZE);
+    this->data = mapped + HISTORY_HEADER_SIZE + this->header->index_capacity * sizeof(IndexEntry);
+    // whatever was entered before the file was opened
+    for (auto &line: this->entries) {
+        append(line);
+    }
+    this->entries.clear();
+    return true;
+}
+
+// a line stays valid while neither its index slot nor its bytes can have been reused, including by an append
+// that is in progress and not published yet
+bool History::valid(uint64_t seq, const IndexEntry &entry) const {
+    uint64_t head = this->header->head.load(std::memory_order_acquire);
+    uint64_t data_end = this->header->data_end.load(std::memory_order_acquire);
+    return seq < head && seq + this->header->index_capacity > head && entry.length <= HISTORY_MAX_LINE &&
+           entry.offset + this->header->data_capacity >= data_end + HISTORY_MAX_LINE;
+}
+
+uint64_t History::firstSeq() const {
+    uint64_t head = this->header->head.load(std::memory_order_acquire);
+    uint64_t low = head >= this->header->index_capacity ? head - this->header->index_capacity + 1 : 0;
+    uint64_t high = head;
+    // offsets grow with seq, so the lines whose bytes are still there form a suffix
+    while (low < high) {
+        uint64_t mid = low + (high - low) / 2;
+        if (valid(mid, this->index[mid % this->header->index_capacity])) {
+            high = mid;
+        } else {
+            low = mid + 1;
+        }
+    }
+    return low;
+}
+
+bool History::read(uint64_t seq, std::string &line) const {
+    IndexEntry entry = this->index[seq % this->header->index_capacity];
+    if (!valid(seq, entry)) {
+        return false;
+    }
+    uint64_t capacity = this->header->data_capacity;
+    size_t start = entry.offset % capacity;
+    size_t first_part = std::min<size_t>(entry.length, capacity - start);
+    line.assign(this->data + start, first_part);
+    line.append(this->data, entry.length - first_part);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return valid(seq, entry);
+}
+
+void History::append(const std::string &line) {
+    flock(this->fd, LOCK_EX);
+    uint64_t head = this->header->head.load(std::memory_order_relaxed);
+    string last;
+    if (head == 0 || !read(head - 1, last) || last != line) {
+        uint64_t offset = this->header->data_end.load(std::memory_order_relaxed);
+        uint64_t capacity = this->header->data_capacity;
+        size_t start = offset % capacity;
+        size_t first_part = std::min<size_t>(line.size(), capacity - start);
+        memcpy(this->data + start, line.data(), first_part);
+        memcpy(this->data, line.data() + first_part, line.size() - first_part);
+        this->index[head % this->header->index_capacity] = {offset, (uint32_t) line.size(), 0};
+        this->header->data_end.store(offset + line.size(), std::memory_order_release);
+        this->header->head.store(head + 1, std::memory_order_release);
+    }
+    flock(this->fd, LOCK_UN);
+}
+
+void History::add(const std::string &line) {
+    if (line.find_first_not_of(" \t") == string::npos || line.size() > HISTORY_MAX_LINE) {
+        return;
+    }
+    if (this->map != nullptr) {
+        append(line);
+        return;
+    }
+    if (!this->entries.empty() && this->entries.back() == line) {
+        return;
+    }
+    this->entries.push_back(line);
+    if (this->entries.size() > HISTORY_MAX_ENTRIES) {
+        this->entries.pop_front();
+    }
+}
+
+size_t History::size() const {
+    if (this->map == nullptr) {
+        return this->entries.size();
+    }
+    return this->header->head.load(std::memory_order_acquire) - firstSeq();
+}
+
+std::string History::at(size_t position) const {
+    if (this->map == nullptr) {
+        return position < this->entries.size() ? this->entries[position] : "";
+    }
+    string line;
+    if (!read(firstSeq() + position, line)) {
+        line.clear();
+    }
+    return line;
+}
+
+std::vector<size_t> History::search(const std::string &pattern, size_t limit) const {
+    vector<size_t> found;
+    if (this->map == nullptr) {
+        for (size_t i = this->entries.size(); i > 0 && found.size() < limit; i--) {
+            if (this->entries[i - 1].find(pattern) != string::npos) {
+                found.push_back(i - 1);
+            }
+        }
+        return found;
+    }
+    uint64_t first = firstSeq();
+    uint64_t head = this->header->head.load(std::memory_order_acquire);
+    uint64_t capacity = this->header->data_capacity;
+    string wrapped;
+    for (uint64_t seq = head; seq > first && found.size() < limit; seq--) {
+        IndexEntry entry = this->index[(seq - 1) % this->header->index_capacity];
+        if (!valid(seq - 1, entry)) {
+            break;
+        }
+        size_t start = entry.offset % capacity;
+        const char *text = this->data + start;
+        // the few lines that wrap around the end of the ring are searched in a copy
+        if (start + entry.length > capacity) {
+            if (!read(seq - 1, wrapped)) {
+                break;
+            }
+            wrapped.resize(entry.length + HISTORY_SEARCH_SLACK);
+            text = wrapped.data();
+        }
+        if (_contains(text, entry.length, pattern) && valid(seq - 1, entry)) {
+            found.push_back(seq - 1 - first);
+        }
+    }
+    return found;
+}
@@ -0,0 +1,90 @@
+#ifndef SMASH_HISTORY_H_
+#define SMASH_HISTORY_H_
+
+#include <string>
+#include <deque>
+#include <vector>
+#include <atomic>
+#include <cstdint>
+
+// used when no history file could be opened
+#define HISTORY_MAX_ENTRIES         (100000)
+#define HISTORY_FILE_MAGIC          "SMASHHST"
+#define HISTORY_FILE_VERSION        (1)
+#define HISTORY_HEADER_SIZE         (4096)
+#define HISTORY_INDEX_CAPACITY      (2 * 1024 * 1024)
+#define HISTORY_DATA_CAPACITY       (64 * 1024 * 1024)
+// lines longer than this are not recorded
+#define HISTORY_MAX_LINE            (64 * 1024)
+// the substring search reads up to 15 bytes past the end of an entry
+#define HISTORY_SEARCH_SLACK        (16)
+
+/*
+ * Command lines entered at the prompt, oldest first, shared by every smash that uses the same file.
+ *
+ * The file is mapped with MAP_SHARED and laid out as a header, a ring of index entries (offset and length of
+ * each line) and a ring of line bytes, so opening it costs a few syscalls no matter how many lines it holds.
+ * Appends take an exclusive flock(), copy the line into the data ring, fill its index slot and only then
+ * publish it by bumping the head counter. Readers do not lock: a line is valid while its index slot and its
+ * bytes have not been overwritten by newer lines, which is checked again after it was read.
+ */
+class History {
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t header_size;
+        uint64_t index_capacity;
+        uint64_t data_capacity;
+        // lines and bytes ever appended
+        std::atomic<uint64_t> head;
+        std::atomic<uint64_t> data_end;
+    };
+
+    struct IndexEntry {
+        uint64_t offset;
+        uint32_t length;
+        uint32_t reserved;
+    };
+
+    std::deque<std::string> entries;
+    int fd = -1;
+    char *map = nullptr;
+    size_t map_size = 0;
+    Header *header = nullptr;
+    IndexEntry *index = nullptr;
+    char *data = nullptr;
+
+    uint64_t firstSeq() const;
+
+    // copies line seq out of the ring; returns false if it was overwritten
+    bool read(uint64_t seq, std::string &line) const;
+
+    bool valid(uint64_t seq, const IndexEntry &entry) const;
+
+    void append(const std::string &line);
+
+public:
+    History() = default;
+
+    ~History();
+
+    History(History const &) = delete;
+
+    void operator=(History const &) = delete;
+
+    // maps the history file, creating it if needed; returns false (and keeps history in memory) on failure
+    bool open(const std::string &path);
+
+    // blank lines and repeats of the previous line are not recorded
+    void add(const std::string &line);
+
+    size_t size() const;
+
+    // empty if the line was overwritten in the meantime
+    std::string at(size_t index) const;
+
+    // positions (as for at()) of up to limit lines containing pattern, newest first
+    std::vector<size_t> search(const std::string &pattern, size_t limit) const;
+};
+
+#endif //SMASH_HISTORY_H_
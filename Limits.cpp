@@ -0,0 +1,217 @@
+#include "Limits.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+
+static const struct {
+    const char *name;
+    int resource;
+} _resources[LIMIT_RESOURCES] = {
+        {"as",     RLIMIT_AS},
+        {"rss",    RLIMIT_DATA},
+        {"cpu",    RLIMIT_CPU},
+        {"nofile", RLIMIT_NOFILE},
+        {"nproc",  RLIMIT_NPROC},
+};
+
+static bool _isMemory(LimitResource resource) {
+    return resource == LIMIT_AS || resource == LIMIT_RSS;
+}
+
+ResourceLimits::ResourceLimits() {
+    std::fill(std::begin(this->values), std::end(this->values), RLIM_INFINITY);
+}
+
+bool ResourceLimits::empty() const {
+    return std::all_of(std::begin(this->values), std::end(this->values),
+                       [](rlim_t value) { return value == RLIM_INFINITY; });
+}
+
+// false when the resource has no limit to set
+bool ResourceLimits::toRlimit(LimitResource resource, const rlimit &current, rlimit &limit) const {
+    rlim_t value = this->values[resource];
+    if (value == RLIM_INFINITY) {
+        return false;
+    }
+    limit.rlim_cur = value;
+    limit.rlim_max = resource == LIMIT_CPU ? value + 1 : value;
+    // only root may raise a hard limit
+    if (current.rlim_max != RLIM_INFINITY) {
+        limit.rlim_max = std::min(limit.rlim_max, current.rlim_max);
+        limit.rlim_cur = std::min(limit.rlim_cur, limit.rlim_max);
+    }
+    return true;
+}
+
+bool ResourceLimits::apply() const {
+    for (int i = 0; i < LIMIT_RESOURCES; i++) {
+        auto resource = (LimitResource) i;
+        rlimit current{}, limit{};
+        if (getrlimit(_resources[i].resource, &current) != 0) {
+            return false;
+        }
+        if (toRlimit(resource, current, limit) && setrlimit(_resources[i].resource, &limit) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ResourceLimits::applyTo(pid_t pid, LimitResource resource) const {
+    rlimit current{}, limit{};
+    if (prlimit(pid, (__rlimit_resource) _resources[resource].resource, nullptr, &current) != 0) {
+        return false;
+    }
+    if (!toRlimit(resource, current, limit)) {
+        // lifting a limit is as far as the hard limit allows
+        limit.rlim_cur = limit.rlim_max = current.rlim_max;
+    }
+    return prlimit(pid, (__rlimit_resource) _resources[resource].resource, &limit, nullptr) == 0;
+}
+
+std::string ResourceLimits::describe() const {
+    string description;
+    for (int i = 0; i < LIMIT_RESOURCES; i++) {
+        if (this->values[i] == RLIM_INFINITY) {
+            continue;
+        }
+        if (!description.empty()) {
+            description += ' ';
+        }
+        description += string(_resources[i].name) + "=" + format((LimitResource) i, this->values[i]);
+    }
+    return description;
+}
+
+LimitResource ResourceLimits::hitBy(int status, const rusage &usage) const {
+    if (this->values[LIMIT_CPU] != RLIM_INFINITY && WIFSIGNALED(status)) {
+        rlim_t cpu_seconds = usage.ru_utime.tv_sec + usage.ru_stime.tv_sec;
+        if (WTERMSIG(status) == SIGXCPU || (WTERMSIG(status) == SIGKILL && cpu_seconds >= this->values[LIMIT_CPU])) {
+            return LIMIT_CPU;
+        }
+    }
+    bool failed = WIFSIGNALED(status) || (WIFEXITED(status) && WEXITSTATUS(status) != 0);
+    if (!failed) {
+        return LIMIT_RESOURCES;
+    }
+    // an allocation refused by the kernel leaves no trace but the job's failure, so the peak is the evidence
+    rlim_t peak = (rlim_t) usage.ru_maxrss * 1024;
+    for (LimitResource resource: {LIMIT_RSS, LIMIT_AS}) {
+        rlim_t value = this->values[resource];
+        if (value != RLIM_INFINITY && peak >= value / 100 * LIMIT_MEMORY_NEAR_PERCENT) {
+            return resource;
+        }
+    }
+    return LIMIT_RESOURCES;
+}
+
+const char *ResourceLimits::name(LimitResource resource) {
+    return _resources[resource].name;
+}
+
+bool ResourceLimits::parseResource(const std::string &name, LimitResource &resource) {
+    for (int i = 0; i < LIMIT_RESOURCES; i++) {
+        if (name == _resources[i].name) {
+            resource = (LimitResource) i;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ResourceLimits::parseValue(LimitResource resource, const std::string &text, rlim_t &value) {
+    if (text == "unlimited") {
+        value = RLIM_INFINITY;
+        return true;
+    }
+    if (text.empty() || !isdigit((unsigned char) text[0])) {
+        return false;
+    }
+    errno = 0;
+    char *end;
+    unsigned long long number = strtoull(text.c_str(), &end, 10);
+    if (errno == ERANGE) {
+        return false;
+    }
+    unsigned long long scale = 1;
+    if (*end != '\0') {
+        const char *suffixes = _isMemory(resource) ? "KMGT" : resource == LIMIT_CPU ? "smh" : "";
+        const char *suffix = end[1] == '\0' ? strchr(suffixes, *end) : nullptr;
+        if (suffix == nullptr || *suffix == '\0') {
+            return false;
+        }
+        if (_isMemory(resource)) {
+            scale = 1ULL << (10 * (suffix - suffixes + 1));
+        } else {
+            scale = *suffix == 's' ? 1 : *suffix == 'm' ? 60 : 3600;
+        }
+    }
+    if (number > (RLIM_INFINITY - 1) / scale) {
+        return false;
+    }
+    value = number * scale;
+    return true;
+}
+
+std::string ResourceLimits::format(LimitResource resource, rlim_t value) {
+    if (value == RLIM_INFINITY) {
+        return "unlimited";
+    }
+    if (resource == LIMIT_CPU) {
+        return to_string(value) + "s";
+    }
+    if (_isMemory(resource)) {
+        static const char suffixes[] = "TGMK";
+        for (int i = 0; i < 4; i++) {
+            rlim_t unit = 1ULL << (10 * (4 - i));
+            if (value != 0 && value % unit == 0) {
+                return to_string(value / unit) + suffixes[i];
+            }
+        }
+    }
+    return to_string(value);
+}
+
+std::vector<pid_t> processGroupMembers(pid_t pgid) {
+    vector<pid_t> members;
+    DIR *proc = opendir("/proc");
+    if (proc == nullptr) {
+        return members;
+    }
+    while (dirent *entry = readdir(proc)) {
+        if (!isdigit((unsigned char) entry->d_name[0])) {
+            continue;
+        }
+        string path = string("/proc/") + entry->d_name + "/stat";
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            continue;
+        }
+        char buffer[512];
+        ssize_t res = read(fd, buffer, sizeof buffer - 1);
+        close(fd);
+        if (res <= 0) {
+            continue;
+        }
+        buffer[res] = '\0';
+        // the command name may contain spaces and parentheses, fields are counted from the last ')':
+        // state, ppid, pgrp
+        char *fields = strrchr(buffer, ')');
+        int ppid, pgrp;
+        char state;
+        if (fields != nullptr && sscanf(fields + 1, " %c %d %d", &state, &ppid, &pgrp) == 3 && pgrp == pgid) {
+            members.push_back((pid_t) atoi(entry->d_name));
+        }
+    }
+    closedir(proc);
+    return members;
+}
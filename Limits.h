@@ -0,0 +1,72 @@
+#ifndef SMASH_LIMITS_H_
+#define SMASH_LIMITS_H_
+
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/types.h>
+
+// a job that failed counts as having hit a memory limit when its peak resident size came this close to it
+#define LIMIT_MEMORY_NEAR_PERCENT   (80)
+
+enum LimitResource {
+    LIMIT_AS,       // address space, in bytes
+    LIMIT_RSS,      // data segment, in bytes: Linux does not enforce RLIMIT_RSS, so this stands in for it
+    LIMIT_CPU,      // cpu time, in seconds
+    LIMIT_NOFILE,   // open descriptors
+    LIMIT_NPROC,    // processes of the user
+    LIMIT_RESOURCES
+};
+
+/*
+ * The resource limits of a job, RLIM_INFINITY where none is set. They are put in place with setrlimit() in
+ * the forked child before exec, or with prlimit() on the processes of a job that already runs. Each limit is
+ * both the soft and the hard one, so that a job can not raise it again; cpu time gets a hard limit a second
+ * above the soft one, so that SIGXCPU (which says why the job died) comes before SIGKILL.
+ */
+class ResourceLimits {
+    rlim_t values[LIMIT_RESOURCES];
+
+    bool toRlimit(LimitResource resource, const rlimit &current, rlimit &limit) const;
+
+public:
+    ResourceLimits();
+
+    rlim_t get(LimitResource resource) const {
+        return this->values[resource];
+    }
+
+    void set(LimitResource resource, rlim_t value) {
+        this->values[resource] = value;
+    }
+
+    bool empty() const;
+
+    // in a forked child, capped at the hard limits it already has; false with errno set
+    bool apply() const;
+
+    // on a running process; false with errno set
+    bool applyTo(pid_t pid, LimitResource resource) const;
+
+    // "as=1G cpu=10s", or "" when no limit is set
+    std::string describe() const;
+
+    // the limit a job that finished with this waitpid() status most likely ran into, or LIMIT_RESOURCES.
+    // Only cpu time is certain; running out of descriptors or processes shows up as the job's own errors
+    LimitResource hitBy(int status, const rusage &usage) const;
+
+    static const char *name(LimitResource resource);
+
+    static bool parseResource(const std::string &name, LimitResource &resource);
+
+    // bytes with an optional K, M, G or T suffix, seconds with an optional s, m or h suffix, plain counts,
+    // or "unlimited"
+    static bool parseValue(LimitResource resource, const std::string &text, rlim_t &value);
+
+    static std::string format(LimitResource resource, rlim_t value);
+};
+
+// the pids in a process group, found through /proc
+std::vector<pid_t> processGroupMembers(pid_t pgid);
+
+#endif //SMASH_LIMITS_H_
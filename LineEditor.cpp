@@ -0,0 +1,452 @@
+#include "LineEditor.h"
+#include "Commands.h"
+
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+
+using namespace std;
+
+#define KEY_CTRL(key)   ((key) & 0x1f)
+#define KEY_ESCAPE      (27)
+#define KEY_DELETE      (127)
+
+CompletionTrie::CompletionTrie() {
+    this->nodes.emplace_back();
+}
+
+void CompletionTrie::clear() {
+    this->nodes.clear();
+    this->nodes.emplace_back();
+}
+
+void CompletionTrie::insert(const std::string &word) {
+    int node = 0;
+    for (char c: word) {
+        auto &children = this->nodes[node].children;
+        auto child = std::lower_bound(children.begin(), children.end(), std::make_pair(c, 0),
+                                      [](const pair<char, int> &a, const pair<char, int> &b) {
+                                          return a.first < b.first;
+                                      });
+        if (child != children.end() && child->first == c) {
+            node = child->second;
+            continue;
+        }
+        int next = (int) this->nodes.size();
+        children.insert(child, {c, next});
+        // invalidates children, which is not used past this point
+        this->nodes.emplace_back();
+        node = next;
+    }
+    this->nodes[node].terminal = true;
+}
+
+int CompletionTrie::find(const std::string &prefix) const {
+    int node = 0;
+    for (char c: prefix) {
+        const auto &children = this->nodes[node].children;
+        auto child = std::lower_bound(children.begin(), children.end(), std::make_pair(c, 0),
+                                      [](const pair<char, int> &a, const pair<char, int> &b) {
+                                          return a.first < b.first;
+                                      });
+        if (child == children.end() || child->first != c) {
+            return -1;
+        }
+        node = child->second;
+    }
+    return node;
+}
+
+void CompletionTrie::collect(int node, std::string &word, std::vector<std::string> &words, size_t limit) const {
+    if (words.size() >= limit) {
+        return;
+    }
+    if (this->nodes[node].terminal) {
+        words.push_back(word);
+    }
+    for (auto &child: this->nodes[node].children) {
+        word += child.first;
+        collect(child.second, word, words, limit);
+        word.pop_back();
+    }
+}
+
+std::vector<std::string> CompletionTrie::complete(const std::string &prefix, size_t limit) const {
+    vector<string> words;
+    int node = find(prefix);
+    if (node != -1) {
+        string word = prefix;
+        collect(node, word, words, limit);
+    }
+    return words;
+}
+
+std::string CompletionTrie::commonPrefix(const std::string &prefix) const {
+    string common = prefix;
+    int node = find(prefix);
+    while (node != -1 && !this->nodes[node].terminal && this->nodes[node].children.size() == 1) {
+        common += this->nodes[node].children[0].first;
+        node = this->nodes[node].children[0].second;
+    }
+    return common;
+}
+
+LineEditor::LineEditor(History &history) : history(history) {
+}
+
+LineEditor::~LineEditor() {
+    end();
+}
+
+void LineEditor::write(const std::string &data) {
+    size_t written = 0;
+    while (written < data.size()) {
+        ssize_t res = ::write(STDOUT_FILENO, data.data() + written, data.size() - written);
+        if (res == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        written += res;
+    }
+}
+
+bool LineEditor::begin(const std::string &new_prompt) {
+    if (!isatty(STDIN_FILENO) || tcgetattr(STDIN_FILENO, &this->saved_termios) == -1) {
+        return false;
+    }
+    termios raw_termios = this->saved_termios;
+    // ISIG stays on: ctrl-C and ctrl-Z still reach the shell's handlers
+    raw_termios.c_iflag &= ~(ICRNL | IXON | BRKINT | INPCK | ISTRIP);
+    raw_termios.c_lflag &= ~(ECHO | ICANON | IEXTEN);
+    raw_termios.c_cc[VMIN] = 1;
+    raw_termios.c_cc[VTIME] = 0;
+    if (tcsetattr(STDIN_FILENO, TCSADRAIN, &raw_termios) == -1) {
+        return false;
+    }
+    this->raw = true;
+    this->prompt = new_prompt;
+    this->buffer.clear();
+    this->cursor = 0;
+    this->history_end = this->history.size();
+    this->history_index = this->history_end;
+    this->draft.clear();
+    this->last_was_tab = false;
+    std::cout.flush();
+    refresh();
+    return true;
+}
+
+void LineEditor::end() {
+    if (this->raw) {
+        tcsetattr(STDIN_FILENO, TCSADRAIN, &this->saved_termios);
+        this->raw = false;
+    }
+}
+
+void LineEditor::cancel() {
+    this->buffer.clear();
+    this->cursor = 0;
+    this->pending.clear();
+    this->history_end = this->history.size();
+    this->history_index = this->history_end;
+    this->draft.clear();
+    std::cout.flush();
+    refresh();
+}
+
+// redraws the whole line, scrolling it horizontally when it does not fit the terminal
+void LineEditor::refresh() {
+    winsize size{};
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_col > 0) {
+        this->columns = size.ws_col;
+    }
+    // the last column is left empty so that the terminal never wraps
+    size_t room = this->columns > this->prompt.size() + 1 ? this->columns - this->prompt.size() - 1 : 1;
+    size_t shift = this->cursor > room ? this->cursor - room : 0;
+    string frame = "\r" + this->prompt + this->buffer.substr(shift, room) + "\x1b[0K\r";
+    size_t column = this->prompt.size() + this->cursor - shift;
+    if (column > 0) {
+        frame += "\x1b[" + to_string(column) + "C";
+    }
+    write(frame);
+}
+
+void LineEditor::insert(const std::string &text) {
+    this->buffer.insert(this->cursor, text);
+    this->cursor += text.size();
+    // typing at the end of a line that still fits only needs the new characters echoed
+    if (this->cursor == this->buffer.size() && this->prompt.size() + this->buffer.size() + 1 < this->columns) {
+        write(text);
+    } else {
+        refresh();
+    }
+}
+
+void LineEditor::erase(size_t from, size_t to) {
+    if (from >= to) {
+        return;
+    }
+    this->buffer.erase(from, to - from);
+    this->cursor = from;
+    refresh();
+}
+
+void LineEditor::historyMove(int direction) {
+    if ((direction < 0 && this->history_index == 0) ||
+        (direction > 0 && this->history_index == this->history_end)) {
+        return;
+    }
+    if (this->history_index == this->history_end) {
+        this->draft = this->buffer;
+    }
+    this->history_index += direction;
+    this->buffer = this->history_index == this->history_end ? this->draft : this->history.at(this->history_index);
+    this->cursor = this->buffer.size();
+    refresh();
+}
+
+void LineEditor::buildCommands() {
+    SmallShell &smash = SmallShell::getInstance();
+    string path = smash.getEnvironment().get("PATH");
+    if (path == this->commands_path && smash.getDispatchGeneration() == this->commands_generation &&
+        time(nullptr) - this->commands_built < COMPLETION_CACHE_TTL_SECS) {
+        return;
+    }
+    this->commands.clear();
+    for (auto &name: smash.commandNames()) {
+        this->commands.insert(name);
+    }
+    DirectoryCache &cache = smash.getGlob().getCache();
+    for (auto &dir: smash.getEnvironment().getPathDirs()) {
+        const vector<DirectoryCache::Entry> *entries = cache.list(dir);
+        if (entries == nullptr) {
+            continue;
+        }
+        for (auto &entry: *entries) {
+            if (!entry.is_dir) {
+                this->commands.insert(entry.name);
+            }
+        }
+    }
+    this->commands_path = path;
+    this->commands_generation = smash.getDispatchGeneration();
+    this->commands_built = time(nullptr);
+}
+
+void LineEditor::complete(bool list_candidates) {
+    SmallShell &smash = SmallShell::getInstance();
+    size_t start = this->cursor;
+    while (start > 0 && !isspace(this->buffer[start - 1]) && !strchr(";|&<>", this->buffer[start - 1])) {
+        start--;
+    }
+    string word = this->buffer.substr(start, this->cursor - start);
+    size_t before = this->buffer.find_last_not_of(" \t", start == 0 ? string::npos : start - 1);
+    bool command_position = start == 0 || before == string::npos || strchr(";|&", this->buffer[before]);
+
+    CompletionTrie files;
+    const CompletionTrie *trie = &files;
+    // the part of the word the candidates complete, the directory part of a path is kept as it is
+    string prefix = word;
+    if (!word.empty() && word[0] == '%') {
+        for (auto &job: smash.getJobsList().jobs_list) {
+            files.insert("%" + to_string(job->getJobID()));
+        }
+    } else if (command_position && word.find('/') == string::npos) {
+        buildCommands();
+        trie = &this->commands;
+    } else {
+        size_t slash = word.rfind('/');
+        string dir = slash == string::npos ? "." : (slash == 0 ? "/" : word.substr(0, slash));
+        prefix = slash == string::npos ? word : word.substr(slash + 1);
+        const vector<DirectoryCache::Entry> *entries = smash.getGlob().getCache().list(dir);
+        if (entries != nullptr) {
+            for (auto &entry: *entries) {
+                if (entry.name.compare(0, prefix.size(), prefix) != 0 || (entry.name[0] == '.' && prefix.empty())) {
+                    continue;
+                }
+                bool is_dir = entry.is_dir;
+                if (entry.is_link) {
+                    struct stat target{};
+                    is_dir = stat((dir + "/" + entry.name).c_str(), &target) == 0 && S_ISDIR(target.st_mode);
+                }
+                files.insert(is_dir ? entry.name + "/" : entry.name);
+            }
+        }
+    }
+
+    vector<string> matches = trie->complete(prefix, COMPLETION_MAX_LISTED + 1);
+    if (matches.empty()) {
+        write("\a");
+        return;
+    }
+    if (matches.size() == 1) {
+        string rest = matches[0].substr(prefix.size());
+        insert(rest.empty() || rest.back() != '/' ? rest + " " : rest);
+        return;
+    }
+    string common = trie->commonPrefix(prefix);
+    if (common.size() > prefix.size()) {
+        insert(common.substr(prefix.size()));
+        return;
+    }
+    if (!list_candidates) {
+        write("\a");
+        return;
+    }
+    string listing = "\n";
+    for (size_t i = 0; i < matches.size() && i < COMPLETION_MAX_LISTED; i++) {
+        listing += matches[i] + "  ";
+    }
+    if (matches.size() > COMPLETION_MAX_LISTED) {
+        listing += "...";
+    }
+    write(listing + "\n");
+    refresh();
+}
+
+size_t LineEditor::handleKey(EditResult &result) {
+    unsigned char key = this->pending[0];
+    if (key == '\r' || key == '\n') {
+        result = EDIT_LINE;
+        return key == '\r' && this->pending.size() > 1 && this->pending[1] == '\n' ? 2 : 1;
+    }
+    bool was_tab = this->last_was_tab;
+    this->last_was_tab = key == '\t';
+    if (key >= 32 && key != KEY_DELETE) {
+        // a run of printable characters (typing ahead or a paste) is inserted at once
+        size_t len = 1;
+        while (len < this->pending.size() && (unsigned char) this->pending[len] >= 32 &&
+               this->pending[len] != KEY_DELETE) {
+            len++;
+        }
+        insert(this->pending.substr(0, len));
+        return len;
+    }
+    if (key == KEY_ESCAPE) {
+        if (this->pending.size() < 2) {
+            return 0;
+        }
+        if (this->pending[1] != '[' && this->pending[1] != 'O') {
+            return 1;
+        }
+        size_t end = 2;
+        while (end < this->pending.size() && (this->pending[end] < 0x40 || this->pending[end] > 0x7e)) {
+            end++;
+        }
+        if (end == this->pending.size()) {
+            return 0;
+        }
+        string sequence = this->pending.substr(2, end - 1);
+        if (sequence == "A") {
+            historyMove(-1);
+        } else if (sequence == "B") {
+            historyMove(1);
+        } else if (sequence == "C" && this->cursor < this->buffer.size()) {
+            this->cursor++;
+            refresh();
+        } else if (sequence == "D" && this->cursor > 0) {
+            this->cursor--;
+            refresh();
+        } else if (sequence == "H" || sequence == "1~" || sequence == "7~") {
+            this->cursor = 0;
+            refresh();
+        } else if (sequence == "F" || sequence == "4~" || sequence == "8~") {
+            this->cursor = this->buffer.size();
+            refresh();
+        } else if (sequence == "3~") {
+            erase(this->cursor, std::min(this->cursor + 1, this->buffer.size()));
+        }
+        return end + 1;
+    }
+    switch (key) {
+        case KEY_CTRL('A'):
+            this->cursor = 0;
+            refresh();
+            break;
+        case KEY_CTRL('E'):
+            this->cursor = this->buffer.size();
+            refresh();
+            break;
+        case KEY_CTRL('B'):
+            if (this->cursor > 0) {
+                this->cursor--;
+                refresh();
+            }
+            break;
+        case KEY_CTRL('F'):
+            if (this->cursor < this->buffer.size()) {
+                this->cursor++;
+                refresh();
+            }
+            break;
+        case KEY_CTRL('D'):
+            if (this->buffer.empty()) {
+                result = EDIT_EOF;
+            } else {
+                erase(this->cursor, std::min(this->cursor + 1, this->buffer.size()));
+            }
+            break;
+        case KEY_CTRL('H'):
+        case KEY_DELETE:
+            if (this->cursor > 0) {
+                erase(this->cursor - 1, this->cursor);
+            }
+            break;
+        case KEY_CTRL('K'):
+            erase(this->cursor, this->buffer.size());
+            break;
+        case KEY_CTRL('U'):
+            erase(0, this->cursor);
+            break;
+        case KEY_CTRL('W'): {
+            size_t start = this->cursor;
+            while (start > 0 && isspace(this->buffer[start - 1])) {
+                start--;
+            }
+            while (start > 0 && !isspace(this->buffer[start - 1])) {
+                start--;
+            }
+            erase(start, this->cursor);
+            break;
+        }
+        case KEY_CTRL('L'):
+            write("\x1b[H\x1b[2J");
+            refresh();
+            break;
+        case KEY_CTRL('P'):
+            historyMove(-1);
+            break;
+        case KEY_CTRL('N'):
+            historyMove(1);
+            break;
+        case '\t':
+            complete(was_tab);
+            break;
+        default:
+            break;
+    }
+    return 1;
+}
+
+EditResult LineEditor::feed(const char *data, size_t len, std::string &line) {
+    this->pending.append(data, len);
+    EditResult result = EDIT_MORE;
+    size_t used = 0;
+    while (!this->pending.empty() && result == EDIT_MORE && (used = handleKey(result)) > 0) {
+        this->pending.erase(0, used);
+    }
+    if (result == EDIT_LINE) {
+        line = this->buffer;
+        write("\n");
+        end();
+        this->history.add(line);
+    } else if (result == EDIT_EOF) {
+        write("\n");
+        end();
+    }
+    return result;
+}
@@ -0,0 +1,119 @@
+#ifndef SMASH_LINE_EDITOR_H_
+#define SMASH_LINE_EDITOR_H_
+
+#include <string>
+#include <vector>
+#include <ctime>
+#include <termios.h>
+#include "History.h"
+
+// the command trie is rebuilt at most this often, or when PATH, an alias or a function changes
+#define COMPLETION_CACHE_TTL_SECS   (5)
+#define COMPLETION_MAX_LISTED       (100)
+#define EDITOR_DEFAULT_COLUMNS      (80)
+
+class CompletionTrie {
+    struct Node {
+        // sorted by character
+        std::vector<std::pair<char, int>> children;
+        bool terminal = false;
+    };
+
+    std::vector<Node> nodes;
+
+    int find(const std::string &prefix) const;
+
+    void collect(int node, std::string &word, std::vector<std::string> &words, size_t limit) const;
+
+public:
+    CompletionTrie();
+
+    ~CompletionTrie() = default;
+
+    void clear();
+
+    void insert(const std::string &word);
+
+    // up to limit words starting with prefix, sorted
+    std::vector<std::string> complete(const std::string &prefix, size_t limit) const;
+
+    // the longest string that every word starting with prefix starts with
+    std::string commonPrefix(const std::string &prefix) const;
+};
+
+enum EditResult {
+    EDIT_MORE,      // waiting for more keys
+    EDIT_LINE,      // a line was entered
+    EDIT_EOF        // ctrl-D on an empty line
+};
+
+/*
+ * An in-process line editor for interactive sessions: the terminal is put in raw mode (signals are still
+ * generated) while a line is being edited, and only the part of the line that changed is redrawn, with a
+ * single write() per key. Supports cursor movement, the usual emacs control keys, history browsing and tab
+ * completion of commands (builtins and PATH), job ids and file names. Input is fed in by the caller, which
+ * keeps waiting on stdin together with the control socket.
+ */
+class LineEditor {
+    History &history;
+    termios saved_termios{};
+    bool raw = false;
+    std::string prompt;
+    std::string buffer;
+    size_t cursor = 0;
+    // terminal width as of the last full redraw
+    size_t columns = EDITOR_DEFAULT_COLUMNS;
+    // keys read but not yet handled, including the start of an escape sequence split across reads
+    std::string pending;
+    size_t history_index = 0;
+    // history size when the line was started, so that lines added by other shells meanwhile do not shift it
+    size_t history_end = 0;
+    // the line being typed while browsing history
+    std::string draft;
+    bool last_was_tab = false;
+    CompletionTrie commands;
+    std::string commands_path;
+    unsigned commands_generation = 0;
+    time_t commands_built = 0;
+
+    void write(const std::string &data);
+
+    void refresh();
+
+    void insert(const std::string &text);
+
+    void erase(size_t from, size_t to);
+
+    void historyMove(int direction);
+
+    void buildCommands();
+
+    // a second tab in a row lists the candidates when there is nothing to insert
+    void complete(bool list_candidates);
+
+    // handles the key at the start of pending; returns the number of bytes used, 0 if the key is incomplete
+    size_t handleKey(EditResult &result);
+
+public:
+    explicit LineEditor(History &history);
+
+    ~LineEditor();
+
+    LineEditor(LineEditor const &) = delete;
+
+    void operator=(LineEditor const &) = delete;
+
+    // switches to raw mode and prints the prompt; returns false if stdin is not a terminal
+    bool begin(const std::string &new_prompt);
+
+    // feeds keys read from stdin; on EDIT_LINE the line is in line and the terminal is restored
+    EditResult feed(const char *data, size_t len, std::string &line);
+
+    // drops the line after ctrl-C and starts over with a new prompt
+    void cancel();
+
+    // restores the terminal
+    void end();
+};
+
+#endif //SMASH_LINE_EDITOR_H_
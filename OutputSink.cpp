@@ -0,0 +1,97 @@
+#include "OutputSink.h"
+#include "Worker.h"
+
+#include <sys/uio.h>
+#include <unistd.h>
+#include <climits>
+#include <cerrno>
+
+using namespace std;
+
+OutputSink::OutputSink(int fd) : fd(fd) {
+    this->blocks.push_back(std::make_unique<char[]>(OUTPUT_SINK_BLOCK_SIZE));
+    setp(this->blocks[0].get(), this->blocks[0].get() + OUTPUT_SINK_BLOCK_SIZE);
+}
+
+OutputSink::~OutputSink() {
+    flush();
+}
+
+size_t OutputSink::pending() const {
+    return (this->used_blocks - 1) * OUTPUT_SINK_BLOCK_SIZE + (pptr() - pbase());
+}
+
+OutputSink::int_type OutputSink::overflow(int_type ch) {
+    if (pending() >= OUTPUT_SINK_HIGH_WATER) {
+        flush();
+    } else {
+        if (this->used_blocks == this->blocks.size()) {
+            this->blocks.push_back(std::make_unique<char[]>(OUTPUT_SINK_BLOCK_SIZE));
+        }
+        char *block = this->blocks[this->used_blocks++].get();
+        setp(block, block + OUTPUT_SINK_BLOCK_SIZE);
+    }
+    if (ch != traits_type::eof()) {
+        *pptr() = traits_type::to_char_type(ch);
+        pbump(1);
+    }
+    return traits_type::not_eof(ch);
+}
+
+int OutputSink::sync() {
+    return flush() ? 0 : -1;
+}
+
+bool OutputSink::flush() {
+    std::vector<iovec> iov;
+    for (size_t i = 0; i < this->used_blocks; i++) {
+        size_t len = i + 1 < this->used_blocks ? OUTPUT_SINK_BLOCK_SIZE : pptr() - pbase();
+        if (len > 0) {
+            iov.push_back({this->blocks[i].get(), len});
+        }
+    }
+    bool ok = true;
+    size_t first = 0;
+    while (first < iov.size()) {
+        ssize_t res = writev(this->fd, &iov[first], (int) std::min<size_t>(iov.size() - first, IOV_MAX));
+        if (res == -1) {
+            // a cancelled worker gives up on a reader that does not drain the pipe
+            if (errno == EINTR && !WorkerPool::cancelRequested()) {
+                continue;
+            }
+            ok = false;
+            break;
+        }
+        // skip what a short write got out
+        while (first < iov.size() && (size_t) res >= iov[first].iov_len) {
+            res -= iov[first++].iov_len;
+        }
+        if (first < iov.size()) {
+            iov[first].iov_base = (char *) iov[first].iov_base + res;
+            iov[first].iov_len -= res;
+        }
+    }
+    if (this->blocks.size() > OUTPUT_SINK_KEPT_BLOCKS) {
+        this->blocks.resize(OUTPUT_SINK_KEPT_BLOCKS);
+    }
+    this->used_blocks = 1;
+    setp(this->blocks[0].get(), this->blocks[0].get() + OUTPUT_SINK_BLOCK_SIZE);
+    return ok;
+}
+
+std::ostream &OutputSink::standard(int fd) {
+    static OutputSink out_sink(STDOUT_FILENO);
+    static OutputSink err_sink(STDERR_FILENO);
+    static std::ostream out(&out_sink);
+    static std::ostream err(&err_sink);
+    if (fd == STDERR_FILENO) {
+        err.tie(&out);
+        return err;
+    }
+    return out;
+}
+
+void OutputSink::flushStandard() {
+    standard(STDOUT_FILENO).flush();
+    standard(STDERR_FILENO).flush();
+}
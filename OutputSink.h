@@ -0,0 +1,52 @@
+#ifndef SMASH_OUTPUT_SINK_H_
+#define SMASH_OUTPUT_SINK_H_
+
+#include <memory>
+#include <ostream>
+#include <streambuf>
+#include <vector>
+
+#define OUTPUT_SINK_BLOCK_SIZE  (16 * 1024)
+// buffered output is written out early once it reaches this size
+#define OUTPUT_SINK_HIGH_WATER  (1024 * 1024)
+// blocks kept for the next command after a flush
+#define OUTPUT_SINK_KEPT_BLOCKS (4)
+
+/*
+ * Collects builtin output in fixed-size blocks and writes it out with a single writev() when flushed, which
+ * the shell does once per command (and before forking, so children do not inherit buffered output). Lines
+ * must therefore end with '\n' rather than std::endl, which would flush every line. std::flush still works
+ * for output that has to appear right away.
+ */
+class OutputSink : public std::streambuf {
+    int fd;
+    std::vector<std::unique_ptr<char[]>> blocks;
+    // blocks in use; all but the last one are full
+    size_t used_blocks = 1;
+
+protected:
+    int_type overflow(int_type ch) override;
+
+    int sync() override;
+
+public:
+    explicit OutputSink(int fd);
+
+    ~OutputSink() override;
+
+    OutputSink(OutputSink const &) = delete;
+
+    void operator=(OutputSink const &) = delete;
+
+    // returns false with errno set if the output could not be written; it is dropped either way
+    bool flush();
+
+    size_t pending() const;
+
+    // the shell's own stdout and stderr; stderr flushes stdout first so that the two stay in order
+    static std::ostream &standard(int fd);
+
+    static void flushStandard();
+};
+
+#endif //SMASH_OUTPUT_SINK_H_
@@ -0,0 +1,96 @@
+#include "Plugin.h"
+#include "Commands.h"
+
+#include <dlfcn.h>
+#include <climits>
+#include <cstdlib>
+
+using namespace std;
+
+namespace {
+    // what a plugin registers during smash_plugin_init(), applied only if it succeeds
+    struct LoadContext {
+        struct Registration {
+            std::string name;
+            smash_builtin_fn fn;
+            void *data;
+        };
+
+        std::vector<Registration> registrations;
+    };
+}
+
+static int _registerBuiltin(void *context, const char *name, smash_builtin_fn fn, void *data) {
+    if (name == nullptr || fn == nullptr) {
+        return -1;
+    }
+    string command = name;
+    if (command.empty() || command.find_first_of(string(COMMAND_NAME_SPECIALS) + " \t\n") != string::npos) {
+        return -1;
+    }
+    static_cast<LoadContext *>(context)->registrations.push_back({command, fn, data});
+    return 0;
+}
+
+static long _getVar(void *, const char *name, char *buffer, unsigned long size) {
+    Environment &env = SmallShell::getInstance().getEnvironment();
+    if (name == nullptr || !env.isSet(name)) {
+        return -1;
+    }
+    string value = env.get(name);
+    if (buffer != nullptr && size > 0) {
+        size_t copied = min<size_t>(value.size(), size - 1);
+        memcpy(buffer, value.data(), copied);
+        buffer[copied] = '\0';
+    }
+    return (long) value.size();
+}
+
+bool PluginList::load(const std::string &path, std::string &error) {
+    char resolved[PATH_MAX];
+    string canonical = realpath(path.c_str(), resolved) != nullptr ? resolved : path;
+    for (auto &plugin: this->plugins) {
+        if (plugin.path == canonical) {
+            return true;
+        }
+    }
+    // a name without a slash would make dlopen() search the library path
+    string open_path = canonical.find('/') == string::npos ? "./" + canonical : canonical;
+    void *handle = dlopen(open_path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (handle == nullptr) {
+        error = dlerror();
+        return false;
+    }
+    auto *version = (const unsigned *) dlsym(handle, SMASH_PLUGIN_ABI_SYMBOL);
+    auto init = (smash_plugin_init_fn) dlsym(handle, SMASH_PLUGIN_INIT_SYMBOL);
+    if (version == nullptr || init == nullptr) {
+        error = path + ": not a smash plugin";
+        dlclose(handle);
+        return false;
+    }
+    if (*version != SMASH_PLUGIN_ABI_VERSION) {
+        error = path + ": plugin ABI version " + to_string(*version) + ", smash supports " +
+                to_string(SMASH_PLUGIN_ABI_VERSION);
+        dlclose(handle);
+        return false;
+    }
+    LoadContext context;
+    smash_plugin_host host{SMASH_PLUGIN_ABI_VERSION, &context, _registerBuiltin, _getVar};
+    if (init(&host) != 0) {
+        error = path + ": plugin initialization failed";
+        dlclose(handle);
+        return false;
+    }
+    Plugin plugin{canonical, handle, {}};
+    SmallShell &smash = SmallShell::getInstance();
+    for (auto &registration: context.registrations) {
+        smash_builtin_fn fn = registration.fn;
+        void *data = registration.data;
+        smash.registerBuiltin(registration.name, [fn, data](const char *cmd_line) -> std::unique_ptr<Command> {
+            return std::make_unique<PluginCommand>(cmd_line, fn, data);
+        });
+        plugin.commands.push_back(registration.name);
+    }
+    this->plugins.push_back(std::move(plugin));
+    return true;
+}
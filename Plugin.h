@@ -0,0 +1,40 @@
+#ifndef SMASH_PLUGIN_H_
+#define SMASH_PLUGIN_H_
+
+#include <string>
+#include <vector>
+#include "smash_plugin.h"
+
+/*
+ * Shared objects loaded with the load builtin. Each one is dlopen()ed once and never closed, since the
+ * commands it registered keep pointing into it; loading the same path again is a no-op.
+ */
+class PluginList {
+public:
+    struct Plugin {
+        std::string path;
+        void *handle;
+        std::vector<std::string> commands;
+    };
+
+private:
+    std::vector<Plugin> plugins;
+
+public:
+    PluginList() = default;
+
+    ~PluginList() = default;
+
+    PluginList(PluginList const &) = delete;
+
+    void operator=(PluginList const &) = delete;
+
+    // returns false with a message in error if the plugin could not be loaded or refused to
+    bool load(const std::string &path, std::string &error);
+
+    const std::vector<Plugin> &getPlugins() const {
+        return this->plugins;
+    }
+};
+
+#endif //SMASH_PLUGIN_H_
@@ -0,0 +1,93 @@
+#ifndef SMASH_POOL_H_
+#define SMASH_POOL_H_
+
+#include <cstddef>
+#include <new>
+#include <pthread.h>
+
+#define POOL_GRANULE            (32)
+#define POOL_SIZE_CLASSES       (32)
+#define POOL_MAX_CACHED_BLOCKS  (256)
+
+/*
+ * Recycles the small, short lived objects the shell creates for every command line (commands, job entries).
+ * Freed blocks are kept on a free list per 32-byte size class, up to POOL_MAX_CACHED_BLOCKS each, so that a
+ * steady stream of commands reuses the same memory instead of going back to malloc. Larger objects fall
+ * through to the global allocator.
+ *
+ * The free lists are not synchronized and belong to the thread that created the pool, the shell's main
+ * thread (in a forked child, the copy of it). Anything else, such as a builtin on a worker or a thread it
+ * starts, allocates from and frees to the global allocator; pooled blocks are sized to their class either
+ * way, so a block may be freed on another thread than the one that allocated it.
+ */
+class ObjectPool {
+    struct FreeBlock {
+        FreeBlock *next;
+    };
+
+    FreeBlock *free_lists[POOL_SIZE_CLASSES] = {};
+    size_t cached[POOL_SIZE_CLASSES] = {};
+    pthread_t owner;
+
+    ObjectPool() : owner(pthread_self()) {}
+
+    bool ownedByCaller() const {
+        return pthread_equal(pthread_self(), this->owner);
+    }
+
+    static size_t sizeClass(size_t size) {
+        return (size + POOL_GRANULE - 1) / POOL_GRANULE - 1;
+    }
+
+public:
+    ObjectPool(ObjectPool const &) = delete;
+
+    void operator=(ObjectPool const &) = delete;
+
+    // never destroyed, so objects released by other static destructors still have a pool to return to
+    static ObjectPool &getInstance() {
+        static ObjectPool *instance = new ObjectPool();
+        return *instance;
+    }
+
+    void *allocate(size_t size) {
+        if (size == 0 || sizeClass(size) >= POOL_SIZE_CLASSES) {
+            return ::operator new(size);
+        }
+        size_t index = sizeClass(size);
+        FreeBlock *block = ownedByCaller() ? this->free_lists[index] : nullptr;
+        if (block == nullptr) {
+            return ::operator new((index + 1) * POOL_GRANULE);
+        }
+        this->free_lists[index] = block->next;
+        this->cached[index]--;
+        return block;
+    }
+
+    void deallocate(void *ptr, size_t size) {
+        if (ptr == nullptr) {
+            return;
+        }
+        size_t index = sizeClass(size);
+        if (size == 0 || index >= POOL_SIZE_CLASSES || !ownedByCaller() ||
+            this->cached[index] >= POOL_MAX_CACHED_BLOCKS) {
+            ::operator delete(ptr);
+            return;
+        }
+        auto *block = static_cast<FreeBlock *>(ptr);
+        block->next = this->free_lists[index];
+        this->free_lists[index] = block;
+        this->cached[index]++;
+    }
+};
+
+// gives a class hierarchy pooled operator new/delete; the hierarchy needs a virtual destructor
+#define POOL_ALLOCATED()                                            \
+    static void *operator new(size_t size) {                        \
+        return ObjectPool::getInstance().allocate(size);            \
+    }                                                               \
+    static void operator delete(void *ptr, size_t size) {           \
+        ObjectPool::getInstance().deallocate(ptr, size);            \
+    }
+
+#endif //SMASH_POOL_H_
@@ -0,0 +1,134 @@
+#include "ProcStats.h"
+
+#include <unordered_set>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <cstring>
+#include <cstdlib>
+#include <ctime>
+#include <cerrno>
+
+using namespace std;
+
+static double _monotonicSeconds() {
+    timespec now{};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+ProcSampler::~ProcSampler() {
+    for (auto &entry: this->handles) {
+        closeHandle(entry.second);
+    }
+}
+
+ProcSampler::ProcSampler() {
+    rlimit limit{};
+    if (getrlimit(RLIMIT_NOFILE, &limit) == -1 || limit.rlim_cur == RLIM_INFINITY) {
+        this->fd_budget = PROC_UNLIMITED_FDS;
+    } else {
+        this->fd_budget = limit.rlim_cur > PROC_RESERVED_FDS ? limit.rlim_cur - PROC_RESERVED_FDS : 0;
+    }
+}
+
+void ProcSampler::closeHandle(Handle &handle) {
+    for (int *fd: {&handle.stat_fd, &handle.statm_fd, &handle.io_fd}) {
+        if (*fd >= 0) {
+            close(*fd);
+            this->cached_fds--;
+        }
+        *fd = -1;
+    }
+}
+
+// reads a /proc/<pid>/<name> file through a cached descriptor; once the descriptor budget is used up
+// the file is opened just for this read
+bool ProcSampler::readFile(int &fd, pid_t pid, const char *name, char *buffer, size_t size) {
+    bool transient = false;
+    if (fd < 0) {
+        string path = "/proc/" + to_string(pid) + "/" + name;
+        fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            return false;
+        }
+        transient = this->cached_fds >= this->fd_budget;
+        if (!transient) {
+            this->cached_fds++;
+        }
+    }
+    ssize_t res = pread(fd, buffer, size - 1, 0);
+    if (transient) {
+        close(fd);
+        fd = -1;
+    }
+    if (res <= 0) {
+        return false;
+    }
+    buffer[res] = '\0';
+    return true;
+}
+
+bool ProcSampler::sample(pid_t pid, ProcSample &current, ProcSample &previous, bool &has_previous) {
+    Handle &handle = this->handles[pid];
+    char buffer[PROC_READ_BUFFER_SIZE];
+    if (!readFile(handle.stat_fd, pid, "stat", buffer, sizeof buffer)) {
+        closeHandle(handle);
+        this->handles.erase(pid);
+        return false;
+    }
+    current = ProcSample();
+    current.taken_at = _monotonicSeconds();
+    // the command name may contain spaces and parentheses, fields are counted from the last ')'
+    char *fields = strrchr(buffer, ')');
+    if (fields == nullptr) {
+        return false;
+    }
+    fields += 2;
+    current.state = fields[0];
+    char *cursor = fields;
+    // state is field 3 of the file, utime and stime are fields 14 and 15
+    for (int field = 3; field < 14 && cursor != nullptr; field++) {
+        cursor = strchr(cursor, ' ');
+        if (cursor != nullptr) {
+            cursor++;
+        }
+    }
+    if (cursor != nullptr) {
+        char *end;
+        unsigned long long utime = strtoull(cursor, &end, 10);
+        unsigned long long stime = strtoull(end, nullptr, 10);
+        current.cpu_ticks = utime + stime;
+    }
+    if (readFile(handle.statm_fd, pid, "statm", buffer, sizeof buffer)) {
+        char *end;
+        strtol(buffer, &end, 10);
+        current.rss_pages = strtol(end, nullptr, 10);
+    }
+    if (readFile(handle.io_fd, pid, "io", buffer, sizeof buffer)) {
+        char *rchar = strstr(buffer, "rchar: ");
+        char *wchar = strstr(buffer, "wchar: ");
+        if (rchar != nullptr && wchar != nullptr) {
+            current.read_bytes = strtoull(rchar + 7, nullptr, 10);
+            current.write_bytes = strtoull(wchar + 7, nullptr, 10);
+            current.has_io = true;
+        }
+    }
+    has_previous = handle.has_last;
+    previous = handle.last;
+    handle.last = current;
+    handle.has_last = true;
+    return true;
+}
+
+void ProcSampler::prune(const std::vector<pid_t> &alive) {
+    std::unordered_set<pid_t> keep(alive.begin(), alive.end());
+    for (auto iter = this->handles.begin(); iter != this->handles.end();) {
+        if (keep.find(iter->first) == keep.end()) {
+            closeHandle(iter->second);
+            iter = this->handles.erase(iter);
+        } else {
+            iter++;
+        }
+    }
+}
@@ -0,0 +1,64 @@
+#ifndef SMASH_PROC_STATS_H_
+#define SMASH_PROC_STATS_H_
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <sys/types.h>
+
+#define PROC_READ_BUFFER_SIZE   (1024)
+// descriptors left for everything else the shell opens
+#define PROC_RESERVED_FDS       (128)
+// descriptors kept when RLIMIT_NOFILE is unlimited (or cannot be read)
+#define PROC_UNLIMITED_FDS      (4096)
+
+struct ProcSample {
+    char state = '?';
+    unsigned long long cpu_ticks = 0;
+    long rss_pages = 0;
+    unsigned long long read_bytes = 0;
+    unsigned long long write_bytes = 0;
+    bool has_io = false;
+    double taken_at = 0;
+};
+
+/*
+ * Samples /proc for a known set of pids (the shell's jobs) instead of scanning every process.
+ * The stat, statm and io files of each pid are opened once and re-read with pread(), so a sample
+ * costs three syscalls per pid. Only as many descriptors are kept as RLIMIT_NOFILE leaves room for;
+ * beyond that files are opened per read. Descriptors of pids that are no longer sampled are closed by prune().
+ */
+class ProcSampler {
+    struct Handle {
+        int stat_fd = -1;
+        int statm_fd = -1;
+        int io_fd = -1;
+        ProcSample last;
+        bool has_last = false;
+    };
+
+    std::unordered_map<pid_t, Handle> handles;
+    size_t cached_fds = 0;
+    size_t fd_budget = 0;
+
+    bool readFile(int &fd, pid_t pid, const char *name, char *buffer, size_t size);
+
+    void closeHandle(Handle &handle);
+
+public:
+    ProcSampler();
+
+    ~ProcSampler();
+
+    ProcSampler(ProcSampler const &) = delete;
+
+    void operator=(ProcSampler const &) = delete;
+
+    // takes a new sample and hands back the previous one (if any); returns false if the pid is gone
+    bool sample(pid_t pid, ProcSample &current, ProcSample &previous, bool &has_previous);
+
+    // closes the descriptors of every pid not in alive
+    void prune(const std::vector<pid_t> &alive);
+};
+
+#endif //SMASH_PROC_STATS_H_
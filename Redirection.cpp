@@ -0,0 +1,246 @@
+#include "Redirection.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+using namespace std;
+
+Redirections::~Redirections() {
+    close();
+}
+
+Redirections &Redirections::operator=(Redirections &&other) noexcept {
+    if (this != &other) {
+        close();
+        this->entries = std::move(other.entries);
+        this->opened = std::move(other.opened);
+        other.opened.clear();
+        for (int fd = 0; fd < REDIRECT_FDS; fd++) {
+            this->fds[fd] = other.fds[fd];
+            this->sinks[fd] = std::move(other.sinks[fd]);
+            this->streams[fd] = std::move(other.streams[fd]);
+        }
+        this->detached = other.detached;
+    }
+    return *this;
+}
+
+static bool _endsWord(char c) {
+    return isspace(c) || strchr("<>|;&", c) != nullptr;
+}
+
+// reads a file name starting at pos, removing quotes and backslashes
+static std::string _readWord(const std::string &line, size_t &pos) {
+    std::string word;
+    char quote = 0;
+    for (; pos < line.size(); pos++) {
+        char c = line[pos];
+        if (quote != 0) {
+            if (c == quote) {
+                quote = 0;
+            } else if (c == '\\' && quote == '"' && pos + 1 < line.size()) {
+                word += line[++pos];
+            } else {
+                word += c;
+            }
+        } else if (c == '\'' || c == '"') {
+            quote = c;
+        } else if (c == '\\' && pos + 1 < line.size()) {
+            word += line[++pos];
+        } else if (_endsWord(c)) {
+            break;
+        } else {
+            word += c;
+        }
+    }
+    return word;
+}
+
+bool Redirections::parse(const std::string &cmd_line, std::string &stripped, Redirections &redirections,
+                         std::string &bad_token) {
+    stripped.clear();
+    char quote = 0;
+    int depth = 0;
+    size_t pos = 0;
+    while (pos < cmd_line.size()) {
+        char c = cmd_line[pos];
+        if (quote != 0 || c == '\\') {
+            if (c == '\\' && pos + 1 < cmd_line.size()) {
+                stripped += c;
+                c = cmd_line[++pos];
+            } else if (c == quote) {
+                quote = 0;
+            }
+            stripped += c;
+            pos++;
+            continue;
+        }
+        if (c == '\'' || c == '"' || c == '`') {
+            quote = c;
+        } else if (c == '(') {
+            depth++;
+        } else if (c == ')' && depth > 0) {
+            depth--;
+        }
+        // anything inside $(...) or a subshell is left to bash
+        size_t op = pos;
+        bool both = false;
+        int target = -1;
+        if (depth == 0 && (pos == 0 || isspace(cmd_line[pos - 1])) && c >= '0' && c < '0' + REDIRECT_FDS &&
+            pos + 1 < cmd_line.size() && (cmd_line[pos + 1] == '<' || cmd_line[pos + 1] == '>')) {
+            target = c - '0';
+            op++;
+        } else if (depth == 0 && c == '&' && pos + 1 < cmd_line.size() && cmd_line[pos + 1] == '>') {
+            both = true;
+            op++;
+        }
+        if (depth > 0 || quote != 0 || (cmd_line[op] != '<' && cmd_line[op] != '>')) {
+            stripped += c;
+            pos++;
+            continue;
+        }
+        char direction = cmd_line[op++];
+        if (direction == '<' && op < cmd_line.size() && cmd_line[op] == '<') {
+            // here-documents are not supported, the line goes to bash as it is
+            stripped += cmd_line.substr(pos, op + 1 - pos);
+            pos = op + 1;
+            continue;
+        }
+        if (target == -1) {
+            target = direction == '<' ? 0 : 1;
+        }
+        int flags = direction == '<' ? O_RDONLY : (O_WRONLY | O_CREAT | O_TRUNC);
+        if (direction == '>' && op < cmd_line.size() && cmd_line[op] == '>') {
+            flags = O_WRONLY | O_CREAT | O_APPEND;
+            op++;
+        } else if (!both && op + 1 < cmd_line.size() && cmd_line[op] == '&' && isdigit(cmd_line[op + 1]) &&
+                   (op + 2 == cmd_line.size() || _endsWord(cmd_line[op + 2]))) {
+            int source = cmd_line[op + 1] - '0';
+            if (source >= REDIRECT_FDS) {
+                bad_token = cmd_line.substr(op + 1, 1);
+                return false;
+            }
+            redirections.entries.push_back({target, source, "", 0});
+            stripped += ' ';
+            pos = op + 2;
+            continue;
+        }
+        while (op < cmd_line.size() && isspace(cmd_line[op])) {
+            op++;
+        }
+        std::string file = _readWord(cmd_line, op);
+        if (file.empty()) {
+            bad_token = op < cmd_line.size() ? cmd_line.substr(op, 1) : "newline";
+            return false;
+        }
+        redirections.entries.push_back({target, -1, file, flags});
+        if (both) {
+            redirections.entries.push_back({STDERR_FILENO, STDOUT_FILENO, "", 0});
+        }
+        stripped += ' ';
+        pos = op;
+    }
+    return true;
+}
+
+bool Redirections::open() {
+    for (auto &entry: this->entries) {
+        int fd;
+        if (entry.source == -1) {
+            fd = ::open(entry.file.c_str(), entry.flags | O_CLOEXEC, 0666);
+            if (fd == -1) {
+                return false;
+            }
+            this->opened.push_back(fd);
+        } else {
+            fd = this->fds[entry.source];
+            // a copy of one of the shell's own descriptors, so that apply() can dup2() in any order
+            if (fd < REDIRECT_FDS && fd != entry.target) {
+                fd = fcntl(fd, F_DUPFD_CLOEXEC, REDIRECT_FDS);
+                if (fd == -1) {
+                    return false;
+                }
+                this->opened.push_back(fd);
+            }
+        }
+        this->fds[entry.target] = fd;
+    }
+    return true;
+}
+
+void Redirections::apply() const {
+    for (int fd = 0; fd < REDIRECT_FDS; fd++) {
+        if (this->fds[fd] != fd) {
+            dup2(this->fds[fd], fd);
+        }
+    }
+}
+
+void Redirections::close() {
+    for (int fd = 0; fd < REDIRECT_FDS; fd++) {
+        this->streams[fd].reset();
+        this->sinks[fd].reset();
+        this->fds[fd] = fd;
+    }
+    for (int fd: this->opened) {
+        ::close(fd);
+    }
+    this->opened.clear();
+    this->detached = false;
+}
+
+bool Redirections::attach(int target, int fd) {
+    if (this->fds[target] != target) {
+        return false;
+    }
+    this->fds[target] = fd;
+    this->opened.push_back(fd);
+    return true;
+}
+
+bool Redirections::detach() {
+    for (int fd = 0; fd < REDIRECT_FDS; fd++) {
+        if (this->fds[fd] != fd) {
+            continue;
+        }
+        int copy = fcntl(fd, F_DUPFD_CLOEXEC, REDIRECT_FDS);
+        // a descriptor the shell does not have stays closed for the command too
+        if (copy == -1 && errno == EBADF) {
+            continue;
+        }
+        if (copy == -1) {
+            return false;
+        }
+        this->fds[fd] = copy;
+        this->opened.push_back(copy);
+    }
+    this->detached = true;
+    return true;
+}
+
+std::ostream &Redirections::stream(int fd) {
+    if (this->fds[fd] == STDOUT_FILENO || this->fds[fd] == STDERR_FILENO) {
+        return OutputSink::standard(this->fds[fd]);
+    }
+    if (this->streams[fd] == nullptr) {
+        this->sinks[fd] = std::make_unique<OutputSink>(this->fds[fd]);
+        this->streams[fd] = std::make_unique<std::ostream>(this->sinks[fd].get());
+        if (fd == STDERR_FILENO) {
+            this->streams[fd]->tie(&stream(STDOUT_FILENO));
+        }
+    }
+    return *this->streams[fd];
+}
+
+void Redirections::flush() {
+    for (auto &stream: this->streams) {
+        if (stream != nullptr) {
+            stream->flush();
+        }
+    }
+    if (!this->detached) {
+        OutputSink::flushStandard();
+    }
+}
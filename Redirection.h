@@ -0,0 +1,86 @@
+#ifndef SMASH_REDIRECTION_H_
+#define SMASH_REDIRECTION_H_
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <ostream>
+#include "OutputSink.h"
+
+// stdin, stdout and stderr; redirections of other descriptors are not supported
+#define REDIRECT_FDS    (3)
+
+/*
+ * The redirections of a single command: <, >, >>, N<, N>, N>>, N>&M, &> and &>>, applied left to right.
+ * open() opens every file with O_CLOEXEC in the shell and resolves the final descriptor of stdin, stdout and
+ * stderr without touching the shell's own descriptors. Builtins read and write through get()/stream();
+ * forked commands call apply() in the child, which dup2()s them into place right before exec.
+ */
+class Redirections {
+    struct Entry {
+        int target;
+        // -1 when the target is a file
+        int source;
+        std::string file;
+        int flags;
+    };
+
+    std::vector<Entry> entries;
+    int fds[REDIRECT_FDS] = {0, 1, 2};
+    std::vector<int> opened;
+    std::unique_ptr<OutputSink> sinks[REDIRECT_FDS];
+    std::unique_ptr<std::ostream> streams[REDIRECT_FDS];
+    // set once the command has private descriptors and must not touch the shell's standard sinks
+    bool detached = false;
+
+public:
+    Redirections() = default;
+
+    ~Redirections();
+
+    Redirections(Redirections &&) = default;
+
+    Redirections &operator=(Redirections &&other) noexcept;
+
+    Redirections(Redirections const &) = delete;
+
+    void operator=(Redirections const &) = delete;
+
+    // moves the redirections of cmd_line into redirections and the rest of the line into stripped;
+    // returns false on a syntax error, with the offending token in bad_token
+    static bool parse(const std::string &cmd_line, std::string &stripped, Redirections &redirections,
+                      std::string &bad_token);
+
+    bool empty() const {
+        return this->entries.empty();
+    }
+
+    // returns false with errno set if a file could not be opened
+    bool open();
+
+    // child side, before exec
+    void apply() const;
+
+    void close();
+
+    // makes fd, which is then owned here, the command's target descriptor unless target was redirected
+    // already; returns false, leaving fd to the caller, if it was
+    bool attach(int target, int fd);
+
+    // for a command about to run on another thread: stdin, stdout and stderr that still refer to the shell's
+    // own descriptors are replaced by private copies, so that the command's output is buffered and written
+    // separately from the shell's; returns false with errno set if a descriptor could not be copied
+    bool detach();
+
+    int get(int fd) const {
+        return this->fds[fd];
+    }
+
+    // the shell's standard sink unless stdout/stderr (fd) was redirected
+    std::ostream &stream(int fd);
+
+    // writes out whatever the command printed so far
+    void flush();
+};
+
+#endif //SMASH_REDIRECTION_H_
@@ -0,0 +1,554 @@
+#include "Sort.h"
+#include "Worker.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <system_error>
+#include <thread>
+
+using namespace std;
+
+bool LineReader::next(const char *&line, size_t &len, bool &failed) {
+    failed = false;
+    while (true) {
+        if (this->pos < this->filled) {
+            char *start = this->buffer.data() + this->pos;
+            auto newline = (char *) memchr(start, '\n', this->filled - this->pos);
+            if (newline != nullptr) {
+                line = start;
+                len = newline - start;
+                this->pos += len + 1;
+                return true;
+            }
+        }
+        if (this->eof) {
+            if (this->pos == this->filled) {
+                return false;
+            }
+            line = this->buffer.data() + this->pos;
+            len = this->filled - this->pos;
+            this->pos = this->filled;
+            return true;
+        }
+        // keeps the partial line and reads the rest of it behind
+        if (this->pos > 0) {
+            memmove(this->buffer.data(), this->buffer.data() + this->pos, this->filled - this->pos);
+            this->filled -= this->pos;
+            this->pos = 0;
+        }
+        if (this->filled == this->buffer.size()) {
+            this->buffer.resize(this->buffer.size() * 2);
+        }
+        ssize_t res = read(this->fd, this->buffer.data() + this->filled, this->buffer.size() - this->filled);
+        if (res == -1 && errno == EINTR && !WorkerPool::cancelRequested()) {
+            continue;
+        }
+        if (res == -1) {
+            failed = true;
+            return false;
+        }
+        if (res == 0) {
+            this->eof = true;
+        }
+        this->filled += res;
+    }
+}
+
+void LineWriter::write(const char *data, size_t len) {
+    while (len > 0 && !this->failed) {
+        if (this->used == this->buffer.size()) {
+            flush();
+        }
+        size_t part = std::min(len, this->buffer.size() - this->used);
+        memcpy(this->buffer.data() + this->used, data, part);
+        this->used += part;
+        data += part;
+        len -= part;
+    }
+}
+
+bool LineWriter::flush() {
+    if (!this->failed && WorkerPool::cancelRequested()) {
+        this->failed = true;
+        this->error = ECANCELED;
+    }
+    size_t done = 0;
+    while (!this->failed && done < this->used) {
+        ssize_t res = ::write(this->fd, this->buffer.data() + done, this->used - done);
+        if (res == -1 && errno == EINTR && !WorkerPool::cancelRequested()) {
+            continue;
+        }
+        if (res == -1) {
+            this->failed = true;
+            this->error = errno;
+            break;
+        }
+        done += res;
+    }
+    this->used = 0;
+    if (this->failed) {
+        errno = this->error;
+    }
+    return !this->failed;
+}
+
+// a sorted run in a temporary file, read back through reader once it is merged
+struct ExternalSort::Run {
+    int fd;
+    std::unique_ptr<LineReader> reader;
+
+    explicit Run(int fd) : fd(fd) {}
+
+    ~Run() {
+        close(this->fd);
+    }
+};
+
+// the next line of a run, or of a sorted part of the chunk in memory
+struct ExternalSort::Cursor {
+    SortLine line{};
+    const SortLine *next = nullptr;
+    const SortLine *end = nullptr;
+    Run *run = nullptr;
+
+    // false once the source is used up, with failed set if a run could not be read
+    bool advance(const SortOptions &options, bool &failed) {
+        failed = false;
+        if (this->run == nullptr) {
+            if (this->next == this->end) {
+                return false;
+            }
+            this->line = *this->next++;
+            return true;
+        }
+        const char *data;
+        size_t len;
+        if (!this->run->reader->next(data, len, failed)) {
+            return false;
+        }
+        this->line.data = data;
+        this->line.len = (uint32_t) len;
+        ExternalSort::setKey(options, this->line);
+        return true;
+    }
+};
+
+static bool _isBlank(char c) {
+    return c == ' ' || c == '\t';
+}
+
+// where the field starting at pos ends: at the next separator, or after the blanks and then the non-blanks
+static size_t _fieldEnd(const SortOptions &options, const char *data, size_t len, size_t pos) {
+    if (options.separator != -1) {
+        auto separator = (const char *) memchr(data + pos, options.separator, len - pos);
+        return separator == nullptr ? len : separator - data;
+    }
+    while (pos < len && _isBlank(data[pos])) {
+        pos++;
+    }
+    while (pos < len && !_isBlank(data[pos])) {
+        pos++;
+    }
+    return pos;
+}
+
+static size_t _fieldStart(const SortOptions &options, const char *data, size_t len, int field) {
+    size_t pos = 0;
+    for (int i = 1; i < field && pos < len; i++) {
+        pos = _fieldEnd(options, data, len, pos);
+        if (options.separator != -1 && pos < len) {
+            pos++;
+        }
+    }
+    return pos;
+}
+
+void ExternalSort::setKey(const SortOptions &options, SortLine &line) {
+    size_t start = 0, end = line.len;
+    if (options.key_first > 0) {
+        start = _fieldStart(options, line.data, line.len, options.key_first);
+    }
+    if (options.key_last > 0) {
+        end = _fieldEnd(options, line.data, line.len, _fieldStart(options, line.data, line.len, options.key_last));
+    }
+    end = std::max(start, end);
+    line.key_start = (uint32_t) start;
+    line.key_len = (uint32_t) (end - start);
+    // big-endian, so that comparing prefixes compares the bytes in order
+    line.prefix = 0;
+    if (!options.numeric) {
+        const char *key = line.data + start;
+        for (size_t i = 0; i < 8; i++) {
+            unsigned char c = i < line.key_len ? key[i] : 0;
+            line.prefix = line.prefix << 8 | (options.ignore_case ? toupper(c) : c);
+        }
+    }
+}
+
+static int _compareBytes(const char *a, size_t a_len, const char *b, size_t b_len) {
+    int result = memcmp(a, b, std::min(a_len, b_len));
+    if (result != 0) {
+        return result;
+    }
+    return a_len < b_len ? -1 : a_len > b_len;
+}
+
+static int _compareFolded(const char *a, size_t a_len, const char *b, size_t b_len) {
+    size_t len = std::min(a_len, b_len);
+    for (size_t i = 0; i < len; i++) {
+        int result = toupper((unsigned char) a[i]) - toupper((unsigned char) b[i]);
+        if (result != 0) {
+            return result;
+        }
+    }
+    return a_len < b_len ? -1 : a_len > b_len;
+}
+
+namespace {
+    // a number as sort -n reads it: leading blanks, an optional minus, digits and a fraction, nothing else
+    struct SortNumber {
+        bool negative = false;
+        // without leading zeros, and the fraction without trailing zeros
+        const char *digits = nullptr;
+        size_t digits_len = 0;
+        const char *fraction = nullptr;
+        size_t fraction_len = 0;
+
+        SortNumber(const char *text, size_t len) {
+            size_t i = 0;
+            while (i < len && _isBlank(text[i])) {
+                i++;
+            }
+            if (i < len && text[i] == '-') {
+                this->negative = true;
+                i++;
+            }
+            while (i < len && text[i] == '0') {
+                i++;
+            }
+            this->digits = text + i;
+            while (i < len && isdigit((unsigned char) text[i])) {
+                i++;
+            }
+            this->digits_len = text + i - this->digits;
+            this->fraction = text + i;
+            if (i < len && text[i] == '.') {
+                this->fraction = text + ++i;
+                while (i < len && isdigit((unsigned char) text[i])) {
+                    i++;
+                }
+                this->fraction_len = text + i - this->fraction;
+                while (this->fraction_len > 0 && this->fraction[this->fraction_len - 1] == '0') {
+                    this->fraction_len--;
+                }
+            }
+            // -0 is 0, and so is anything that is not a number
+            if (this->digits_len == 0 && this->fraction_len == 0) {
+                this->negative = false;
+            }
+        }
+    };
+}
+
+// compares the digits themselves, so that numbers of any length order exactly
+static int _compareNumbers(const char *a, size_t a_len, const char *b, size_t b_len) {
+    SortNumber x(a, a_len), y(b, b_len);
+    if (x.negative != y.negative) {
+        return x.negative ? -1 : 1;
+    }
+    int result;
+    if (x.digits_len != y.digits_len) {
+        result = x.digits_len < y.digits_len ? -1 : 1;
+    } else {
+        result = memcmp(x.digits, y.digits, x.digits_len);
+        if (result == 0) {
+            result = _compareBytes(x.fraction, x.fraction_len, y.fraction, y.fraction_len);
+        }
+    }
+    return x.negative ? -result : result;
+}
+
+int ExternalSort::compare(const SortOptions &options, const SortLine &a, const SortLine &b) {
+    const char *a_key = a.data + a.key_start, *b_key = b.data + b.key_start;
+    int result;
+    if (options.numeric) {
+        result = _compareNumbers(a_key, a.key_len, b_key, b.key_len);
+    } else if (a.prefix != b.prefix) {
+        result = a.prefix < b.prefix ? -1 : 1;
+    } else if (options.ignore_case) {
+        result = _compareFolded(a_key, a.key_len, b_key, b.key_len);
+    } else if (a.key_len >= 8 && b.key_len >= 8) {
+        // equal prefixes are the keys' first 8 bytes
+        result = _compareBytes(a_key + 8, a.key_len - 8, b_key + 8, b.key_len - 8);
+    } else {
+        result = _compareBytes(a_key, a.key_len, b_key, b.key_len);
+    }
+    // the last resort of GNU sort, which -u goes without so that lines with equal keys are duplicates. Lines
+    // whose whole bytes were the key are equal already
+    bool whole_line = options.key_first == 0 && !options.numeric && !options.ignore_case;
+    if (result == 0 && !options.unique && !whole_line) {
+        result = _compareBytes(a.data, a.len, b.data, b.len);
+    }
+    return options.reverse ? -result : result;
+}
+
+ExternalSort::ExternalSort(const SortOptions &options) : options(options) {
+    if (this->options.threads == 0) {
+        this->options.threads = std::max(1U, std::thread::hardware_concurrency());
+    }
+    this->options.threads = std::min<unsigned>(this->options.threads, SORT_MAX_THREADS);
+    this->options.buffer_size = std::max<size_t>(this->options.buffer_size, SORT_MIN_BUFFER);
+}
+
+ExternalSort::~ExternalSort() = default;
+
+void ExternalSort::addLine(const char *line, size_t len) {
+    SortLine sort_line{line, 0, (uint32_t) len, 0, 0};
+    setKey(this->options, sort_line);
+    this->lines.push_back(sort_line);
+}
+
+void ExternalSort::sortChunk() {
+    this->parts.clear();
+    size_t count = this->lines.size();
+    size_t num_parts = std::max<size_t>(1, std::min<size_t>(this->options.threads, count / SORT_MIN_PART_LINES));
+    for (size_t i = 0; i < num_parts; i++) {
+        this->parts.emplace_back(count * i / num_parts, count * (i + 1) / num_parts);
+    }
+    const SortOptions &options = this->options;
+    atomic<size_t> next{0};
+    auto worker = [this, &options, &next]() {
+        auto less = [&options](const SortLine &a, const SortLine &b) {
+            // most pairs differ in their prefixes, which is decided here without the call
+            if (!options.numeric && a.prefix != b.prefix) {
+                return (a.prefix < b.prefix) != options.reverse;
+            }
+            return compare(options, a, b) < 0;
+        };
+        for (size_t i = next++; i < this->parts.size(); i = next++) {
+            auto begin = this->lines.begin() + this->parts[i].first, end = this->lines.begin() + this->parts[i].second;
+            // with -u the line kept of those with equal keys is the first one read
+            if (options.unique) {
+                std::stable_sort(begin, end, less);
+            } else {
+                std::sort(begin, end, less);
+            }
+        }
+    };
+    vector<thread> pool;
+    // the calling thread sorts a part as well
+    for (size_t i = 1; i < num_parts; i++) {
+        try {
+            pool.emplace_back(worker);
+        } catch (const system_error &) {
+            // fewer threads only make it slower
+            break;
+        }
+    }
+    worker();
+    for (auto &t: pool) {
+        t.join();
+    }
+}
+
+bool ExternalSort::merge(std::vector<Cursor> &cursors, LineWriter &writer) const {
+    const SortOptions &options = this->options;
+    bool failed;
+    // a heap of the cursors that still have a line, smallest line on top
+    vector<Cursor *> heap;
+    for (auto &cursor: cursors) {
+        if (cursor.advance(options, failed)) {
+            heap.push_back(&cursor);
+        } else if (failed) {
+            return false;
+        }
+    }
+    // the cursors are in input order, which decides between equal lines
+    auto greater = [&options](const Cursor *a, const Cursor *b) {
+        int result = compare(options, a->line, b->line);
+        return result != 0 ? result > 0 : a > b;
+    };
+    std::make_heap(heap.begin(), heap.end(), greater);
+    // with -u, the line written last, copied since its buffer moves on
+    string last_text;
+    SortLine last{};
+    bool have_last = false;
+    while (!heap.empty() && writer.good()) {
+        std::pop_heap(heap.begin(), heap.end(), greater);
+        Cursor *cursor = heap.back();
+        const SortLine &line = cursor->line;
+        if (!options.unique || !have_last || compare(options, last, line) != 0) {
+            writer.writeLine(line.data, line.len);
+            if (options.unique) {
+                last_text.assign(line.data, line.len);
+                last = line;
+                last.data = last_text.data();
+                have_last = true;
+            }
+        }
+        if (cursor->advance(options, failed)) {
+            std::push_heap(heap.begin(), heap.end(), greater);
+        } else if (failed) {
+            return false;
+        } else {
+            heap.pop_back();
+        }
+    }
+    return writer.flush();
+}
+
+// an empty temporary file for a run, or -1 with errno set
+static int _createRun(const std::string &temp_dir) {
+    string path = temp_dir + "/smash-sort.XXXXXX";
+    int fd = mkostemp(&path[0], O_CLOEXEC);
+    if (fd != -1) {
+        // nothing is left behind, however the sort ends
+        unlink(path.c_str());
+    }
+    return fd;
+}
+
+bool ExternalSort::spill() {
+    int fd = _createRun(this->options.temp_dir);
+    if (fd == -1) {
+        return false;
+    }
+    auto run = std::make_unique<Run>(fd);
+    sortChunk();
+    vector<Cursor> cursors(this->parts.size());
+    for (size_t i = 0; i < this->parts.size(); i++) {
+        cursors[i].next = this->lines.data() + this->parts[i].first;
+        cursors[i].end = this->lines.data() + this->parts[i].second;
+    }
+    LineWriter writer(fd);
+    if (!merge(cursors, writer) || lseek(fd, 0, SEEK_SET) == -1) {
+        return false;
+    }
+    this->runs.push_back(std::move(run));
+    this->lines.clear();
+    // the line being read moves to the front of the chunk
+    memmove(this->text.get(), this->text.get() + this->line_start, this->text_used - this->line_start);
+    this->text_used -= this->line_start;
+    this->line_start = 0;
+    return true;
+}
+
+bool ExternalSort::mergeRuns(size_t first, size_t count) {
+    int fd = _createRun(this->options.temp_dir);
+    if (fd == -1) {
+        return false;
+    }
+    auto run = std::make_unique<Run>(fd);
+    vector<Cursor> cursors(count);
+    for (size_t i = 0; i < count; i++) {
+        cursors[i].run = this->runs[first + i].get();
+        cursors[i].run->reader = std::make_unique<LineReader>(cursors[i].run->fd);
+    }
+    LineWriter writer(fd);
+    if (!merge(cursors, writer) || lseek(fd, 0, SEEK_SET) == -1) {
+        return false;
+    }
+    this->runs.erase(this->runs.begin() + first + 1, this->runs.begin() + first + count);
+    this->runs[first] = std::move(run);
+    return true;
+}
+
+// spills the chunk when it is full, or grows it when all of it is a single line
+bool ExternalSort::makeRoom() {
+    if (!this->lines.empty()) {
+        return spill();
+    }
+    size_t size = this->text_size * 2;
+    std::unique_ptr<char[]> text(new(std::nothrow) char[size]);
+    if (text == nullptr) {
+        errno = ENOMEM;
+        return false;
+    }
+    memcpy(text.get(), this->text.get(), this->text_used);
+    this->text = std::move(text);
+    this->text_size = size;
+    return true;
+}
+
+bool ExternalSort::add(int fd) {
+    if (this->text == nullptr) {
+        // untouched pages cost nothing, so a small input only uses what it needs of the budget
+        this->text.reset(new(std::nothrow) char[this->options.buffer_size]);
+        if (this->text == nullptr) {
+            errno = ENOMEM;
+            return false;
+        }
+        this->text_size = this->options.buffer_size;
+    }
+    while (true) {
+        if (WorkerPool::cancelRequested()) {
+            errno = ECANCELED;
+            return false;
+        }
+        bool full = this->text_used == this->text_size ||
+                    (!this->lines.empty() &&
+                     this->text_used + this->lines.size() * sizeof(SortLine) >= this->options.buffer_size);
+        if (full && !makeRoom()) {
+            return false;
+        }
+        char *text = this->text.get();
+        size_t len = std::min<size_t>(SORT_READ_BLOCK, this->text_size - this->text_used);
+        ssize_t res = read(fd, text + this->text_used, len);
+        if (res == -1 && errno == EINTR) {
+            continue;
+        }
+        if (res == -1) {
+            return false;
+        }
+        if (res == 0) {
+            break;
+        }
+        size_t scanned = this->text_used;
+        this->text_used += res;
+        while (auto newline = (char *) memchr(text + scanned, '\n', this->text_used - scanned)) {
+            addLine(text + this->line_start, newline - text - this->line_start);
+            this->line_start = scanned = newline - text + 1;
+        }
+    }
+    // a last line without a newline ends with its file
+    if (this->line_start < this->text_used) {
+        addLine(this->text.get() + this->line_start, this->text_used - this->line_start);
+        this->line_start = this->text_used;
+    }
+    return true;
+}
+
+bool ExternalSort::finish(int out_fd) {
+    sortChunk();
+    // each pass merges consecutive runs into one, which keeps them in input order
+    while (this->runs.size() > SORT_MERGE_FANIN) {
+        for (size_t first = 0; first < this->runs.size(); first++) {
+            if (WorkerPool::cancelRequested()) {
+                errno = ECANCELED;
+                return false;
+            }
+            size_t count = std::min<size_t>(SORT_MERGE_FANIN, this->runs.size() - first);
+            if (count > 1 && !mergeRuns(first, count)) {
+                return false;
+            }
+        }
+    }
+    vector<Cursor> cursors(this->runs.size() + this->parts.size());
+    for (size_t i = 0; i < this->runs.size(); i++) {
+        cursors[i].run = this->runs[i].get();
+        cursors[i].run->reader = std::make_unique<LineReader>(cursors[i].run->fd);
+    }
+    for (size_t i = 0; i < this->parts.size(); i++) {
+        Cursor &cursor = cursors[this->runs.size() + i];
+        cursor.next = this->lines.data() + this->parts[i].first;
+        cursor.end = this->lines.data() + this->parts[i].second;
+    }
+    LineWriter writer(out_fd);
+    return merge(cursors, writer);
+}
@@ -0,0 +1,152 @@
+#ifndef SMASH_SORT_H_
+#define SMASH_SORT_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+// memory for the lines held at once, text and index together, unless sort is given -S
+#define SORT_DEFAULT_BUFFER     (256 * 1024 * 1024)
+#define SORT_MIN_BUFFER         (64 * 1024)
+#define SORT_READ_BLOCK         (1024 * 1024)
+// the read buffer of each run during a merge, and the write buffer of sort and uniq
+#define SORT_IO_BUFFER          (256 * 1024)
+// runs merged at once; more are merged in passes, so that descriptors and buffers stay bounded
+#define SORT_MERGE_FANIN        (64)
+#define SORT_MAX_THREADS        (16)
+// a chunk is only split between threads into parts of at least this many lines
+#define SORT_MIN_PART_LINES     (32 * 1024)
+
+struct SortOptions {
+    // the key is fields key_first to key_last, counted from 1; 0 for the whole line or through its end
+    int key_first = 0;
+    int key_last = 0;
+    // fields are separated by this character, or else each starts at a run of blanks it includes
+    int separator = -1;
+    bool numeric = false;
+    bool reverse = false;
+    bool unique = false;
+    bool ignore_case = false;
+    size_t buffer_size = SORT_DEFAULT_BUFFER;
+    // 0 for one per cpu
+    unsigned threads = 0;
+    std::string temp_dir = "/tmp";
+};
+
+// a line without its newline, and where its key is; the prefix is the key's first bytes, for comparing most
+// pairs of lines without following the pointer
+struct SortLine {
+    const char *data;
+    uint64_t prefix;
+    uint32_t len;
+    uint32_t key_start;
+    uint32_t key_len;
+};
+
+// reads lines from a descriptor through a buffer that grows to hold the longest line
+class LineReader {
+    int fd;
+    std::vector<char> buffer;
+    size_t pos = 0;
+    size_t filled = 0;
+    bool eof = false;
+
+public:
+    explicit LineReader(int fd, size_t buffer_size = SORT_IO_BUFFER) : fd(fd), buffer(buffer_size) {}
+
+    // false at end of input, or with errno set on an error; the line stays valid until the next call. A
+    // last line without a newline is still a line
+    bool next(const char *&line, size_t &len, bool &failed);
+};
+
+// buffered write() of whole lines, which stops at the first error
+class LineWriter {
+    int fd;
+    std::vector<char> buffer;
+    size_t used = 0;
+    bool failed = false;
+    int error = 0;
+
+public:
+    explicit LineWriter(int fd) : fd(fd), buffer(SORT_IO_BUFFER) {}
+
+    void write(const char *data, size_t len);
+
+    void writeLine(const char *line, size_t len) {
+        write(line, len);
+        write("\n", 1);
+    }
+
+    // returns false with errno set if anything could not be written, or the running worker was cancelled
+    bool flush();
+
+    // false once a write failed; whatever follows is dropped
+    bool good() const {
+        return !this->failed;
+    }
+};
+
+/*
+ * sort's engine. Lines are read into a chunk of the memory budget; a full chunk is sorted by several threads,
+ * a part each, and its parts are merged into a run in a temporary file, which is unlinked as soon as it is
+ * created. finish() then merges the runs and the last chunk, still in memory, into the output, first merging
+ * runs SORT_MERGE_FANIN at a time while there are more. Lines compare as bytes (the C locale), with the whole
+ * line deciding between equal keys unless only unique keys are kept, as GNU sort does.
+ */
+class ExternalSort {
+    struct Run;
+    struct Cursor;
+
+    SortOptions options;
+    // allocated by the first add(); only grows past the budget for a line longer than all of it
+    std::unique_ptr<char[]> text;
+    size_t text_size = 0;
+    size_t text_used = 0;
+    // where the line being read started, in text
+    size_t line_start = 0;
+    std::vector<SortLine> lines;
+    // the sorted parts of lines, as [begin, end) indices
+    std::vector<std::pair<size_t, size_t>> parts;
+    std::vector<std::unique_ptr<Run>> runs;
+
+    void addLine(const char *line, size_t len);
+
+    void sortChunk();
+
+    bool makeRoom();
+
+    bool spill();
+
+    // replaces runs [first, first + count) with a run of their lines
+    bool mergeRuns(size_t first, size_t count);
+
+    bool merge(std::vector<Cursor> &cursors, LineWriter &writer) const;
+
+public:
+    explicit ExternalSort(const SortOptions &options);
+
+    ~ExternalSort();
+
+    ExternalSort(ExternalSort const &) = delete;
+
+    void operator=(ExternalSort const &) = delete;
+
+    // reads fd to its end; returns false with errno set on an error
+    bool add(int fd);
+
+    // writes the sorted lines; returns false with errno set on an error
+    bool finish(int out_fd);
+
+    size_t getRuns() const {
+        return this->runs.size();
+    }
+
+    // the key of a line as the options define it, and the ordering used
+    static void setKey(const SortOptions &options, SortLine &line);
+
+    static int compare(const SortOptions &options, const SortLine &a, const SortLine &b);
+};
+
+#endif //SMASH_SORT_H_
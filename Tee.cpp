@@ -0,0 +1,180 @@
+#include "Tee.h"
+#include "Worker.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <climits>
+#include <cerrno>
+
+using namespace std;
+
+StreamTee::StreamTee(int in_fd, int out_fd, const std::vector<int> &file_fds) : in_fd(in_fd), out_fd(out_fd) {
+    for (int fd: file_fds) {
+        this->files.push_back({fd});
+    }
+}
+
+StreamTee::~StreamTee() {
+    for (auto &file: this->files) {
+        if (file.pipe_read != -1) {
+            close(file.pipe_read);
+            close(file.pipe_write);
+        }
+    }
+}
+
+// one private pipe per file, at least as large as the input so that a tee() of everything buffered in the
+// input always fits into an empty private pipe
+bool StreamTee::openPipes() {
+    // larger rounds mean fewer syscalls per byte; the pipe size limit may refuse, which is fine
+    if (fcntl(this->in_fd, F_GETPIPE_SZ) < TEE_PIPE_SIZE) {
+        fcntl(this->in_fd, F_SETPIPE_SZ, TEE_PIPE_SIZE);
+    }
+    int capacity = fcntl(this->in_fd, F_GETPIPE_SZ);
+    if (capacity == -1) {
+        return false;
+    }
+    for (auto &file: this->files) {
+        int fds[2];
+        if (pipe2(fds, O_CLOEXEC) == -1) {
+            return false;
+        }
+        file.pipe_read = fds[0];
+        file.pipe_write = fds[1];
+        if (fcntl(file.pipe_write, F_GETPIPE_SZ) < capacity && fcntl(file.pipe_write, F_SETPIPE_SZ, capacity) == -1) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool StreamTee::writeAll(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t res = write(fd, data, len);
+        if (res == -1) {
+            if (errno == EINTR && !WorkerPool::cancelRequested()) {
+                continue;
+            }
+            return false;
+        }
+        data += res;
+        len -= res;
+    }
+    return true;
+}
+
+// moves exactly len bytes out of the pipe from_fd; splice() into files opened with O_APPEND or into some
+// character devices fails with EINVAL before consuming anything, those get a copy instead
+bool StreamTee::moveBytes(int from_fd, int to_fd, size_t len) {
+    while (len > 0) {
+        ssize_t res = splice(from_fd, nullptr, to_fd, nullptr, len, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (res == -1 && errno == EINTR && !WorkerPool::cancelRequested()) {
+            continue;
+        }
+        if (res == -1 && errno == EINVAL) {
+            this->buffer.resize(TEE_COPY_BUFFER_SIZE);
+            res = read(from_fd, this->buffer.data(), std::min(len, this->buffer.size()));
+            if (res > 0 && !writeAll(to_fd, this->buffer.data(), res)) {
+                return false;
+            }
+        }
+        if (res == -1) {
+            return false;
+        }
+        if (res == 0) {
+            errno = EPIPE;
+            return false;
+        }
+        len -= res;
+    }
+    return true;
+}
+
+bool StreamTee::run() {
+    struct stat in_stat{};
+    if (fstat(this->in_fd, &in_stat) == -1) {
+        return false;
+    }
+    if (!S_ISFIFO(in_stat.st_mode) || !openPipes()) {
+        return runCopy();
+    }
+    while (true) {
+        if (WorkerPool::cancelRequested()) {
+            errno = ECANCELED;
+            return false;
+        }
+        ssize_t len;
+        if (this->files.empty()) {
+            len = splice(this->in_fd, nullptr, this->out_fd, nullptr, INT_MAX, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (len == -1 && errno == EINVAL) {
+                return runCopy();
+            }
+        } else {
+            // blocks until input is available; whatever it copies fixes the size of this round
+            len = tee(this->in_fd, this->files[0].pipe_write, INT_MAX, 0);
+        }
+        if (len == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        if (len == 0) {
+            return true;
+        }
+        for (size_t i = 1; i < this->files.size(); i++) {
+            // the private pipes are empty and as large as the input, tee() can not fall short here
+            ssize_t copied;
+            do {
+                copied = tee(this->in_fd, this->files[i].pipe_write, len, 0);
+            } while (copied == -1 && errno == EINTR && !WorkerPool::cancelRequested());
+            if (copied != len) {
+                if (copied != -1) {
+                    errno = EIO;
+                }
+                return false;
+            }
+        }
+        if (!this->files.empty() && !moveBytes(this->in_fd, this->out_fd, len)) {
+            return false;
+        }
+        for (auto &file: this->files) {
+            if (!moveBytes(file.pipe_read, file.fd, len)) {
+                return false;
+            }
+        }
+        this->transferred += len;
+    }
+}
+
+bool StreamTee::runCopy() {
+    this->buffer.resize(TEE_COPY_BUFFER_SIZE);
+    while (true) {
+        // checked every round, as reading a file or device never blocks long enough to be interrupted
+        if (WorkerPool::cancelRequested()) {
+            errno = ECANCELED;
+            return false;
+        }
+        ssize_t len = read(this->in_fd, this->buffer.data(), this->buffer.size());
+        if (len == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        if (len == 0) {
+            return true;
+        }
+        if (!writeAll(this->out_fd, this->buffer.data(), len)) {
+            return false;
+        }
+        for (auto &file: this->files) {
+            if (!writeAll(file.fd, this->buffer.data(), len)) {
+                return false;
+            }
+        }
+        this->transferred += len;
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef SMASH_TEE_H_
+#define SMASH_TEE_H_
+
+#include <vector>
+#include <sys/types.h>
+
+#define TEE_COPY_BUFFER_SIZE    (64 * 1024)
+#define TEE_PIPE_SIZE           (1024 * 1024)
+
+/*
+ * Duplicates everything read from in_fd to out_fd and to a set of files. When the input is a pipe the data
+ * never passes through user space: tee(2) clones the pipe buffers into one private pipe per file, splice(2)
+ * moves those into the files, and the input itself is spliced into out_fd. Inputs that are not pipes, and
+ * outputs splice() refuses, go through a plain read()/write() copy.
+ */
+class StreamTee {
+    struct Sink {
+        int fd;
+        int pipe_read = -1;
+        int pipe_write = -1;
+    };
+
+    int in_fd;
+    int out_fd;
+    std::vector<Sink> files;
+    unsigned long long transferred = 0;
+    // only allocated once a copy is needed
+    std::vector<char> buffer;
+
+    bool openPipes();
+
+    bool moveBytes(int from_fd, int to_fd, size_t len);
+
+    static bool writeAll(int fd, const char *data, size_t len);
+
+public:
+    StreamTee(int in_fd, int out_fd, const std::vector<int> &file_fds);
+
+    ~StreamTee();
+
+    StreamTee(StreamTee const &) = delete;
+
+    void operator=(StreamTee const &) = delete;
+
+    // copies until end of input; returns false with errno set on the first error
+    bool run();
+
+    // the read()/write() path, also used as the fallback of run()
+    bool runCopy();
+
+    unsigned long long getTransferred() const {
+        return this->transferred;
+    }
+};
+
+#endif //SMASH_TEE_H_
@@ -0,0 +1,230 @@
+#include "Trace.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+TraceEvent Trace::events[TRACE_CAPACITY];
+std::atomic<uint64_t> Trace::next{0};
+
+static_assert((TRACE_CAPACITY & (TRACE_CAPACITY - 1)) == 0, "TRACE_CAPACITY must be a power of two");
+
+void Trace::record(TraceKind kind, pid_t pid, long value, const char *text, long cpu_us) {
+    timespec now{};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t index = next.fetch_add(1, std::memory_order_relaxed);
+    TraceEvent &event = events[index & (TRACE_CAPACITY - 1)];
+    event.seq.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    event.ts_ns = (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+    event.kind = kind;
+    event.tid = (pid_t) syscall(SYS_gettid);
+    event.pid = pid;
+    event.value = value;
+    event.cpu_us = cpu_us;
+    // strncpy() is not async-signal-safe on every libc
+    size_t len = 0;
+    if (text != nullptr) {
+        while (len < TRACE_TEXT_SIZE - 1 && text[len] != '\0') {
+            event.text[len] = text[len];
+            len++;
+        }
+    }
+    event.text[len] = '\0';
+    event.seq.store(index + 1, std::memory_order_release);
+}
+
+void Trace::clear() {
+    next.store(0, std::memory_order_relaxed);
+    for (auto &event: events) {
+        event.seq.store(0, std::memory_order_relaxed);
+    }
+}
+
+// a plain copy of an event, taken while no writer touched its slot
+struct TraceSnapshot {
+    uint64_t ts_ns;
+    TraceKind kind;
+    pid_t tid;
+    pid_t pid;
+    long value;
+    long cpu_us;
+    char text[TRACE_TEXT_SIZE];
+};
+
+static string _jsonString(const char *text) {
+    string quoted = "\"";
+    for (const char *c = text; *c != '\0'; c++) {
+        switch (*c) {
+            case '"':
+                quoted += "\\\"";
+                break;
+            case '\\':
+                quoted += "\\\\";
+                break;
+            case '\n':
+                quoted += "\\n";
+                break;
+            case '\t':
+                quoted += "\\t";
+                break;
+            default:
+                if ((unsigned char) *c < 0x20) {
+                    char escaped[8];
+                    snprintf(escaped, sizeof escaped, "\\u%04x", *c);
+                    quoted += escaped;
+                } else {
+                    quoted += *c;
+                }
+        }
+    }
+    return quoted + "\"";
+}
+
+// one event of the Chrome trace format; args, if any, is a JSON object
+static void _writeEvent(FILE *out, bool &first, const char *phase, const string &name, uint64_t ts_ns, pid_t pid,
+                        pid_t tid, const string &args = "") {
+    fprintf(out, "%s\n{\"name\":%s,\"ph\":\"%s\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d", first ? "" : ",",
+            _jsonString(name.c_str()).c_str(), phase, ts_ns / 1000.0, pid, tid);
+    if (*phase == 'i') {
+        fprintf(out, ",\"s\":\"t\"");
+    }
+    if (!args.empty()) {
+        fprintf(out, ",\"args\":%s", args.c_str());
+    }
+    fprintf(out, "}");
+    first = false;
+}
+
+// the shell's handlers are what the user sees them as
+static const char *_signalName(int sig_num) {
+    switch (sig_num) {
+        case SIGINT:
+            return "ctrl-C";
+        case SIGTSTP:
+            return "ctrl-Z";
+        case SIGALRM:
+            return "alarm";
+        default:
+            return strsignal(sig_num);
+    }
+}
+
+static string _finishArgs(const TraceSnapshot &event) {
+    int status = (int) event.value;
+    char args[128];
+    if (WIFSIGNALED(status)) {
+        snprintf(args, sizeof args, "{\"signal\":%d,\"cpu_ms\":%.3f}", WTERMSIG(status), event.cpu_us / 1000.0);
+    } else {
+        snprintf(args, sizeof args, "{\"exit_status\":%d,\"cpu_ms\":%.3f}", WEXITSTATUS(status),
+                 event.cpu_us / 1000.0);
+    }
+    return args;
+}
+
+bool Trace::dump(const std::string &path) {
+    vector<TraceSnapshot> snapshots;
+    uint64_t end = next.load(std::memory_order_acquire);
+    uint64_t begin = end > TRACE_CAPACITY ? end - TRACE_CAPACITY : 0;
+    for (uint64_t index = begin; index < end; index++) {
+        TraceEvent &event = events[index & (TRACE_CAPACITY - 1)];
+        if (event.seq.load(std::memory_order_acquire) != index + 1) {
+            continue;
+        }
+        TraceSnapshot snapshot{event.ts_ns, event.kind, event.tid, event.pid, event.value, event.cpu_us, {}};
+        memcpy(snapshot.text, event.text, TRACE_TEXT_SIZE);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (event.seq.load(std::memory_order_relaxed) != index + 1) {
+            continue;
+        }
+        snapshot.text[TRACE_TEXT_SIZE - 1] = '\0';
+        snapshots.push_back(snapshot);
+    }
+
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        return false;
+    }
+    FILE *out = fdopen(fd, "w");
+    if (out == nullptr) {
+        close(fd);
+        return false;
+    }
+    pid_t shell = getpid();
+    bool first = true;
+    fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    _writeEvent(out, first, "M", "process_name", 0, shell, shell, "{\"name\":\"smash\"}");
+    // per job track: whether it is between start and finish, and whether a "stopped" slice is open
+    struct Track {
+        bool running = false;
+        bool stopped = false;
+    };
+    unordered_map<pid_t, Track> tracks;
+    for (auto &event: snapshots) {
+        Track &track = tracks[event.pid];
+        switch (event.kind) {
+            case TRACE_COMMAND_BEGIN:
+                _writeEvent(out, first, "B", event.text, event.ts_ns, shell, event.tid);
+                break;
+            case TRACE_COMMAND_END:
+                _writeEvent(out, first, "E", "", event.ts_ns, shell, event.tid);
+                break;
+            case TRACE_JOB_START:
+                _writeEvent(out, first, "M", "thread_name", 0, shell, event.pid,
+                            "{\"name\":" + _jsonString(("job " + to_string(event.pid)).c_str()) + "}");
+                _writeEvent(out, first, "B", event.text, event.ts_ns, shell, event.pid);
+                track.running = true;
+                break;
+            case TRACE_JOB_ADDED:
+                _writeEvent(out, first, "i", "job [" + to_string(event.value) + "]", event.ts_ns, shell, event.pid);
+                break;
+            case TRACE_JOB_STOP:
+                if (track.running && !track.stopped) {
+                    _writeEvent(out, first, "B", "stopped", event.ts_ns, shell, event.pid);
+                    track.stopped = true;
+                }
+                break;
+            case TRACE_JOB_RESUME:
+                if (track.stopped) {
+                    _writeEvent(out, first, "E", "", event.ts_ns, shell, event.pid);
+                    track.stopped = false;
+                }
+                break;
+            case TRACE_JOB_TIMEOUT:
+                _writeEvent(out, first, "i", "timed out", event.ts_ns, shell, event.pid);
+                break;
+            case TRACE_JOB_FINISH:
+                // a job whose start was overwritten in the ring shows up as a bare finish
+                if (!track.running) {
+                    _writeEvent(out, first, "i", "finished", event.ts_ns, shell, event.pid, _finishArgs(event));
+                    break;
+                }
+                if (track.stopped) {
+                    _writeEvent(out, first, "E", "", event.ts_ns, shell, event.pid);
+                }
+                _writeEvent(out, first, "E", "", event.ts_ns, shell, event.pid, _finishArgs(event));
+                tracks.erase(event.pid);
+                break;
+            case TRACE_SIGNAL:
+                _writeEvent(out, first, "i", _signalName((int) event.value), event.ts_ns, shell, event.tid,
+                            "{\"signal\":" + to_string(event.value) + "}");
+                break;
+        }
+    }
+    fprintf(out, "\n]}\n");
+    bool written = !ferror(out);
+    if (fclose(out) != 0) {
+        written = false;
+    }
+    return written;
+}
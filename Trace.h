@@ -0,0 +1,98 @@
+#ifndef SMASH_TRACE_H_
+#define SMASH_TRACE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <sys/types.h>
+
+// events kept; once full the oldest are overwritten. Must be a power of two
+#define TRACE_CAPACITY      (1 << 15)
+// bytes of the command line kept with an event
+#define TRACE_TEXT_SIZE     (64)
+// set to a file name to trace from startup and dump there when smash exits
+#define TRACE_ENV           "SMASH_TRACE"
+
+enum TraceKind {
+    TRACE_COMMAND_BEGIN,    // executeCommand() started on a line
+    TRACE_COMMAND_END,
+    TRACE_JOB_START,        // a command was forked or started on a worker; value is the job's first pid
+    TRACE_JOB_ADDED,        // entered the jobs list; value is the job id
+    TRACE_JOB_STOP,
+    TRACE_JOB_RESUME,
+    TRACE_JOB_TIMEOUT,
+    TRACE_JOB_FINISH,       // reaped; value is the waitpid() status, cpu_us the cpu time it used
+    TRACE_SIGNAL            // a signal reached the shell's handler; value is the signal
+};
+
+struct TraceEvent {
+    // index + 1 once the event is completely written, 0 while it is being written
+    std::atomic<uint64_t> seq{0};
+    uint64_t ts_ns;
+    TraceKind kind;
+    pid_t tid;
+    pid_t pid;
+    long value;
+    long cpu_us;
+    char text[TRACE_TEXT_SIZE];
+};
+
+/*
+ * A fixed ring of job lifecycle events, written without locks or allocation so that signal handlers and
+ * worker threads may record as well. Writers claim a slot with one fetch_add and publish it through its
+ * sequence number, which dump() checks before and after copying so that it skips slots being rewritten.
+ * Disabled (the default), recording costs the single branch in event(). dump() writes the Chrome trace
+ * format that Perfetto and chrome://tracing open: shell commands as slices on the shell's thread, and each
+ * job as a slice on its own track, with nested "stopped" slices while it was stopped.
+ */
+class Trace {
+    static TraceEvent events[TRACE_CAPACITY];
+    static std::atomic<uint64_t> next;
+
+    static void record(TraceKind kind, pid_t pid, long value, const char *text, long cpu_us);
+
+    friend class TraceScope;
+public:
+    static inline std::atomic<bool> enabled{false};
+
+    // async-signal-safe
+    static void event(TraceKind kind, pid_t pid, long value = 0, const char *text = nullptr, long cpu_us = 0) {
+        if (enabled.load(std::memory_order_relaxed)) {
+            record(kind, pid, value, text, cpu_us);
+        }
+    }
+
+    static void clear();
+
+    // events recorded since the last clear(), including any overwritten
+    static uint64_t recorded() {
+        return next.load(std::memory_order_relaxed);
+    }
+
+    // returns false with errno set if the file could not be written
+    static bool dump(const std::string &path);
+};
+
+// records a command's slice on the shell's thread for as long as it is in scope
+class TraceScope {
+    bool active;
+public:
+    explicit TraceScope(const char *cmd_line) : active(Trace::enabled.load(std::memory_order_relaxed)) {
+        if (this->active) {
+            Trace::event(TRACE_COMMAND_BEGIN, 0, 0, cmd_line);
+        }
+    }
+
+    // closes the slice even if tracing was turned off in between
+    ~TraceScope() {
+        if (this->active) {
+            Trace::record(TRACE_COMMAND_END, 0, 0, nullptr, 0);
+        }
+    }
+
+    TraceScope(TraceScope const &) = delete;
+
+    void operator=(TraceScope const &) = delete;
+};
+
+#endif //SMASH_TRACE_H_
@@ -0,0 +1,130 @@
+#include "Worker.h"
+
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cstdint>
+#include <system_error>
+#include <thread>
+
+using namespace std;
+
+static thread_local WorkerTask *current_task = nullptr;
+
+static void _wakeHandler(int) {
+    // nothing to do: being delivered is what interrupts the worker's system call
+}
+
+WorkerTask::WorkerTask(std::function<int()> run) : run(std::move(run)) {
+    this->done_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+}
+
+WorkerTask::~WorkerTask() {
+    if (this->done_fd != -1) {
+        close(this->done_fd);
+    }
+}
+
+void WorkerTask::cancel(int sig_num) {
+    int none = 0;
+    // the first signal is the one reported
+    this->cancel_signal.compare_exchange_strong(none, sig_num);
+    if (!isFinished() && this->tid.load() != 0) {
+        pthread_kill(this->thread, WORKER_WAKE_SIGNAL);
+    }
+}
+
+WorkerPool::WorkerPool() : owner(getpid()) {
+    struct sigaction sa{};
+    // no SA_RESTART: the point of the signal is to make blocking calls return EINTR
+    sa.sa_handler = _wakeHandler;
+    sigemptyset(&sa.sa_mask);
+    sigaction(WORKER_WAKE_SIGNAL, &sa, nullptr);
+}
+
+WorkerPool &WorkerPool::instance() {
+    // never destroyed: the detached workers still wait on it while the shell exits
+    static WorkerPool *pool = new WorkerPool();
+    return *pool;
+}
+
+bool WorkerPool::reserve() {
+    if (!ownsWorkers()) {
+        return false;
+    }
+    unique_lock<mutex> guard(this->lock);
+    if (this->idle > this->reserved + this->queue.size()) {
+        this->reserved++;
+        return true;
+    }
+    if (this->threads >= WORKER_MAX_THREADS) {
+        return false;
+    }
+    // created with every signal but the wake-up blocked, which it inherits
+    sigset_t all, old_mask;
+    sigfillset(&all);
+    sigdelset(&all, WORKER_WAKE_SIGNAL);
+    pthread_sigmask(SIG_SETMASK, &all, &old_mask);
+    bool created = true;
+    try {
+        thread(&WorkerPool::workerMain, this).detach();
+    } catch (const system_error &) {
+        created = false;
+    }
+    pthread_sigmask(SIG_SETMASK, &old_mask, nullptr);
+    if (!created) {
+        return false;
+    }
+    this->threads++;
+    this->idle++;
+    this->reserved++;
+    return true;
+}
+
+void WorkerPool::start(const std::shared_ptr<WorkerTask> &task) {
+    unique_lock<mutex> guard(this->lock);
+    this->reserved--;
+    this->queue.push_back(task);
+    this->work.notify_one();
+    // the job's pid is the worker's thread id, which jobs and kill print right away
+    this->started.wait(guard, [&task]() { return task->tid.load() != 0; });
+}
+
+void WorkerPool::release() {
+    lock_guard<mutex> guard(this->lock);
+    this->reserved--;
+}
+
+bool WorkerPool::cancelRequested() {
+    return current_task != nullptr && current_task->cancel_signal.load() != 0;
+}
+
+void WorkerPool::workerMain() {
+    pid_t tid = (pid_t) syscall(SYS_gettid);
+    while (true) {
+        shared_ptr<WorkerTask> task;
+        {
+            unique_lock<mutex> guard(this->lock);
+            this->work.wait(guard, [this]() { return !this->queue.empty(); });
+            task = std::move(this->queue.front());
+            this->queue.pop_front();
+            this->idle--;
+            task->thread = pthread_self();
+            task->tid.store(tid);
+        }
+        this->started.notify_all();
+        current_task = task.get();
+        task->exit_status = task->run();
+        current_task = nullptr;
+        task->finished.store(true, std::memory_order_release);
+        uint64_t one = 1;
+        if (task->done_fd != -1) {
+            write(task->done_fd, &one, sizeof one);
+        }
+        // wakes a shell sleeping until a child changes state, as a finished process would
+        kill(this->owner, SIGCHLD);
+        task.reset();
+        lock_guard<mutex> guard(this->lock);
+        this->idle++;
+    }
+}
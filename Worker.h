@@ -0,0 +1,122 @@
+#ifndef SMASH_WORKER_H_
+#define SMASH_WORKER_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#define WORKER_MAX_THREADS      (32)
+// interrupts the system call a worker is blocked in when its task is cancelled; ignored by default, so a
+// stray one sent to the process is harmless
+#define WORKER_WAKE_SIGNAL      (SIGURG)
+// how often a cancelled task is woken again while someone waits for it, in case the first wake-up came
+// before it blocked
+#define WORKER_WAKE_INTERVAL_MS (100)
+
+/*
+ * One piece of work for the pool. Cancellation is cooperative: cancel() records the signal that asked for it
+ * and interrupts the worker's current system call, and the code running on the worker gives up at the next
+ * point that checks WorkerPool::cancelRequested(). done_fd is an eventfd that becomes readable once the task
+ * has returned, so that waiting for a task looks like waiting for a pidfd.
+ */
+class WorkerTask {
+    std::function<int()> run;
+    std::atomic<bool> finished{false};
+    std::atomic<int> cancel_signal{0};
+    int exit_status = 0;
+    std::atomic<pid_t> tid{0};
+    pthread_t thread{};
+    int done_fd;
+
+    friend class WorkerPool;
+public:
+    explicit WorkerTask(std::function<int()> run);
+
+    ~WorkerTask();
+
+    WorkerTask(WorkerTask const &) = delete;
+
+    void operator=(WorkerTask const &) = delete;
+
+    // async-signal-safe, so that the ctrl-C handler may call it
+    void cancel(int sig_num);
+
+    // async-signal-safe
+    bool isFinished() const {
+        return this->finished.load(std::memory_order_acquire);
+    }
+
+    // the signal that cancelled the task, or 0
+    int cancelledBy() const {
+        return this->cancel_signal.load();
+    }
+
+    // only meaningful once finished
+    int getExitStatus() const {
+        return this->exit_status;
+    }
+
+    // the id of the thread running the task, set before WorkerPool::start() returns
+    pid_t getTid() const {
+        return this->tid.load();
+    }
+
+    int getDoneFd() const {
+        return this->done_fd;
+    }
+};
+
+/*
+ * Threads that run builtins off the shell's main loop. The pool starts empty, adds a thread whenever a task
+ * is reserved and none is idle, and never shrinks, so a thread a task was started on stays valid for
+ * cancel(). Workers block every signal except WORKER_WAKE_SIGNAL, leaving ctrl-C, ctrl-Z and SIGCHLD to the
+ * main thread. In a forked child the workers do not exist, so the pool refuses everything there.
+ */
+class WorkerPool {
+    std::mutex lock;
+    std::condition_variable work;
+    std::condition_variable started;
+    std::deque<std::shared_ptr<WorkerTask>> queue;
+    size_t threads = 0;
+    size_t idle = 0;
+    size_t reserved = 0;
+    pid_t owner;
+
+    WorkerPool();
+
+    void workerMain();
+
+public:
+    static WorkerPool &instance();
+
+    WorkerPool(WorkerPool const &) = delete;
+
+    void operator=(WorkerPool const &) = delete;
+
+    // claims a worker for the next start(), adding a thread if needed; false when all WORKER_MAX_THREADS
+    // are busy or in a forked child
+    bool reserve();
+
+    // runs the task on the reserved worker
+    void start(const std::shared_ptr<WorkerTask> &task);
+
+    // gives back a reservation that will not be started
+    void release();
+
+    // false in a forked child, where the workers and the tasks they run do not exist
+    bool ownsWorkers() const {
+        return getpid() == this->owner;
+    }
+
+    // whether the task on the calling thread was cancelled; always false on the main thread
+    static bool cancelRequested();
+};
+
+#endif //SMASH_WORKER_H_
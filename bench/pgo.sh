@@ -0,0 +1,43 @@
+#!/bin/sh
+# Builds smash with profile-guided optimization and reports the gains: an instrumented build runs the
+# training workload, the same build directory is rebuilt with the profile, and smash_bench is run against
+# the release, release+LTO and PGO builds with the release numbers as the baseline.
+#
+#   bench/pgo.sh [workload repetitions]      (BENCH_ARGS is passed to smash_bench, e.g. --quick)
+set -e
+
+cd "$(dirname "$0")/.."
+REPS=${1:-200}
+BUILD=build
+
+run_workload() {
+    i=0
+    while [ "$i" -lt "$REPS" ]; do
+        cat bench/workload.smash
+        i=$((i + 1))
+    done | HOME=/tmp SMASH_HISTFILE=/dev/null "$1" > /dev/null 2>&1
+}
+
+for preset in release release-lto; do
+    cmake --preset "$preset" > /dev/null
+    cmake --build --preset "$preset"
+done
+
+rm -rf "$BUILD/pgo/pgo-profile"
+cmake --preset pgo-generate > /dev/null
+cmake --build --preset pgo-generate --target smash
+run_workload "$BUILD/pgo/smash"
+if ls "$BUILD/pgo/pgo-profile"/*.profraw > /dev/null 2>&1; then
+    llvm-profdata merge -o "$BUILD/pgo/pgo-profile/smash.profdata" "$BUILD/pgo/pgo-profile"/*.profraw
+fi
+cmake --preset pgo-use > /dev/null
+# everything is rebuilt, since the flags changed
+cmake --build --preset pgo-use --clean-first
+
+"$BUILD/release/smash_bench" $BENCH_ARGS > "$BUILD/bench-release.json"
+"$BUILD/release-lto/smash_bench" $BENCH_ARGS --baseline "$BUILD/bench-release.json" > "$BUILD/bench-release-lto.json"
+"$BUILD/pgo/smash_bench" $BENCH_ARGS --baseline "$BUILD/bench-release.json" > "$BUILD/bench-pgo.json"
+for build in release-lto pgo; do
+    echo "$build: $(grep -o '"geomean_speedup": [0-9.]*' "$BUILD/bench-$build.json")"
+done
+echo "results in $BUILD/bench-*.json"
@@ -0,0 +1,474 @@
+// Microbenchmarks for smash's hot paths, each measured in isolation: command line parsing and Command
+// construction, CreateCommand dispatch, JobsList operations at several sizes, timeoutAlarm with many
+// timers, recording a trace event, TailCommand on generated files and on cold log shards, and fork/exec launch latency.
+//
+// Every case is warmed up first, then timed in samples of a batch of operations sized so that one sample
+// is well above the clock resolution. The JSON report gives percentiles of the time per operation over
+// the samples, so that two commits can be compared case by case.
+//
+//   cmake -S .. -B build && cmake --build build --target smash_bench
+//   ./smash_bench [--filter text] [--quick] [--tail-max-mb N] [--tail-dir dir] [--cpu N] [--baseline old.json]
+//
+// With --baseline, every case also reports the p50 of the same case in an earlier report and the speedup
+// over it, and the report ends with the geometric mean of the speedups.
+
+#include "../Commands.h"
+#include "../BlockReader.h"
+
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+#define BENCH_WARMUP_SECS       (0.2)
+#define BENCH_CASE_SECS         (1.0)
+#define BENCH_QUICK_CASE_SECS   (0.2)
+// the batch of operations in one sample is doubled until a sample takes at least this long
+#define BENCH_MIN_SAMPLE_SECS   (0.0002)
+#define BENCH_MIN_SAMPLES       (5)
+#define BENCH_MAX_SAMPLES       (2000)
+// far above any pid in use, so that waitpid() on a fake job fails fast with ECHILD
+#define BENCH_FAKE_PID_BASE     (3000000)
+#define BENCH_TAIL_LINE_SIZE    (100)
+#define BENCH_TAIL_DEFAULT_MB   (16)
+// rotated log shards of 1 MB each, tailed with their page cache dropped
+#define BENCH_TAIL_SHARDS       (64)
+
+int _parseCommandLine(const char *cmd_line, char ***args);
+
+struct Options {
+    std::string filter;
+    bool quick = false;
+    long tail_max_mb = BENCH_TAIL_DEFAULT_MB;
+    std::string tail_dir = "/tmp";
+    int cpu = -1;
+    std::string baseline;
+};
+
+static Options options;
+static FILE *report;
+static bool first_case = true;
+// p50 by case (name and params) from the baseline report
+static std::map<std::string, double> baseline;
+static double log_speedup_sum = 0;
+static int compared_cases = 0;
+
+static double now() {
+    timespec ts{};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// a job's command; nothing is ever run
+class BenchCommand : public Command {
+public:
+    explicit BenchCommand(const char *cmd_line) : Command(cmd_line) {};
+
+    void execute() override {}
+};
+
+static double percentile(const std::vector<double> &sorted, double fraction) {
+    size_t rank = (size_t) std::ceil(fraction * sorted.size());
+    return sorted[std::min(sorted.size() - 1, rank > 0 ? rank - 1 : 0)];
+}
+
+static std::string caseKey(const std::string &name, const std::string &params) {
+    return name + " {" + params + "}";
+}
+
+// reads the cases of a report written by this program, one per line
+static bool loadBaseline(const std::string &path) {
+    std::ifstream file(path);
+    if (!file) {
+        return false;
+    }
+    const std::string name_tag = "{\"name\": \"", params_tag = "\"params\": {", p50_tag = "\"p50\": ";
+    for (std::string line; std::getline(file, line);) {
+        size_t name = line.find(name_tag), params = line.find(params_tag), p50 = line.find(p50_tag);
+        if (name == std::string::npos || params == std::string::npos || p50 == std::string::npos) {
+            continue;
+        }
+        name += name_tag.size();
+        params += params_tag.size();
+        std::string key = caseKey(line.substr(name, line.find('"', name) - name),
+                                  line.substr(params, line.find('}', params) - params));
+        baseline[key] = atof(line.c_str() + p50 + p50_tag.size());
+    }
+    return true;
+}
+
+template<typename Op>
+static double timeBatch(Op &op, long batch) {
+    double start = now();
+    for (long i = 0; i < batch; i++) {
+        op();
+    }
+    return now() - start;
+}
+
+// params is a JSON object body such as "\"entries\": 1000"
+template<typename Op>
+static void runCase(const std::string &name, const std::string &params, Op op) {
+    if (!options.filter.empty() && name.find(options.filter) == std::string::npos) {
+        return;
+    }
+    long batch = 1;
+    double elapsed = timeBatch(op, batch);
+    while (elapsed < BENCH_MIN_SAMPLE_SECS) {
+        batch *= 2;
+        elapsed = timeBatch(op, batch);
+    }
+    for (double start = now(); now() - start < BENCH_WARMUP_SECS;) {
+        timeBatch(op, batch);
+    }
+    double budget = options.quick ? BENCH_QUICK_CASE_SECS : BENCH_CASE_SECS;
+    std::vector<double> samples;
+    for (double start = now(); samples.size() < BENCH_MAX_SAMPLES &&
+                               (samples.size() < BENCH_MIN_SAMPLES || now() - start < budget);) {
+        samples.push_back(timeBatch(op, batch) * 1e9 / batch);
+    }
+    double mean = 0;
+    for (double sample: samples) {
+        mean += sample / samples.size();
+    }
+    std::sort(samples.begin(), samples.end());
+    double p50 = percentile(samples, 0.5);
+    fprintf(report, "%s\n    {\"name\": \"%s\", \"params\": {%s}, \"samples\": %zu, \"ops_per_sample\": %ld, "
+                    "\"ns_per_op\": {\"min\": %.1f, \"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, \"max\": %.1f, "
+                    "\"mean\": %.1f}",
+            first_case ? "" : ",", name.c_str(), params.c_str(), samples.size(), batch, samples.front(), p50,
+            percentile(samples, 0.9), percentile(samples, 0.99), samples.back(), mean);
+    auto old = baseline.find(caseKey(name, params));
+    if (old != baseline.end() && old->second > 0 && p50 > 0) {
+        fprintf(report, ", \"baseline_p50\": %.1f, \"speedup\": %.3f", old->second, old->second / p50);
+        log_speedup_sum += std::log(old->second / p50);
+        compared_cases++;
+    }
+    fprintf(report, "}");
+    fflush(report);
+    first_case = false;
+}
+
+static void benchParse() {
+    const std::pair<const char *, const char *> lines[] = {
+            {"short",  "ls -l"},
+            {"medium", "grep -rn pattern src include --color=auto -e other"},
+            {"long",   "cc -O2 -g -Wall -Wextra -I include -I src -D NDEBUG -o build/out a.c b.c c.c d.c e.c f.c "
+                       "g.c h.c i.c j.c k.c l.c m.c n.c o.c p.c -lm -lpthread -ldl"},
+    };
+    for (auto &line: lines) {
+        std::string params = "\"line\": \"" + std::string(line.first) + "\"";
+        runCase("parse.command_line", params, [&line]() {
+            char **args;
+            int num_of_args = _parseCommandLine(line.second, &args);
+            freeArgs(args, num_of_args);
+        });
+        runCase("construct.external", params, [&line]() {
+            ExternalCommand cmd(line.second);
+        });
+    }
+    JobsList jobs;
+    runCase("construct.builtin", "\"line\": \"kill -9 1\"", [&jobs]() {
+        KillCommand cmd("kill -9 1", &jobs);
+    });
+}
+
+static void benchDispatch() {
+    SmallShell &smash = SmallShell::getInstance();
+    const char *lines[] = {
+            "pwd",
+            "jobs",
+            "kill -9 3000000",
+            "ls -l /tmp",
+            "true && false",
+            "cat file | wc -l",
+            "echo x > /dev/null",
+    };
+    for (const char *line: lines) {
+        runCase("dispatch.create_command", "\"line\": \"" + std::string(line) + "\"", [&smash, line]() {
+            std::unique_ptr<Command> cmd = smash.CreateCommand(line);
+        });
+    }
+}
+
+static void benchJobs() {
+    std::vector<long> sizes = {10, 1000, 100000};
+    if (options.quick) {
+        sizes.pop_back();
+    }
+    for (long size: sizes) {
+        JobsList jobs;
+        std::vector<int> ids;
+        for (long i = 0; i < size; i++) {
+            auto cmd = std::make_unique<BenchCommand>("sleep 100 &");
+            cmd->setCmdPID(BENCH_FAKE_PID_BASE + i);
+            ids.push_back(jobs.addJob(std::move(cmd))->getJobID());
+        }
+        std::string params = "\"entries\": " + std::to_string(size);
+        runCase("jobs.add", params, [&jobs]() {
+            auto cmd = std::make_unique<BenchCommand>("sleep 100 &");
+            cmd->setCmdPID(BENCH_FAKE_PID_BASE);
+            jobs.addJob(std::move(cmd));
+            jobs.jobs_list.pop_back();
+        });
+        // a fixed pseudo-random walk over the ids, the same for every run
+        unsigned seed = 1;
+        runCase("jobs.lookup", params, [&jobs, &ids, &seed]() {
+            seed = seed * 1103515245 + 12345;
+            if (jobs.getJobById(ids[(seed >> 8) % ids.size()]) == nullptr) {
+                abort();
+            }
+        });
+        runCase("jobs.remove_add", params, [&jobs, &ids, &seed]() {
+            seed = seed * 1103515245 + 12345;
+            size_t victim = (seed >> 8) % ids.size();
+            jobs.removeJobById(ids[victim]);
+            auto cmd = std::make_unique<BenchCommand>("sleep 100 &");
+            cmd->setCmdPID(BENCH_FAKE_PID_BASE + (int) victim);
+            ids[victim] = jobs.addJob(std::move(cmd))->getJobID();
+        });
+        // what every command line pays before it runs
+        runCase("jobs.remove_finished", params, [&jobs]() {
+            jobs.removeFinishedJobs();
+        });
+    }
+}
+
+// the cost every traced call site pays, with tracing off (a single branch) and on
+static void benchTrace() {
+    for (bool enabled: {false, true}) {
+        Trace::enabled = enabled;
+        runCase("trace.event", std::string("\"enabled\": ") + (enabled ? "true" : "false"), []() {
+            Trace::event(TRACE_JOB_START, BENCH_FAKE_PID_BASE, 0, "sleep 100 &");
+        });
+    }
+    Trace::enabled = false;
+    Trace::clear();
+}
+
+static void benchTimers() {
+    SmallShell &smash = SmallShell::getInstance();
+    std::vector<long> sizes = {10, 1000, 10000};
+    if (options.quick) {
+        sizes.pop_back();
+    }
+    for (long size: sizes) {
+        for (long i = 0; i < size; i++) {
+            TimeoutCommand cmd("timeout 100000 sleep 1");
+            cmd.setCmdPID(BENCH_FAKE_PID_BASE + i);
+            smash.addTimeoutCMD(&cmd);
+        }
+        runCase("timers.timeout_alarm", "\"timers\": " + std::to_string(size), [&smash]() {
+            smash.timeoutAlarm();
+        });
+        for (long i = size - 1; i >= 0; i--) {
+            smash.timeoutRemoveByPID(BENCH_FAKE_PID_BASE + i);
+        }
+        alarm(0);
+    }
+}
+
+static bool writeTailFile(const std::string &path, long megabytes) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        return false;
+    }
+    std::string chunk;
+    while (chunk.size() + BENCH_TAIL_LINE_SIZE <= 1024 * 1024) {
+        std::string line = "line " + std::to_string(chunk.size() / BENCH_TAIL_LINE_SIZE) + " ";
+        line.resize(BENCH_TAIL_LINE_SIZE - 1, 'x');
+        chunk += line + '\n';
+    }
+    chunk.resize(1024 * 1024, '\n');
+    bool ok = true;
+    for (long i = 0; i < megabytes && ok; i++) {
+        ok = write(fd, chunk.data(), chunk.size()) == (ssize_t) chunk.size();
+    }
+    close(fd);
+    return ok;
+}
+
+// drops the cached pages of the files, which must be clean, so that the next read goes to the disk
+static void evictFiles(const std::vector<std::string> &paths) {
+    for (auto &path: paths) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd != -1) {
+            posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+            close(fd);
+        }
+    }
+}
+
+// one tail of all the shards through io_uring and through the thread pool, against one tail per shard
+static void benchTailShards() {
+    if (!options.filter.empty() && std::string("tail.cold_shards").find(options.filter) == std::string::npos) {
+        return;
+    }
+    std::vector<std::string> paths;
+    std::string line = "tail -10";
+    for (int i = 0; i < BENCH_TAIL_SHARDS; i++) {
+        paths.push_back(options.tail_dir + "/smash_bench_shard_" + std::to_string(i) + ".log");
+        line += " " + paths.back();
+        int fd = writeTailFile(paths.back(), 1) ? open(paths.back().c_str(), O_RDONLY) : -1;
+        if (fd == -1 || fdatasync(fd) == -1) {
+            perror(paths.back().c_str());
+            for (auto &path: paths) {
+                unlink(path.c_str());
+            }
+            return;
+        }
+        close(fd);
+    }
+    std::string params = "\"files\": " + std::to_string(BENCH_TAIL_SHARDS) + ", \"reader\": ";
+    for (const char *reader: {"io_uring", "threads"}) {
+        if (strcmp(reader, "threads") == 0) {
+            setenv(BLOCK_READER_DISABLE_ENV, "1", 1);
+        }
+        runCase("tail.cold_shards", params + "\"" + reader + "\"", [&paths, &line]() {
+            evictFiles(paths);
+            TailCommand cmd(line.c_str());
+            cmd.execute();
+            cmd.flushOutput();
+        });
+        unsetenv(BLOCK_READER_DISABLE_ENV);
+    }
+    std::vector<std::string> lines;
+    for (auto &path: paths) {
+        lines.push_back("tail -10 " + path);
+    }
+    runCase("tail.cold_shards", params + "\"sequential\"", [&paths, &lines]() {
+        evictFiles(paths);
+        for (auto &one: lines) {
+            TailCommand cmd(one.c_str());
+            cmd.execute();
+            cmd.flushOutput();
+        }
+    });
+    for (auto &path: paths) {
+        unlink(path.c_str());
+    }
+}
+
+static void benchTail() {
+    for (long megabytes = 1; megabytes <= options.tail_max_mb; megabytes *= 4) {
+        std::string path = options.tail_dir + "/smash_bench_tail_" + std::to_string(megabytes) + "M.txt";
+        if (!options.filter.empty() && std::string("tail.last_10_lines").find(options.filter) == std::string::npos) {
+            return;
+        }
+        if (!writeTailFile(path, megabytes)) {
+            perror(path.c_str());
+            unlink(path.c_str());
+            return;
+        }
+        std::string line = "tail -10 " + path;
+        runCase("tail.last_10_lines", "\"megabytes\": " + std::to_string(megabytes), [&line]() {
+            TailCommand cmd(line.c_str());
+            cmd.execute();
+        });
+        unlink(path.c_str());
+    }
+    benchTailShards();
+}
+
+static void benchLaunch() {
+    SmallShell &smash = SmallShell::getInstance();
+    char *const argv[] = {(char *) "true", nullptr};
+    char *const *envp = smash.getEnvironment().getEnvp();
+    std::string true_path = smash.getEnvironment().findExecutable("true");
+    // the floor: what any shell pays to start and reap a process
+    runCase("launch.fork_exec", "", [&true_path, argv, envp]() {
+        pid_t pid = fork();
+        if (pid == 0) {
+            execve(true_path.c_str(), argv, envp);
+            _exit(127);
+        }
+        waitpid(pid, nullptr, 0);
+    });
+    runCase("launch.smash_direct", "\"line\": \"true\"", [&smash]() {
+        smash.executeCommand("true");
+    });
+    // quoting sends the line to bash
+    runCase("launch.smash_bash", "\"line\": \"true 'x'\"", [&smash]() {
+        smash.executeCommand("true 'x'");
+    });
+}
+
+int main(int argc, char *argv[]) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--quick") {
+            options.quick = true;
+        } else if (arg == "--filter" && i + 1 < argc) {
+            options.filter = argv[++i];
+        } else if (arg == "--tail-max-mb" && i + 1 < argc) {
+            options.tail_max_mb = atol(argv[++i]);
+        } else if (arg == "--tail-dir" && i + 1 < argc) {
+            options.tail_dir = argv[++i];
+        } else if (arg == "--cpu" && i + 1 < argc) {
+            options.cpu = atoi(argv[++i]);
+        } else if (arg == "--baseline" && i + 1 < argc) {
+            options.baseline = argv[++i];
+        } else {
+            fprintf(stderr, "usage: %s [--filter text] [--quick] [--tail-max-mb N] [--tail-dir dir] [--cpu N] "
+                            "[--baseline old.json]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (!options.baseline.empty() && !loadBaseline(options.baseline)) {
+        perror(options.baseline.c_str());
+        return 1;
+    }
+    if (options.cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(options.cpu, &set);
+        if (sched_setaffinity(0, sizeof set, &set) == -1) {
+            perror("sched_setaffinity");
+        }
+    }
+    // the timers case arms real alarms; none of them may fire while the benchmarks run
+    sigset_t alarms;
+    sigemptyset(&alarms);
+    sigaddset(&alarms, SIGALRM);
+    sigprocmask(SIG_BLOCK, &alarms, nullptr);
+
+    // what the commands print is not what is being measured
+    int saved_stdout = dup(STDOUT_FILENO);
+    int devnull = open("/dev/null", O_WRONLY);
+    dup2(devnull, STDOUT_FILENO);
+    dup2(devnull, STDERR_FILENO);
+    report = fdopen(saved_stdout, "w");
+
+    time_t started = time(nullptr);
+    char date[64];
+    strftime(date, sizeof date, "%Y-%m-%dT%H:%M:%SZ", gmtime(&started));
+    fprintf(report, "{\"benchmark\": \"smash\", \"date\": \"%s\", \"quick\": %s, \"cases\": [", date,
+            options.quick ? "true" : "false");
+    benchParse();
+    benchDispatch();
+    benchJobs();
+    benchTimers();
+    benchTrace();
+    benchTail();
+    benchLaunch();
+    fprintf(report, "\n]");
+    if (compared_cases > 0) {
+        fprintf(report, ", \"compared_cases\": %d, \"geomean_speedup\": %.3f", compared_cases,
+                std::exp(log_speedup_sum / compared_cases));
+    }
+    fprintf(report, "}\n");
+    OutputSink::flushStandard();
+    fclose(report);
+    return 0;
+}
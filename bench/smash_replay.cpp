@@ -0,0 +1,470 @@
+// Interactive latency harness: runs smash under a pseudo-terminal, replays recorded sessions, timestamps
+// every expected prompt and message and reports latency distributions of what a user actually waits for:
+// Enter to the first output of the command, ctrl-Z to "was stopped", ctrl-C to "was killed" and a timeout's
+// deadline to "timed out!". The whole terminal output of every run is checked against the session's
+// expected transcript.
+//
+// A session is a text file of steps, one per line, with C escapes inside the quotes:
+//
+//   expect "text" [timeout_ms]          wait until text appears in the output
+//   send "text"                         type text (\r is Enter, \x1a ctrl-Z, \x03 ctrl-C)
+//   latency name "text" "expect"        type text and record the time until expect appears as name
+//   deadline name seconds "expect"      record the time from the last send plus seconds until expect appears
+//   pause ms
+//
+// session.expected next to it holds the transcript, byte for byte except that {N} stands for any number
+// (pids); --record writes it from a run, replacing numbers of three or more digits by {N}.
+//
+//   cmake --build build --target smash_replay
+//   ./smash_replay [--smash path] [--runs N] [--record] session...
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define REPLAY_DEFAULT_RUNS         (10)
+#define REPLAY_EXPECT_TIMEOUT_MS    (10000)
+#define REPLAY_EXIT_TIMEOUT_MS      (2000)
+#define REPLAY_COLUMNS              (80)
+#define REPLAY_ROWS                 (24)
+#define REPLAY_READ_SIZE            (4096)
+#define REPLAY_NUMBER               "{N}"
+// numbers at least this long are taken for pids when recording
+#define REPLAY_RECORD_MIN_DIGITS    (3)
+
+struct Step {
+    std::string op;
+    std::string name;
+    std::string text;
+    std::string expect;
+    double value = 0;
+    int line = 0;
+};
+
+static double now() {
+    timespec ts{};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static std::string unescape(const std::string &text) {
+    std::string result;
+    for (size_t i = 0; i < text.size(); i++) {
+        if (text[i] != '\\' || i + 1 == text.size()) {
+            result += text[i];
+            continue;
+        }
+        char c = text[++i];
+        switch (c) {
+            case 'r':
+                result += '\r';
+                break;
+            case 'n':
+                result += '\n';
+                break;
+            case 't':
+                result += '\t';
+                break;
+            case 'e':
+                result += '\x1b';
+                break;
+            case 'x':
+                result += (char) strtol(text.substr(i + 1, 2).c_str(), nullptr, 16);
+                i += 2;
+                break;
+            default:
+                result += c;
+        }
+    }
+    return result;
+}
+
+static std::string escape(const std::string &text) {
+    std::string result;
+    char hex[8];
+    for (unsigned char c: text) {
+        if (c == '\r') {
+            result += "\\r";
+        } else if (c == '\n') {
+            result += "\\n";
+        } else if (c == '\\' || c == '"') {
+            result += '\\';
+            result += (char) c;
+        } else if (c < 0x20 || c >= 0x7f) {
+            snprintf(hex, sizeof hex, "\\x%02x", c);
+            result += hex;
+        } else {
+            result += (char) c;
+        }
+    }
+    return result;
+}
+
+// splits a step into words, where "quoted strings" are single words with escapes resolved
+static std::vector<std::string> splitStep(const std::string &line) {
+    std::vector<std::string> words;
+    size_t pos = 0;
+    while (pos < line.size()) {
+        if (isspace(line[pos])) {
+            pos++;
+        } else if (line[pos] == '"') {
+            std::string word;
+            for (pos++; pos < line.size() && line[pos] != '"'; pos++) {
+                if (line[pos] == '\\' && pos + 1 < line.size()) {
+                    word += line[pos++];
+                }
+                word += line[pos];
+            }
+            pos++;
+            words.push_back(unescape(word));
+        } else {
+            size_t end = line.find_first_of(" \t", pos);
+            words.push_back(line.substr(pos, end == std::string::npos ? std::string::npos : end - pos));
+            pos = end == std::string::npos ? line.size() : end;
+        }
+    }
+    return words;
+}
+
+static bool loadSession(const std::string &path, std::vector<Step> &steps) {
+    std::ifstream file(path);
+    if (!file) {
+        fprintf(stderr, "%s: cannot open\n", path.c_str());
+        return false;
+    }
+    std::string line;
+    for (int number = 1; std::getline(file, line); number++) {
+        std::vector<std::string> words = splitStep(line);
+        if (words.empty() || words[0][0] == '#') {
+            continue;
+        }
+        Step step;
+        step.op = words[0];
+        step.line = number;
+        bool ok = true;
+        if (step.op == "send" && words.size() == 2) {
+            step.text = words[1];
+        } else if (step.op == "expect" && (words.size() == 2 || words.size() == 3)) {
+            step.expect = words[1];
+            step.value = words.size() == 3 ? atof(words[2].c_str()) : REPLAY_EXPECT_TIMEOUT_MS;
+        } else if (step.op == "latency" && words.size() == 4) {
+            step.name = words[1];
+            step.text = words[2];
+            step.expect = words[3];
+        } else if (step.op == "deadline" && words.size() == 4) {
+            step.name = words[1];
+            step.value = atof(words[2].c_str());
+            step.expect = words[3];
+        } else if (step.op == "pause" && words.size() == 2) {
+            step.value = atof(words[1].c_str());
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            fprintf(stderr, "%s:%d: bad step\n", path.c_str(), number);
+            return false;
+        }
+        steps.push_back(step);
+    }
+    return true;
+}
+
+/*
+ * One smash under a pty. Output is collected as it arrives; expect() returns the time at which the read
+ * that completed the awaited text returned.
+ */
+class Terminal {
+    int master = -1;
+    pid_t pid = -1;
+    std::string output;
+    // where the next expect() starts looking
+    size_t consumed = 0;
+
+    // reads whatever is available within timeout_ms; returns false on EOF
+    bool pump(int timeout_ms) {
+        pollfd fd{this->master, POLLIN, 0};
+        if (poll(&fd, 1, timeout_ms) <= 0) {
+            return true;
+        }
+        char buffer[REPLAY_READ_SIZE];
+        ssize_t res = read(this->master, buffer, sizeof buffer);
+        if (res <= 0) {
+            return false;
+        }
+        this->output.append(buffer, res);
+        return true;
+    }
+
+public:
+    ~Terminal() {
+        if (this->pid > 0) {
+            kill(this->pid, SIGKILL);
+            waitpid(this->pid, nullptr, 0);
+        }
+        if (this->master != -1) {
+            close(this->master);
+        }
+    }
+
+    bool start(const std::string &smash, const std::string &home) {
+        this->master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+        if (this->master == -1 || grantpt(this->master) == -1 || unlockpt(this->master) == -1) {
+            perror("posix_openpt");
+            return false;
+        }
+        winsize size{REPLAY_ROWS, REPLAY_COLUMNS, 0, 0};
+        ioctl(this->master, TIOCSWINSZ, &size);
+        std::string slave = ptsname(this->master);
+        this->pid = fork();
+        if (this->pid == 0) {
+            setsid();
+            int fd = open(slave.c_str(), O_RDWR);
+            ioctl(fd, TIOCSCTTY, 0);
+            dup2(fd, STDIN_FILENO);
+            dup2(fd, STDOUT_FILENO);
+            dup2(fd, STDERR_FILENO);
+            if (fd > STDERR_FILENO) {
+                close(fd);
+            }
+            // a history of its own, so that sessions neither see nor change the user's
+            setenv("HOME", home.c_str(), 1);
+            setenv("SMASH_HISTFILE", (home + "/history").c_str(), 1);
+            chdir(home.c_str());
+            execl(smash.c_str(), "smash", nullptr);
+            _exit(127);
+        }
+        return this->pid > 0;
+    }
+
+    void send(const std::string &text) {
+        write(this->master, text.data(), text.size());
+    }
+
+    // returns the time text was seen, or a negative value on timeout
+    double expect(const std::string &text, double timeout_ms) {
+        double deadline = now() + timeout_ms / 1000;
+        while (true) {
+            size_t found = this->output.find(text, this->consumed);
+            if (found != std::string::npos) {
+                this->consumed = found + text.size();
+                return now();
+            }
+            double left = deadline - now();
+            if (left <= 0 || !pump((int) std::ceil(left * 1000))) {
+                return -1;
+            }
+        }
+    }
+
+    // waits for smash to exit and drains its output
+    void finish() {
+        double deadline = now() + REPLAY_EXIT_TIMEOUT_MS / 1000.0;
+        while (now() < deadline && pump(10)) {
+            if (waitpid(this->pid, nullptr, WNOHANG) == this->pid) {
+                this->pid = -1;
+                while (pump(10) && now() < deadline) {
+                }
+                return;
+            }
+        }
+    }
+
+    const std::string &getOutput() const {
+        return this->output;
+    }
+};
+
+// expected with each {N} matching a run of digits; returns the offset of the first mismatch or npos
+static size_t compareTranscript(const std::string &expected, const std::string &actual) {
+    size_t e = 0, a = 0;
+    while (e < expected.size()) {
+        if (expected.compare(e, strlen(REPLAY_NUMBER), REPLAY_NUMBER) == 0) {
+            if (a >= actual.size() || !isdigit((unsigned char) actual[a])) {
+                return a;
+            }
+            while (a < actual.size() && isdigit((unsigned char) actual[a])) {
+                a++;
+            }
+            e += strlen(REPLAY_NUMBER);
+        } else if (a < actual.size() && expected[e] == actual[a]) {
+            e++;
+            a++;
+        } else {
+            return a;
+        }
+    }
+    return a == actual.size() ? std::string::npos : a;
+}
+
+static std::string normalize(const std::string &output) {
+    std::string result;
+    for (size_t i = 0; i < output.size();) {
+        size_t end = i;
+        while (end < output.size() && isdigit((unsigned char) output[end])) {
+            end++;
+        }
+        if (end - i >= REPLAY_RECORD_MIN_DIGITS) {
+            result += REPLAY_NUMBER;
+            i = end;
+        } else if (end > i) {
+            result += output.substr(i, end - i);
+            i = end;
+        } else {
+            result += output[i++];
+        }
+    }
+    return result;
+}
+
+// returns false with a message if a step timed out
+static bool runSession(const std::string &smash, const std::vector<Step> &steps, const std::string &home,
+                       std::map<std::string, std::vector<double>> &latencies, std::string &output,
+                       std::string &error) {
+    Terminal terminal;
+    if (!terminal.start(smash, home)) {
+        error = "cannot start " + smash;
+        return false;
+    }
+    double last_send = now();
+    bool ok = true;
+    for (auto &step: steps) {
+        if (step.op == "send" || step.op == "latency") {
+            last_send = now();
+            terminal.send(step.text);
+        } else if (step.op == "pause") {
+            usleep((useconds_t) (step.value * 1000));
+            continue;
+        }
+        if (step.expect.empty()) {
+            continue;
+        }
+        double seen = terminal.expect(step.expect, step.op == "expect" ? step.value : REPLAY_EXPECT_TIMEOUT_MS);
+        if (seen < 0) {
+            error = "line " + std::to_string(step.line) + ": timed out waiting for \"" + escape(step.expect) + "\"";
+            ok = false;
+            break;
+        }
+        if (step.op == "latency") {
+            latencies[step.name].push_back((seen - last_send) * 1e6);
+        } else if (step.op == "deadline") {
+            latencies[step.name].push_back((seen - last_send - step.value) * 1e6);
+        }
+    }
+    terminal.finish();
+    output = terminal.getOutput();
+    return ok;
+}
+
+static double percentile(const std::vector<double> &sorted, double fraction) {
+    size_t rank = (size_t) std::ceil(fraction * sorted.size());
+    return sorted[std::min(sorted.size() - 1, rank > 0 ? rank - 1 : 0)];
+}
+
+int main(int argc, char *argv[]) {
+    std::string smash = "./smash";
+    int runs = REPLAY_DEFAULT_RUNS;
+    bool record = false;
+    std::vector<std::string> sessions;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--smash" && i + 1 < argc) {
+            smash = argv[++i];
+        } else if (arg == "--runs" && i + 1 < argc) {
+            runs = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--record") {
+            record = true;
+        } else if (arg[0] == '-') {
+            fprintf(stderr, "usage: %s [--smash path] [--runs N] [--record] session...\n", argv[0]);
+            return 1;
+        } else {
+            sessions.push_back(arg);
+        }
+    }
+    // smash runs in its own home directory
+    char resolved[PATH_MAX];
+    if (realpath(smash.c_str(), resolved) == nullptr) {
+        perror(smash.c_str());
+        return 1;
+    }
+    smash = resolved;
+    char home_template[] = "/tmp/smash_replay.XXXXXX";
+    if (mkdtemp(home_template) == nullptr) {
+        perror("mkdtemp");
+        return 1;
+    }
+    std::string home = home_template;
+    std::map<std::string, std::vector<double>> latencies;
+    bool all_ok = true;
+    printf("{\"harness\": \"smash_replay\", \"runs\": %d, \"sessions\": [", runs);
+    for (size_t s = 0; s < sessions.size(); s++) {
+        std::vector<Step> steps;
+        if (!loadSession(sessions[s], steps)) {
+            return 1;
+        }
+        std::string expected_path = sessions[s].substr(0, sessions[s].rfind(".session")) + ".expected";
+        std::ifstream expected_file(expected_path, std::ios::binary);
+        std::stringstream expected;
+        expected << expected_file.rdbuf();
+        int passed = 0;
+        std::string failure;
+        for (int run = 0; run < (record ? 1 : runs); run++) {
+            unlink((home + "/history").c_str());
+            std::string output, error;
+            bool ok = runSession(smash, steps, home, latencies, output, error);
+            if (record && ok) {
+                std::ofstream(expected_path, std::ios::binary) << normalize(output);
+            } else if (ok && !expected_file) {
+                ok = false;
+                error = expected_path + ": missing, run with --record";
+            } else if (ok) {
+                size_t mismatch = compareTranscript(expected.str(), output);
+                if (mismatch != std::string::npos) {
+                    size_t from = mismatch > 20 ? mismatch - 20 : 0;
+                    error = "transcript differs at byte " + std::to_string(mismatch) + ": \"" +
+                            escape(output.substr(from, 60)) + "\"";
+                    ok = false;
+                }
+            }
+            if (ok) {
+                passed++;
+            } else if (failure.empty()) {
+                failure = error;
+            }
+        }
+        all_ok = all_ok && failure.empty();
+        printf("%s\n    {\"session\": \"%s\", \"passed\": %d, \"failed\": %d%s%s%s}", s == 0 ? "" : ",",
+               escape(sessions[s]).c_str(), passed, (record ? 1 : runs) - passed,
+               failure.empty() ? "" : ", \"error\": \"", escape(failure).c_str(), failure.empty() ? "" : "\"");
+    }
+    printf("\n], \"latency_us\": {");
+    bool first = true;
+    for (auto &entry: latencies) {
+        std::vector<double> &values = entry.second;
+        std::sort(values.begin(), values.end());
+        printf("%s\n    \"%s\": {\"count\": %zu, \"min\": %.0f, \"p50\": %.0f, \"p90\": %.0f, \"p99\": %.0f, "
+               "\"max\": %.0f}", first ? "" : ",", entry.first.c_str(), values.size(), values.front(),
+               percentile(values, 0.5), percentile(values, 0.9), percentile(values, 0.99), values.back());
+        first = false;
+    }
+    printf("\n}}\n");
+    unlink((home + "/history").c_str());
+    rmdir(home.c_str());
+    return all_ok ? 0 : 1;
+}
@@ -0,0 +1,75 @@
+// Soak test for command and job lifecycle: runs a long stream of command lines through
+// SmallShell::executeCommand and checks that the resident set stays flat once warmed up.
+//
+//   cmake --build build --target soak_bench
+//   ./soak_bench [iterations]
+
+#include "../Commands.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#define SOAK_DEFAULT_ITERATIONS     (1000000L)
+#define SOAK_SAMPLES                (10)
+#define SOAK_BG_JOB_EVERY           (10000L)
+#define SOAK_MAX_GROWTH_KB          (512L)
+
+static long residentKb() {
+    long pages_total = 0, pages_resident = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm == nullptr) {
+        return -1;
+    }
+    if (fscanf(statm, "%ld %ld", &pages_total, &pages_resident) != 2) {
+        pages_resident = -1;
+    }
+    fclose(statm);
+    return pages_resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+int main(int argc, char *argv[]) {
+    long iterations = argc > 1 ? atol(argv[1]) : SOAK_DEFAULT_ITERATIONS;
+    const char *lines[] = {
+            "pwd",
+            "showpid",
+            "cd .",
+            "export SOAK_VAR=value",
+            "unset SOAK_VAR",
+            "SOAK_LOCAL=1 && SOAK_LOCAL=2 || SOAK_LOCAL=3",
+            "jobs",
+            "kill -9 1000000",
+            "chprompt soak",
+            "fg 1000000",
+    };
+    size_t num_lines = sizeof(lines) / sizeof(lines[0]);
+
+    // builtin output is not what is being measured
+    int saved_stdout = dup(STDOUT_FILENO);
+    int devnull = open("/dev/null", O_WRONLY);
+    dup2(devnull, STDOUT_FILENO);
+    dup2(devnull, STDERR_FILENO);
+    FILE *report = fdopen(saved_stdout, "w");
+
+    SmallShell &smash = SmallShell::getInstance();
+    long warmup = iterations / SOAK_SAMPLES;
+    long baseline = 0;
+    fprintf(report, "{\"benchmark\": \"soak\", \"iterations\": %ld, \"samples\": [", iterations);
+    for (long i = 1; i <= iterations; i++) {
+        smash.executeCommand(lines[i % num_lines]);
+        if (i % SOAK_BG_JOB_EVERY == 0) {
+            smash.executeCommand("true &");
+        }
+        if (i % (iterations / SOAK_SAMPLES) == 0) {
+            long rss = residentKb();
+            if (i == warmup) {
+                baseline = rss;
+            }
+            fprintf(report, "%s{\"commands\": %ld, \"rss_kb\": %ld}", i == warmup ? "" : ", ", i, rss);
+        }
+    }
+    long growth = residentKb() - baseline;
+    bool flat = growth <= SOAK_MAX_GROWTH_KB;
+    fprintf(report, "], \"growth_after_warmup_kb\": %ld, \"flat\": %s}\n", growth, flat ? "true" : "false");
+    fclose(report);
+    return flat ? 0 : 1;
+}
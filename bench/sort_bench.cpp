@@ -0,0 +1,146 @@
+// Throughput of the sort builtin against GNU sort on a generated access log: ExternalSort sorting it within
+// the default memory budget, and again with a small budget that makes it spill runs and merge them, then
+// GNU sort (LC_ALL=C, the same byte order) with the same budgets. Each writes its output into a pipe that is
+// counted and checksummed, so that a mode that sorts differently from the others fails the benchmark.
+//
+//   cmake --build build --target sort_bench
+//   ./sort_bench [megabytes] [spill budget in megabytes] [directory]
+
+#include "../Sort.h"
+
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+
+#define SORT_BENCH_DEFAULT_MB       (256L)
+#define SORT_BENCH_DEFAULT_SPILL_MB (16L)
+#define SORT_BENCH_SEED             (12345U)
+
+static double now() {
+    timespec ts{};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// lines like "10.0.3.17 - - [GET /api/v1/items/4711] 200 5123", from a few hosts and a skewed set of paths
+static void generate(const std::string &path, long total) {
+    FILE *file = fopen(path.c_str(), "w");
+    if (file == nullptr) {
+        perror("fopen");
+        exit(1);
+    }
+    static const char *methods[] = {"GET", "GET", "GET", "POST", "PUT", "DELETE"};
+    static const int statuses[] = {200, 200, 200, 200, 301, 404, 500};
+    unsigned seed = SORT_BENCH_SEED;
+    long written = 0;
+    while (written < total) {
+        unsigned host = rand_r(&seed) % 256, item = rand_r(&seed) % (1 + rand_r(&seed) % 10000);
+        int len = fprintf(file, "10.0.%u.%u - - [%s /api/v1/items/%u] %d %d\n", host / 16, host,
+                          methods[rand_r(&seed) % 6], item, statuses[rand_r(&seed) % 7], rand_r(&seed) % 65536);
+        written += len;
+    }
+    fclose(file);
+}
+
+// reads the output of a mode to its end; the sum is position-dependent, so that the order counts
+static unsigned long long consume(int fd, unsigned long long &bytes) {
+    static char buffer[SORT_IO_BUFFER];
+    unsigned long long sum = 0;
+    bytes = 0;
+    ssize_t res;
+    while ((res = read(fd, buffer, sizeof buffer)) > 0) {
+        for (ssize_t i = 0; i < res; i++) {
+            sum = sum * 31 + (unsigned char) buffer[i];
+        }
+        bytes += res;
+    }
+    return sum;
+}
+
+static double runMode(const char *mode, const std::string &input, size_t budget, const std::string &directory,
+                      unsigned long long &sum, unsigned long long &bytes) {
+    int fds[2];
+    if (pipe(fds) == -1) {
+        perror("pipe");
+        exit(1);
+    }
+    double start = now();
+    pid_t sorter = fork();
+    if (sorter == 0) {
+        close(fds[0]);
+        if (strcmp(mode, "gnu") == 0) {
+            dup2(fds[1], STDOUT_FILENO);
+            std::string size = "-S" + std::to_string(budget / 1024) + "K";
+            setenv("LC_ALL", "C", 1);
+            execlp("sort", "sort", size.c_str(), "-T", directory.c_str(), input.c_str(), (char *) nullptr);
+            perror("sort");
+            _exit(1);
+        }
+        SortOptions options;
+        options.buffer_size = budget;
+        options.temp_dir = directory;
+        ExternalSort sort(options);
+        int fd = open(input.c_str(), O_RDONLY);
+        bool ok = fd != -1 && sort.add(fd) && sort.finish(fds[1]);
+        if (!ok) {
+            perror(mode);
+        }
+        _exit(ok ? 0 : 1);
+    }
+    close(fds[1]);
+    sum = consume(fds[0], bytes);
+    close(fds[0]);
+    int status;
+    waitpid(sorter, &status, 0);
+    double elapsed = now() - start;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "%s: failed\n", mode);
+        exit(1);
+    }
+    return elapsed;
+}
+
+int main(int argc, char *argv[]) {
+    long megabytes = argc > 1 ? atol(argv[1]) : SORT_BENCH_DEFAULT_MB;
+    long spill_megabytes = argc > 2 ? atol(argv[2]) : SORT_BENCH_DEFAULT_SPILL_MB;
+    std::string directory = argc > 3 ? argv[3] : "/tmp";
+    long total = megabytes * 1024 * 1024;
+    std::string input = directory + "/sort_bench.log";
+    generate(input, total);
+    printf("{\"benchmark\": \"sort\", \"bytes\": %ld, \"spill_budget\": %ld, \"results\": [", total,
+           spill_megabytes * 1024 * 1024);
+    struct {
+        const char *mode;
+        const char *name;
+        size_t budget;
+    } cases[] = {
+            {"smash", "smash", SORT_DEFAULT_BUFFER},
+            {"smash", "smash-spill", (size_t) spill_megabytes * 1024 * 1024},
+            {"gnu",   "gnu",   SORT_DEFAULT_BUFFER},
+            {"gnu",   "gnu-spill", (size_t) spill_megabytes * 1024 * 1024},
+    };
+    unsigned long long expected_sum = 0, expected_bytes = 0;
+    for (size_t i = 0; i < sizeof cases / sizeof cases[0]; i++) {
+        unsigned long long sum, bytes;
+        double elapsed = runMode(cases[i].mode, input, cases[i].budget, directory, sum, bytes);
+        if (i == 0) {
+            expected_sum = sum;
+            expected_bytes = bytes;
+        } else if (sum != expected_sum || bytes != expected_bytes) {
+            fprintf(stderr, "%s: output differs from %s\n", cases[i].name, cases[0].name);
+            unlink(input.c_str());
+            return 1;
+        }
+        printf("%s{\"mode\": \"%s\", \"seconds\": %.3f, \"mbps\": %.1f}", i == 0 ? "" : ", ", cases[i].name,
+               elapsed, total / elapsed / 1e6);
+        fflush(stdout);
+    }
+    printf("]}\n");
+    unlink(input.c_str());
+    return 0;
+}
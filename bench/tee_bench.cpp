@@ -0,0 +1,108 @@
+// Throughput of the tee fan-out: a producer process pushes a fixed amount of data into a pipe and the
+// consumer duplicates it to stdout and N files with StreamTee, once through tee(2)/splice(2) and once
+// through the read()/write() copy. All sinks are /dev/null unless a directory for real files is given.
+//
+//   cmake --build build --target tee_bench
+//   ./tee_bench [megabytes] [files] [directory]
+
+#include "../Tee.h"
+
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+
+#define TEE_BENCH_DEFAULT_MB        (4096L)
+#define TEE_BENCH_DEFAULT_FILES     (2)
+#define TEE_BENCH_CHUNK             (1024 * 1024)
+
+static double now() {
+    timespec ts{};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// vmsplice keeps the producer cheap so that the consumer side is what gets measured
+static void produce(int fd, long total) {
+    static char chunk[TEE_BENCH_CHUNK];
+    memset(chunk, 'x', sizeof chunk);
+    while (total > 0) {
+        iovec iov{chunk, (size_t) std::min<long>(total, sizeof chunk)};
+        ssize_t res = vmsplice(fd, &iov, 1, 0);
+        if (res == -1) {
+            res = write(fd, chunk, iov.iov_len);
+        }
+        if (res <= 0) {
+            break;
+        }
+        total -= res;
+    }
+}
+
+static double runMode(const char *mode, long total, int num_files, const char *directory) {
+    int fds[2];
+    if (pipe(fds) == -1) {
+        perror("pipe");
+        exit(1);
+    }
+    pid_t producer = fork();
+    if (producer == 0) {
+        close(fds[0]);
+        produce(fds[1], total);
+        _exit(0);
+    }
+    close(fds[1]);
+    int out = open("/dev/null", O_WRONLY);
+    std::vector<int> files;
+    for (int i = 0; i < num_files; i++) {
+        if (directory == nullptr) {
+            files.push_back(open("/dev/null", O_WRONLY));
+        } else {
+            std::string path = std::string(directory) + "/tee_bench." + std::to_string(i);
+            files.push_back(open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644));
+        }
+    }
+    StreamTee stream(fds[0], out, files);
+    double start = now();
+    bool ok = strcmp(mode, "splice") == 0 ? stream.run() : stream.runCopy();
+    double elapsed = now() - start;
+    waitpid(producer, nullptr, 0);
+    close(fds[0]);
+    close(out);
+    for (int i = 0; i < num_files; i++) {
+        close(files[i]);
+        if (directory != nullptr) {
+            unlink((std::string(directory) + "/tee_bench." + std::to_string(i)).c_str());
+        }
+    }
+    if (!ok || stream.getTransferred() != (unsigned long long) total) {
+        fprintf(stderr, "%s: moved %llu of %ld bytes\n", mode, stream.getTransferred(), total);
+        exit(1);
+    }
+    return elapsed;
+}
+
+int main(int argc, char *argv[]) {
+    long megabytes = argc > 1 ? atol(argv[1]) : TEE_BENCH_DEFAULT_MB;
+    int num_files = argc > 2 ? atoi(argv[2]) : TEE_BENCH_DEFAULT_FILES;
+    const char *directory = argc > 3 ? argv[3] : nullptr;
+    long total = megabytes * 1024 * 1024;
+    printf("{\"benchmark\": \"tee\", \"bytes\": %ld, \"files\": %d, \"sink\": \"%s\", \"results\": [",
+           total, num_files, directory == nullptr ? "/dev/null" : directory);
+    const char *modes[] = {"splice", "copy"};
+    for (int i = 0; i < 2; i++) {
+        double elapsed = runMode(modes[i], total, num_files, directory);
+        // bytes delivered to every sink, stdout included
+        double fanout_gbps = total * (num_files + 1.0) / elapsed / 1e9;
+        printf("%s{\"mode\": \"%s\", \"seconds\": %.3f, \"input_gbps\": %.2f, \"fanout_gbps\": %.2f}",
+               i == 0 ? "" : ", ", modes[i], elapsed, total / elapsed / 1e9, fanout_gbps);
+    }
+    printf("]}\n");
+    return 0;
+}
@@ -0,0 +1,87 @@
+// Example smash plugin: basename and dirname, which scripts tend to call once per file.
+//
+//   gcc -std=c11 -O2 -shared -fPIC -I.. example_plugin.c -o example_plugin.so
+//   smash> load ./plugins/example_plugin.so
+//   smash> basename /usr/lib/libc.so .so
+
+#include "smash_plugin.h"
+
+#include <string.h>
+#include <unistd.h>
+
+SMASH_PLUGIN_DECLARE();
+
+static int writeLine(int fd, const char *text, size_t len) {
+    char line[4096];
+    if (len >= sizeof line) {
+        len = sizeof line - 1;
+    }
+    memcpy(line, text, len);
+    line[len] = '\n';
+    return write(fd, line, len + 1) == (ssize_t) (len + 1) ? 0 : 1;
+}
+
+static int usage(const smash_io *io, const char *message) {
+    write(io->err_fd, message, strlen(message));
+    return 1;
+}
+
+// the path without trailing slashes, as [start, end)
+static void trimSlashes(const char *path, size_t *end) {
+    while (*end > 1 && path[*end - 1] == '/') {
+        (*end)--;
+    }
+}
+
+static int basenameCommand(int argc, char **argv, const smash_io *io, void *data) {
+    (void) data;
+    if (argc < 2 || argc > 3) {
+        return usage(io, "usage: basename path [suffix]\n");
+    }
+    const char *path = argv[1];
+    size_t end = strlen(path);
+    trimSlashes(path, &end);
+    size_t start = end;
+    while (start > 0 && path[start - 1] != '/') {
+        start--;
+    }
+    if (end == 1 && path[0] == '/') {
+        start = 0;
+    }
+    if (argc == 3) {
+        size_t suffix = strlen(argv[2]);
+        if (suffix < end - start && memcmp(path + end - suffix, argv[2], suffix) == 0) {
+            end -= suffix;
+        }
+    }
+    return writeLine(io->out_fd, path + start, end - start);
+}
+
+static int dirnameCommand(int argc, char **argv, const smash_io *io, void *data) {
+    (void) data;
+    if (argc != 2) {
+        return usage(io, "usage: dirname path\n");
+    }
+    const char *path = argv[1];
+    size_t end = strlen(path);
+    trimSlashes(path, &end);
+    while (end > 0 && path[end - 1] != '/') {
+        end--;
+    }
+    if (end == 0) {
+        return writeLine(io->out_fd, ".", 1);
+    }
+    trimSlashes(path, &end);
+    return writeLine(io->out_fd, path, end);
+}
+
+SMASH_PLUGIN_EXPORT int smash_plugin_init(const smash_plugin_host *host) {
+    if (host->abi_version < SMASH_PLUGIN_ABI_VERSION) {
+        return 1;
+    }
+    if (host->register_builtin(host->context, "basename", basenameCommand, NULL) != 0 ||
+        host->register_builtin(host->context, "dirname", dirnameCommand, NULL) != 0) {
+        return 1;
+    }
+    return 0;
+}
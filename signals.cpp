@@ -3,32 +3,45 @@
 
 using namespace std;
 
+// smashError prints through the shell's buffered streams, which the interrupted code may be in the middle of
+static void _killFailed() {
+    static const char message[] = "smash error: kill failed\n";
+    write(STDERR_FILENO, message, sizeof message - 1);
+}
+
 void ctrlZHandler(int sig_num) {
     SmallShell& small_shell = SmallShell::getInstance();
+    Trace::event(TRACE_SIGNAL, 0, sig_num);
     cout << "smash: got ctrl-Z" << endl;
     if(small_shell.getActiveCMD() == nullptr){
         return;
     }
-    int res = kill(small_shell.getActiveCMD()->getCmdPID(), SIGSTOP);
+    int res = small_shell.getActiveCMD()->sendSignal(SIGSTOP);
     if (res != SUCCESS){
-        smashError::SyscallFailed("kill");
+        _killFailed();
         return;
     }
     cout << "smash: process " << small_shell.getActiveCMD()->getCmdPID()  << " was stopped" << endl;
-    small_shell.addJobShell(small_shell.getActiveCMD(),true);
+    // the waiting side sees the stop through waitpid and moves the command into the jobs list
     small_shell.setActiveCMD(nullptr);
 }
 
 void ctrlCHandler(int sig_num) {
     SmallShell& small_shell = SmallShell::getInstance();
+    Trace::event(TRACE_SIGNAL, 0, sig_num);
     cout << "smash: got ctrl-C" << endl;
-    if(small_shell.getActiveCMD() == nullptr || waitpid(small_shell.getActiveCMD()->getCmdPID(), nullptr, WNOHANG) != 0){
+    small_shell.interrupt();
+    if(small_shell.getActiveCMD() == nullptr){
+        return;
+    }
+    // only signalled here: the foreground wait reaps it, which the handler must not race with
+    int res = small_shell.getActiveCMD()->sendSignal(SIGKILL);
+    if (res != SUCCESS && errno == ESRCH){
         small_shell.setActiveCMD(nullptr);
         return;
     }
-    int res = kill(small_shell.getActiveCMD()->getCmdPID(), SIGKILL);
     if (res != SUCCESS){
-        smashError::SyscallFailed("kill");
+        _killFailed();
         return;
     }
     cout << "smash: process " << small_shell.getActiveCMD()->getCmdPID() << " was killed" << endl;
@@ -38,6 +51,7 @@ void ctrlCHandler(int sig_num) {
 void alarmHandler(int sig_num) {
     cout << "smash: got an alarm" << endl;
     SmallShell& small_shell = SmallShell::getInstance();
+    Trace::event(TRACE_SIGNAL, 0, sig_num);
     if(small_shell.getActiveCMD() != nullptr && waitpid(small_shell.getTimeoutPid(), NULL, WNOHANG) != 0){
         small_shell.removeJobByPID(small_shell.getTimeoutPid());
         small_shell.timeoutRemoveByPID(small_shell.getTimeoutPid());
@@ -46,9 +60,10 @@ void alarmHandler(int sig_num) {
     int res = kill(small_shell.getTimeoutPid(), SIGKILL);
     if(res != 0)
     {
-        smashError::SyscallFailed("kill");
+        _killFailed();
         return;
     }
+    Trace::event(TRACE_JOB_TIMEOUT, small_shell.getTimeoutPid());
     cout << "smash: " << small_shell.getTimeoutCmdLine()  << " timed out!" << endl;
     small_shell.timeoutRemoveByPID(small_shell.getTimeoutPid());
 }
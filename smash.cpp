@@ -2,6 +2,74 @@
 #include <unistd.h>
 #include <sys/wait.h>
 #include "signals.h"
+#include "ControlSocket.h"
+#include "LineEditor.h"
+#include <poll.h>
+
+#define INPUT_CHUNK_SIZE    (4096)
+
+// reads lines from stdin, serving the control socket while waiting for input
+static bool readLine(ControlServer &control, std::string &pending, std::string &line) {
+    size_t newline;
+    while ((newline = pending.find('\n')) == std::string::npos) {
+        if (control.isListening() && !control.waitForInput(STDIN_FILENO)) {
+            return false;
+        }
+        if (SmallShell::getInstance().consumeInterrupt()) {
+            continue;
+        }
+        char buffer[INPUT_CHUNK_SIZE];
+        ssize_t res = read(STDIN_FILENO, buffer, sizeof buffer);
+        if (res == -1 && errno == EINTR) {
+            continue;
+        }
+        if (res <= 0) {
+            if (pending.empty()) {
+                return false;
+            }
+            line.swap(pending);
+            pending.clear();
+            return true;
+        }
+        pending.append(buffer, res);
+    }
+    line = pending.substr(0, newline);
+    pending.erase(0, newline + 1);
+    return true;
+}
+
+// reads a line through the line editor; stdin is polled (not just read) so that ctrl-C can drop the line
+static bool editLine(ControlServer &control, LineEditor &editor, const std::string &prompt, std::string &line) {
+    SmallShell &smash = SmallShell::getInstance();
+    editor.begin(prompt);
+    EditResult result = editor.feed(nullptr, 0, line);
+    while (result == EDIT_MORE) {
+        if (control.isListening()) {
+            if (!control.waitForInput(STDIN_FILENO)) {
+                editor.end();
+                return false;
+            }
+        } else {
+            pollfd input{STDIN_FILENO, POLLIN, 0};
+            poll(&input, 1, -1);
+        }
+        if (smash.consumeInterrupt()) {
+            editor.cancel();
+            continue;
+        }
+        char buffer[INPUT_CHUNK_SIZE];
+        ssize_t res = read(STDIN_FILENO, buffer, sizeof buffer);
+        if (res == -1 && errno == EINTR) {
+            continue;
+        }
+        if (res <= 0) {
+            editor.end();
+            return false;
+        }
+        result = editor.feed(buffer, res, line);
+    }
+    return result == EDIT_LINE;
+}
 
 int main(int argc, char* argv[]) {
 
@@ -19,14 +87,56 @@ int main(int argc, char* argv[]) {
     }
 
     SmallShell& smash = SmallShell::getInstance();
+    ControlServer control;
+    std::string control_path = smash.getEnvironment().get("SMASH_CONTROL_SOCKET");
+    for (int i = 1; i + 1 < argc; i++) {
+        if (std::string(argv[i]) == "--control-socket") {
+            control_path = argv[i + 1];
+        }
+    }
+    if (!control_path.empty()) {
+        control.listen(control_path);
+    }
+
+    // shared by every smash of the user unless SMASH_HISTFILE points elsewhere
+    std::string history_path = smash.getEnvironment().get("SMASH_HISTFILE");
+    if (history_path.empty() && !smash.getEnvironment().get("HOME").empty()) {
+        history_path = smash.getEnvironment().get("HOME") + "/.smash_history";
+    }
+    if (!history_path.empty()) {
+        smash.getHistory().open(history_path);
+    }
+
+    // traces the whole session, e.g. a slow batch run, and dumps it when smash exits
+    std::string trace_path = smash.getEnvironment().get(TRACE_ENV);
+    if (!trace_path.empty()) {
+        Trace::enabled = true;
+    }
+
+    std::string pending;
+    LineEditor editor(smash.getHistory());
+    bool interactive = isatty(STDIN_FILENO) && isatty(STDOUT_FILENO);
     while(smash.getActiveStatus()) {
-        std::cout << smash.getChprompt();
+        // anything reported outside of a command, e.g. by the control socket
+        OutputSink::flushStandard();
         std::string cmd_line;
-        std::getline(std::cin, cmd_line);
+        if (interactive) {
+            if (!editLine(control, editor, smash.getChprompt(), cmd_line)) {
+                break;
+            }
+        } else {
+            std::cout << smash.getChprompt() << std::flush;
+            if (!readLine(control, pending, cmd_line)) {
+                break;
+            }
+        }
         if(cmd_line.size()>0)
         {
             smash.executeCommand(cmd_line.c_str());
         }
     }
+    if (!trace_path.empty() && !Trace::dump(trace_path)) {
+        perror("smash error: trace dump failed");
+    }
     return 0 ;
-}
\ No newline at end of file
+}
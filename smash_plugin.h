@@ -0,0 +1,59 @@
+#ifndef SMASH_PLUGIN_ABI_H_
+#define SMASH_PLUGIN_ABI_H_
+
+/*
+ * The C interface between smash and builtin plugins loaded with `load /path/plugin.so`.
+ *
+ * A plugin is a shared object exporting smash_plugin_abi_version (use SMASH_PLUGIN_DECLARE()) and
+ * smash_plugin_init(). smash calls the latter once after dlopen(); it registers its commands through the
+ * host and returns 0, or anything else to refuse loading. A registered command runs inside smash itself:
+ * it gets the command line split into argv and the descriptors its stdin, stdout and stderr were
+ * redirected to, and returns its exit status. Descriptors belong to smash and must not be closed.
+ *
+ * Only new members may be added at the end of these structs; anything else bumps the version.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SMASH_PLUGIN_ABI_VERSION    1
+
+typedef struct smash_io {
+    int in_fd;
+    int out_fd;
+    int err_fd;
+} smash_io;
+
+typedef int (*smash_builtin_fn)(int argc, char **argv, const smash_io *io, void *data);
+
+typedef struct smash_plugin_host {
+    unsigned abi_version;
+    // passed back as the first argument of every callback
+    void *context;
+    // data is handed to fn on every call; returns 0 on success
+    int (*register_builtin)(void *context, const char *name, smash_builtin_fn fn, void *data);
+    // copies the value of a shell variable into buffer (always terminated) and returns its full length,
+    // or -1 if it is not set
+    long (*get_var)(void *context, const char *name, char *buffer, unsigned long size);
+} smash_plugin_host;
+
+typedef int (*smash_plugin_init_fn)(const smash_plugin_host *host);
+
+#define SMASH_PLUGIN_INIT_SYMBOL    "smash_plugin_init"
+#define SMASH_PLUGIN_ABI_SYMBOL     "smash_plugin_abi_version"
+
+#ifdef __cplusplus
+#define SMASH_PLUGIN_EXPORT extern "C" __attribute__((visibility("default")))
+#else
+#define SMASH_PLUGIN_EXPORT __attribute__((visibility("default")))
+#endif
+
+#define SMASH_PLUGIN_DECLARE() \
+    SMASH_PLUGIN_EXPORT const unsigned smash_plugin_abi_version = SMASH_PLUGIN_ABI_VERSION
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //SMASH_PLUGIN_ABI_H_